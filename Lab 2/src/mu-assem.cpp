@@ -94,7 +94,7 @@ inline std::string B_assemble_instruction(std::string instruction, std::string r
     uint32_t address = branch_map[imm];
 
     //Creating the instruction
-    imm = to_binary(address - PC - 4, 13);
+    imm = to_binary(address - PC, 13);
     std::string assemble_instruction = imm.substr(13-12-1,1); //[12]
     assemble_instruction += imm.substr(13-10-1,10-5+1); //[10:5]
     assemble_instruction += to_binary(register_map[rs2], 5);
@@ -146,7 +146,7 @@ inline std::string J_assemble_instruction(std::string instruction, std::string i
         return NULL;
     }
 
-    imm = to_binary(std::stoi(imm)- PC - 4, 21);
+    imm = to_binary(std::stoi(imm) - PC, 21);
     std::string assemble_instruction = imm.substr(21-20-1,1); //[20]
     assemble_instruction +=  imm.substr(21-10-1,10-1+1); //[10:1]
     assemble_instruction += imm[21-11-1]; //[11]
@@ -0,0 +1,255 @@
+#ifndef MU_DECODE_H
+#define MU_DECODE_H
+
+#include <stdint.h>
+
+/***************************************************************/
+/* RV32IM instruction decoder, shared by the functional simulator, the */
+/* pipeline and the disassemblers.                                                     */
+/*                                                                                                    */
+/* Every instruction is described once in ISA_LIST; the lookup tables  */
+/* below are expanded from it by the preprocessor, so they are constant */
+/* data and isa_decode() is two table loads and a compare, no branches. */
+/***************************************************************/
+
+/* operand layouts: decide the immediate encoding and the disassembly syntax */
+enum isa_format {
+	FMT_NONE,	/* invalid word */
+	FMT_R,		/* rd, rs1, rs2 */
+	FMT_I,		/* rd, rs1, imm */
+	FMT_SHIFT,	/* rd, rs1, shamt (I-type with funct7 in imm[11:5]) */
+	FMT_LOAD,	/* rd, imm(rs1) (I-type loads and jalr) */
+	FMT_S,		/* rs2, imm(rs1) */
+	FMT_B,		/* rs1, rs2, pc-relative offset */
+	FMT_U,		/* rd, imm[31:12] */
+	FMT_J,		/* rd, pc-relative offset */
+	FMT_COUNT
+};
+
+/* funct3/funct7 value for instructions that do not decode that field */
+#define ISA_ANY 0x80
+
+/* name, mnemonic, format, opcode, funct3, funct7 */
+#define ISA_LIST(X) \
+	X(LUI,   "lui",   FMT_U,     0x37, ISA_ANY, ISA_ANY) \
+	X(AUIPC, "auipc", FMT_U,     0x17, ISA_ANY, ISA_ANY) \
+	X(JAL,   "jal",   FMT_J,     0x6F, ISA_ANY, ISA_ANY) \
+	X(JALR,  "jalr",  FMT_LOAD,  0x67, 0x0, ISA_ANY) \
+	X(BEQ,   "beq",   FMT_B,     0x63, 0x0, ISA_ANY) \
+	X(BNE,   "bne",   FMT_B,     0x63, 0x1, ISA_ANY) \
+	X(BLT,   "blt",   FMT_B,     0x63, 0x4, ISA_ANY) \
+	X(BGE,   "bge",   FMT_B,     0x63, 0x5, ISA_ANY) \
+	X(BLTU,  "bltu",  FMT_B,     0x63, 0x6, ISA_ANY) \
+	X(BGEU,  "bgeu",  FMT_B,     0x63, 0x7, ISA_ANY) \
+	X(LB,    "lb",    FMT_LOAD,  0x03, 0x0, ISA_ANY) \
+	X(LH,    "lh",    FMT_LOAD,  0x03, 0x1, ISA_ANY) \
+	X(LW,    "lw",    FMT_LOAD,  0x03, 0x2, ISA_ANY) \
+	X(LBU,   "lbu",   FMT_LOAD,  0x03, 0x4, ISA_ANY) \
+	X(LHU,   "lhu",   FMT_LOAD,  0x03, 0x5, ISA_ANY) \
+	X(SB,    "sb",    FMT_S,     0x23, 0x0, ISA_ANY) \
+	X(SH,    "sh",    FMT_S,     0x23, 0x1, ISA_ANY) \
+	X(SW,    "sw",    FMT_S,     0x23, 0x2, ISA_ANY) \
+	X(ADDI,  "addi",  FMT_I,     0x13, 0x0, ISA_ANY) \
+	X(SLTI,  "slti",  FMT_I,     0x13, 0x2, ISA_ANY) \
+	X(SLTIU, "sltiu", FMT_I,     0x13, 0x3, ISA_ANY) \
+	X(XORI,  "xori",  FMT_I,     0x13, 0x4, ISA_ANY) \
+	X(ORI,   "ori",   FMT_I,     0x13, 0x6, ISA_ANY) \
+	X(ANDI,  "andi",  FMT_I,     0x13, 0x7, ISA_ANY) \
+	X(SLLI,  "slli",  FMT_SHIFT, 0x13, 0x1, 0x00) \
+	X(SRLI,  "srli",  FMT_SHIFT, 0x13, 0x5, 0x00) \
+	X(SRAI,  "srai",  FMT_SHIFT, 0x13, 0x5, 0x20) \
+	X(ADD,   "add",   FMT_R,     0x33, 0x0, 0x00) \
+	X(SUB,   "sub",   FMT_R,     0x33, 0x0, 0x20) \
+	X(SLL,   "sll",   FMT_R,     0x33, 0x1, 0x00) \
+	X(SLT,   "slt",   FMT_R,     0x33, 0x2, 0x00) \
+	X(SLTU,  "sltu",  FMT_R,     0x33, 0x3, 0x00) \
+	X(XOR,   "xor",   FMT_R,     0x33, 0x4, 0x00) \
+	X(SRL,   "srl",   FMT_R,     0x33, 0x5, 0x00) \
+	X(SRA,   "sra",   FMT_R,     0x33, 0x5, 0x20) \
+	X(OR,    "or",    FMT_R,     0x33, 0x6, 0x00) \
+	X(AND,   "and",   FMT_R,     0x33, 0x7, 0x00) \
+	X(MUL,   "mul",   FMT_R,     0x33, 0x0, 0x01) \
+	X(MULH,  "mulh",  FMT_R,     0x33, 0x1, 0x01) \
+	X(MULHSU,"mulhsu",FMT_R,     0x33, 0x2, 0x01) \
+	X(MULHU, "mulhu", FMT_R,     0x33, 0x3, 0x01) \
+	X(DIV,   "div",   FMT_R,     0x33, 0x4, 0x01) \
+	X(DIVU,  "divu",  FMT_R,     0x33, 0x5, 0x01) \
+	X(REM,   "rem",   FMT_R,     0x33, 0x6, 0x01) \
+	X(REMU,  "remu",  FMT_R,     0x33, 0x7, 0x01)
+
+#define ISA_ENUM(name, mnemonic, format, opcode, f3, f7) INST_##name,
+enum isa_inst { INST_INVALID, ISA_LIST(ISA_ENUM) INST_COUNT };
+
+/* bits that must match exactly once the table has picked a candidate */
+#define ISA_MASK_OF(opcode, f3, f7) \
+	(0x7Fu | ((f3) == ISA_ANY ? 0u : 0x7000u) | ((f7) == ISA_ANY ? 0u : 0xFE000000u))
+#define ISA_MATCH_OF(opcode, f3, f7) \
+	((uint32_t)(opcode) | ((f3) == ISA_ANY ? 0u : (uint32_t)(f3) << 12) | ((f7) == ISA_ANY ? 0u : (uint32_t)(f7) << 25))
+
+#define ISA_NAME_ENTRY(name, mnemonic, format, opcode, f3, f7) [INST_##name] = mnemonic,
+#define ISA_FORMAT_ENTRY(name, mnemonic, format, opcode, f3, f7) [INST_##name] = format,
+#define ISA_MASK_ENTRY(name, mnemonic, format, opcode, f3, f7) [INST_##name] = ISA_MASK_OF(opcode, f3, f7),
+#define ISA_MATCH_ENTRY(name, mnemonic, format, opcode, f3, f7) [INST_##name] = ISA_MATCH_OF(opcode, f3, f7),
+
+static const char *const ISA_NAME[INST_COUNT] = { [INST_INVALID] = "unknown", ISA_LIST(ISA_NAME_ENTRY) };
+static const uint8_t ISA_FORMAT[INST_COUNT] = { ISA_LIST(ISA_FORMAT_ENTRY) };
+static const uint32_t ISA_MASK[INST_COUNT] = { ISA_LIST(ISA_MASK_ENTRY) };
+static const uint32_t ISA_MATCH[INST_COUNT] = { ISA_LIST(ISA_MATCH_ENTRY) };
+
+/* formats whose rd field is a destination register */
+static const uint8_t FMT_WRITES_RD[FMT_COUNT] = {
+	[FMT_R] = 1, [FMT_I] = 1, [FMT_SHIFT] = 1, [FMT_LOAD] = 1, [FMT_U] = 1, [FMT_J] = 1
+};
+
+/*
+ * The lookup key is opcode[6:2] followed by funct3, instr[30] and instr[25],
+ * with the fields an opcode does not decode masked off by ISA_KEY_MASK.
+ * An instruction that ignores funct7 is entered under both values of bit 30.
+ */
+#define ISA_KEY(opcode, f3, b30, b25) \
+	((((opcode) >> 2) & 0x1F) << 5 | ((f3) & 0x7) << 2 | (b30) << 1 | (b25))
+#define ISA_B30(f7) (((f7) == ISA_ANY ? 0 : (f7) >> 5) & 1)
+#define ISA_B25(f7) (((f7) == ISA_ANY ? 0 : (f7)) & 1)
+#define ISA_TABLE_ENTRY(name, mnemonic, format, opcode, f3, f7) \
+	[ISA_KEY(opcode, f3, ISA_B30(f7), ISA_B25(f7))] = INST_##name, \
+	[ISA_KEY(opcode, f3, ISA_B30(f7) | ((f7) == ISA_ANY), ISA_B25(f7))] = INST_##name,
+
+static const uint8_t ISA_KEY_MASK[32] = {
+	[0x03 >> 2] = 0x1C, [0x23 >> 2] = 0x1C, [0x63 >> 2] = 0x1C, [0x67 >> 2] = 0x1C,	/* funct3 */
+	[0x13 >> 2] = 0x1E,	/* funct3, bit 30 for srli/srai */
+	[0x33 >> 2] = 0x1F,	/* funct3 and funct7 */
+};
+static const uint8_t ISA_TABLE[32 << 5] = { ISA_LIST(ISA_TABLE_ENTRY) };
+
+/* enum isa_inst of an instruction word, INST_INVALID if it is not RV32IM */
+static inline uint32_t isa_decode(uint32_t instruction)
+{
+	uint32_t opcode = (instruction >> 2) & 0x1F;
+	uint32_t key = ((instruction >> 10) & 0x1C) | ((instruction >> 29) & 0x2) | ((instruction >> 25) & 0x1);
+	uint32_t id = ISA_TABLE[(opcode << 5) | (key & ISA_KEY_MASK[opcode])];
+
+	return (instruction & ISA_MASK[id]) == ISA_MATCH[id] ? id : INST_INVALID;
+}
+
+/* sign-extended immediate of an instruction word for its format */
+static inline int32_t isa_imm(uint32_t instruction, uint32_t format)
+{
+	int32_t word = (int32_t)instruction;
+	int32_t imm[FMT_COUNT];
+
+	imm[FMT_NONE] = 0;
+	imm[FMT_R] = 0;
+	imm[FMT_I] = word >> 20;
+	imm[FMT_SHIFT] = (instruction >> 20) & 0x1F;
+	imm[FMT_LOAD] = word >> 20;
+	imm[FMT_S] = ((word >> 20) & ~0x1F) | ((instruction >> 7) & 0x1F);
+	imm[FMT_B] = ((word >> 19) & ~0xFFF) | ((instruction << 4) & 0x800) |
+		((instruction >> 20) & 0x7E0) | ((instruction >> 7) & 0x1E);
+	imm[FMT_U] = word & ~0xFFF;
+	imm[FMT_J] = ((word >> 11) & ~0xFFFFF) | (instruction & 0xFF000) |
+		((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7FE);
+	return imm[format];
+}
+
+/* RV32M: multiplies go to a pipelined multiplier, divides and remainders to an iterative divider */
+static inline int isa_is_mul(uint32_t id)
+{
+	return id >= INST_MUL && id <= INST_MULHU;
+}
+
+static inline int isa_is_div(uint32_t id)
+{
+	return id >= INST_DIV && id <= INST_REMU;
+}
+
+/* whether a conditional branch is taken, 0 for every other instruction */
+static inline int isa_taken(uint32_t id, uint32_t a, uint32_t b)
+{
+	switch (id) {
+	case INST_BEQ: return a == b;
+	case INST_BNE: return a != b;
+	case INST_BLT: return (int32_t)a < (int32_t)b;
+	case INST_BGE: return (int32_t)a >= (int32_t)b;
+	case INST_BLTU: return a < b;
+	case INST_BGEU: return a >= b;
+	default: return 0;
+	}
+}
+
+/*
+ * What an instruction computes from its operands a (rs1) and b (rs2):
+ * the ALU result, the effective address of a load or store, the return
+ * address of a jump, or the next PC of a conditional branch.
+ */
+static inline uint32_t isa_execute(uint32_t id, uint32_t a, uint32_t b, uint32_t imm, uint32_t pc)
+{
+	switch (id) {
+	case INST_ADD: return a + b;
+	case INST_SUB: return a - b;
+	case INST_SLL: return a << (b & 0x1F);
+	case INST_SLT: return (int32_t)a < (int32_t)b;
+	case INST_SLTU: return a < b;
+	case INST_XOR: return a ^ b;
+	case INST_SRL: return a >> (b & 0x1F);
+	case INST_SRA: return (int32_t)a >> (b & 0x1F);
+	case INST_OR: return a | b;
+	case INST_AND: return a & b;
+
+	/* division by zero and the one signed overflow do not trap, as the spec has it */
+	case INST_MUL: return a * b;
+	case INST_MULH: return (uint32_t)(((int64_t)(int32_t)a * (int32_t)b) >> 32);
+	case INST_MULHSU: return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+	case INST_MULHU: return (uint32_t)(((uint64_t)a * b) >> 32);
+	case INST_DIV:
+		return b == 0 ? 0xFFFFFFFFu : a == 0x80000000u && b == 0xFFFFFFFFu ? a : (uint32_t)((int32_t)a / (int32_t)b);
+	case INST_DIVU: return b == 0 ? 0xFFFFFFFFu : a / b;
+	case INST_REM:
+		return b == 0 ? a : a == 0x80000000u && b == 0xFFFFFFFFu ? 0 : (uint32_t)((int32_t)a % (int32_t)b);
+	case INST_REMU: return b == 0 ? a : a % b;
+
+	/* imm is the shift amount for the shifts */
+	case INST_ADDI: return a + imm;
+	case INST_SLTI: return (int32_t)a < (int32_t)imm;
+	case INST_SLTIU: return a < imm;
+	case INST_XORI: return a ^ imm;
+	case INST_ORI: return a | imm;
+	case INST_ANDI: return a & imm;
+	case INST_SLLI: return a << imm;
+	case INST_SRLI: return a >> imm;
+	case INST_SRAI: return (int32_t)a >> imm;
+
+	case INST_LB: case INST_LH: case INST_LW: case INST_LBU: case INST_LHU:
+	case INST_SB: case INST_SH: case INST_SW:
+		return a + imm;
+
+	case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU:
+		return isa_taken(id, a, b) ? pc + imm : pc + 4;
+
+	case INST_LUI: return imm;
+	case INST_AUIPC: return pc + imm;
+	case INST_JAL: case INST_JALR: return pc + 4;
+	default: return 0;
+	}
+}
+
+/*
+ * Cycles an iterative divider with early out spends on a divide or
+ * remainder: one step per quotient bit, scaled so a full 32-bit quotient
+ * takes latency cycles. Dividing by zero or by something larger takes one.
+ */
+static inline uint32_t isa_div_cycles(uint32_t id, uint32_t a, uint32_t b, uint32_t latency)
+{
+	uint32_t bits;
+
+	if (id == INST_DIV || id == INST_REM) {
+		a = (int32_t)a < 0 ? 0u - a : a;
+		b = (int32_t)b < 0 ? 0u - b : b;
+	}
+	if (b == 0 || a < b) {
+		return 1;
+	}
+	bits = __builtin_clz(b) - __builtin_clz(a) + 1;
+	return (latency * bits + 31) / 32;
+}
+
+#endif
@@ -3,9 +3,20 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define MU_JIT 1
+#include <sys/mman.h>
+#else
+#define MU_JIT 0
+#endif
 
 #include "mu-riscv.h"
 #include "mu-assem.h"
+#include "mu-decode.h"
 
 /***************************************************************/
 /* Print out a list of commands available                                                                  */
@@ -16,12 +27,21 @@ void help() {
 	printf("sim\t-- simulate program to completion \n");
 	printf("run <n>\t-- simulate program for <n> instructions\n");
 	printf("rdump\t-- dump register values\n");
-	printf("reset\t-- clears all registers/memory and re-loads the program\n");
+	printf("reset\t-- restores all registers/memory to the freshly loaded program\n");
 	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
 	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
+	printf("mdiff <load|checkpoint>\t-- list words changed since load or the last checkpoint\n");
+	printf("checkpoint\t-- start a new checkpoint for mdiff\n");
 	printf("high <val>\t-- set the HI register to <val>\n");
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
+	printf("stats\t-- show memory pages touched and resident bytes\n");
+	printf("bench mem\t-- time memory accesses per second\n");
+	printf("bench decode\t-- time instruction decodes per second\n");
+	printf("bench run\t-- time the program from the current state in both interpreters\n");
+	printf("fast\t-- toggle the threaded interpreter for run/sim\n");
+	printf("jit\t-- toggle translating basic blocks to x86-64 for run/sim\n");
+	printf("trace\t-- show hot-loop traces built by the threaded interpreter and their hit rate\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
@@ -43,73 +63,240 @@ uint32_t half_to_word(uint16_t half)
     return (half & 0x8000) ? (half | 0xffff8000) : half;
 }
 
-int32_t signExtend_13b(uint32_t number)
-{
-    // Appending leading zeroes to
-    // the 23-bit number
-    int32_t ans = number & 0x00001FFF;
- 
-    // Checking if sign-bit of number is 0 or 1
-    if (number & 0x00001000) {
- 
-        // If number is negative, append
-        // leading 1's to the 21-bit sequence
-        ans = ans | 0xFFFFE000;
-    }
- 
-    return ans;
+/***************************************************************/
+/* Find the memory region holding an address (NULL if unmapped)                  */
+/***************************************************************/
+mem_region_t *mem_region(uint32_t address) {
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if ((address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end)) {
+			return &MEM_REGIONS[i];
+		}
+	}
+	return NULL;
 }
 
-int32_t signExtend_21b(uint32_t number)
-{
-    // Appending leading zeroes to
-    // the 21-bit number
-    int32_t ans = number & 0x001FFFFF;
- 
-    // Checking if sign-bit of number is 0 or 1
-    if (number & 0x00100000) {
- 
-        // If number is negative, append
-        // leading 1's to the 21-bit sequence
-        ans = ans | 0xFFE00000;
-    }
- 
-    return ans;
+/***************************************************************/
+/* Remember that a page has diverged from the snapshot                                */
+/***************************************************************/
+void mem_mark_dirty(uint32_t page_num) {
+	if (MEM_BIT_TEST(MEM_DIRTY_BITS, page_num)) {
+		return;
+	}
+	MEM_BIT_SET(MEM_DIRTY_BITS, page_num);
+
+	if (MEM_DIRTY_COUNT == MEM_DIRTY_CAPACITY) {
+		MEM_DIRTY_CAPACITY = MEM_DIRTY_CAPACITY ? 2 * MEM_DIRTY_CAPACITY : 256;
+		MEM_DIRTY_LIST = realloc(MEM_DIRTY_LIST, MEM_DIRTY_CAPACITY * sizeof(uint32_t));
+		if (MEM_DIRTY_LIST == NULL) {
+			printf("Error: Out of memory tracking dirty pages\n");
+			exit(-1);
+		}
+	}
+	MEM_DIRTY_LIST[MEM_DIRTY_COUNT++] = page_num;
+}
+
+/***************************************************************/
+/* First write since the checkpoint: keep the old page to diff against       */
+/***************************************************************/
+void mem_mark_checkpoint(uint32_t page_num) {
+	uint8_t *page = MEM_PAGE_TABLE[page_num];
+
+	MEM_BIT_SET(MEM_CHECKPOINT_BITS, page_num);
+
+	// Before any checkpoint the snapshot already holds the old contents
+	if (CHECKPOINT_TAKEN && page != NULL) {
+		MEM_CHECKPOINT_TABLE[page_num] = malloc(MEM_PAGE_SIZE);
+		if (MEM_CHECKPOINT_TABLE[page_num] == NULL) {
+			printf("Error: Out of memory saving checkpoint page\n");
+			exit(-1);
+		}
+		memcpy(MEM_CHECKPOINT_TABLE[page_num], page, MEM_PAGE_SIZE);
+	}
+}
+
+/***************************************************************/
+/* Write fault: give a page its own copy before it is first written              */
+/***************************************************************/
+uint8_t *mem_write_fault(uint32_t address) {
+	uint32_t page_num = address >> MEM_PAGE_SHIFT;
+	uint8_t *page = MEM_PAGE_TABLE[page_num];
+	uint8_t *shared = MEM_SNAPSHOT_TABLE[page_num];
+
+	// Writes outside every region are dropped
+	if (page == NULL && mem_region(address) == NULL) {
+		return NULL;
+	}
+
+	if (!MEM_BIT_TEST(MEM_CHECKPOINT_BITS, page_num)) {
+		mem_mark_checkpoint(page_num);
+	}
+
+	// A missing page reads as zero and a snapshot page is shared with the
+	// load image, so either way the write needs a private page
+	if (page == NULL || page == shared) {
+		page = malloc(MEM_PAGE_SIZE);
+		if (page == NULL) {
+			printf("Error: Out of memory allocating page 0x%08x\n", address & ~MEM_PAGE_MASK);
+			exit(-1);
+		}
+		if (shared != NULL) {
+			memcpy(page, shared, MEM_PAGE_SIZE);
+		} else {
+			memset(page, 0, MEM_PAGE_SIZE);
+		}
+		MEM_PAGE_TABLE[page_num] = page;
+		mem_region(address)->touched++;
+		mem_mark_dirty(page_num);
+
+		if (LAST_PAGE_NUM == page_num) {
+			LAST_PAGE = page;
+		}
+	}
+
+	LAST_WRITE_PAGE_NUM = page_num;
+	LAST_WRITE_PAGE = page;
+	return page;
+}
+
+/***************************************************************/
+/* Host page holding a guest address, for reading (NULL reads as zero)      */
+/***************************************************************/
+static inline uint8_t *mem_read_page(uint32_t address) {
+	uint32_t page_num = address >> MEM_PAGE_SHIFT;
+	uint8_t *page;
+
+	// Consecutive accesses (fetch, array walks) nearly always hit the same page
+	if (page_num == LAST_PAGE_NUM) {
+		return LAST_PAGE;
+	}
+
+	page = MEM_PAGE_TABLE[page_num];
+	if (page != NULL) {
+		LAST_PAGE_NUM = page_num;
+		LAST_PAGE = page;
+	}
+	return page;
+}
+
+/***************************************************************/
+/* Host page holding a guest address, for writing (NULL if unmapped)          */
+/***************************************************************/
+static inline uint8_t *mem_write_page(uint32_t address) {
+	// A store into the loaded program makes that word decode again before it runs
+	if (address - MEM_TEXT_BEGIN < (DECODE_COUNT << 2)) {
+		DECODE_CACHE[(address - MEM_TEXT_BEGIN) >> 2].handler = NULL;
+		JIT_STALE = TRUE;
+		TRACE_STALE = TRUE;
+	}
+
+	// Only private pages are cached here, so a hit never needs copying
+	if ((address >> MEM_PAGE_SHIFT) == LAST_WRITE_PAGE_NUM) {
+		return LAST_WRITE_PAGE;
+	}
+	return mem_write_fault(address);
+}
+
+/***************************************************************/
+/* Read a byte from memory                                                                                  */
+/***************************************************************/
+uint8_t mem_read_8(uint32_t address) {
+	uint8_t *page = mem_read_page(address);
+
+	return page ? page[address & MEM_PAGE_MASK] : 0;
+}
+
+/***************************************************************/
+/* Read a 16-bit halfword from memory                                                                  */
+/***************************************************************/
+uint16_t mem_read_16(uint32_t address) {
+	uint16_t value = 0;
+	uint8_t *page;
+
+	if ((address & 0x1) == 0) {
+		page = mem_read_page(address);
+		if (page != NULL) {
+			memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
+		}
+		return value;
+	}
+
+	return mem_read_8(address) | (mem_read_8(address + 1) << 8);
+}
+
+/***************************************************************/
+/* Write a byte to memory                                                                                      */
+/***************************************************************/
+void mem_write_8(uint32_t address, uint8_t value) {
+	uint8_t *page = mem_write_page(address);
+
+	if (page != NULL) {
+		page[address & MEM_PAGE_MASK] = value;
+	}
+}
+
+/***************************************************************/
+/* Write a 16-bit halfword to memory                                                                    */
+/***************************************************************/
+void mem_write_16(uint32_t address, uint16_t value) {
+	uint8_t *page;
+
+	if ((address & 0x1) == 0) {
+		page = mem_write_page(address);
+		if (page != NULL) {
+			memcpy(page + (address & MEM_PAGE_MASK), &value, sizeof(value));
+		}
+		return;
+	}
+
+	mem_write_8(address, value & 0xFF);
+	mem_write_8(address + 1, value >> 8);
 }
 
 /***************************************************************/
 /* Read a 32-bit word from memory                                                                            */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
-{
+uint32_t mem_read_32(uint32_t address) {
 	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
+	uint32_t value = 0;
+	uint8_t *page;
+
+	if ((address & 0x3) == 0) {
+		// An aligned word never straddles a page, so it is a single host load
+		// (RISC-V and the x86/ARM hosts we run on are all little-endian)
+		page = mem_read_page(address);
+		if (page != NULL) {
+			memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
 		}
+		return value;
 	}
-	return 0;
+
+	for (i = 3; i >= 0; i--) {
+		page = mem_read_page(address + i);
+		value = (value << 8) | (page ? page[(address + i) & MEM_PAGE_MASK] : 0);
+	}
+	return value;
 }
 
 /***************************************************************/
 /* Write a 32-bit word to memory                                                                                */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
-{
+void mem_write_32(uint32_t address, uint32_t value) {
 	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
+	uint8_t *page;
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+	if ((address & 0x3) == 0) {
+		page = mem_write_page(address);
+		if (page != NULL) {
+			memcpy(page + (address & MEM_PAGE_MASK), &value, sizeof(value));
+		}
+		return;
+	}
+
+	for (i = 0; i < 4; i++) {
+		page = mem_write_page(address + i);
+		if (page != NULL) {
+			page[(address + i) & MEM_PAGE_MASK] = (value >> (8 * i)) & 0xFF;
 		}
 	}
 }
@@ -134,6 +321,12 @@ void run(int num_cycles) {
 	}
 
 	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	if (JIT_MODE || FAST_MODE) {
+		if (num_cycles > 0 && (JIT_MODE ? run_jit(num_cycles) : run_fast(num_cycles)) < (uint32_t)num_cycles) {
+			printf("Simulation Stopped.\n\n");
+		}
+		return;
+	}
 	int i;
 	for (i = 0; i < num_cycles; i++) {
 		if (RUN_FLAG == FALSE) {
@@ -155,11 +348,660 @@ void runAll() {
 
 	printf("Simulation Started...\n\n");
 	while (RUN_FLAG){
-		cycle();
+		if (JIT_MODE) {
+			run_jit(UINT32_MAX);
+		}else if (FAST_MODE) {
+			run_fast(UINT32_MAX);
+		}else {
+			cycle();
+		}
 	}
 	printf("Simulation Finished.\n\n");
 }
 
+/***************************************************************/
+/* Threaded interpreter over the decode cache                                                     */
+/* Each handler updates CURRENT_STATE in place and jumps straight to   */
+/* the next one (computed goto on GCC/Clang, a switch of gotos otherwise). */
+/* Returns the number of instructions executed, at most budget.            */
+/***************************************************************/
+#if defined(__GNUC__)
+#define FAST_LABEL(name) &&do_##name,
+#define FAST_DISPATCH_ON(op) goto *dispatch[op]
+#else
+#define FAST_CASE(name) case OP_##name: goto do_##name;
+#define FAST_DISPATCH_ON(op) switch (op) { FAST_OPS(FAST_CASE) default: goto do_SLOW; }
+#endif
+#define FAST_DISPATCH() FAST_DISPATCH_ON(inst->op)
+
+/* x0 is rewritten rather than checked on every handler that writes rd */
+#define FAST_NEXT() do { \
+	regs[0] = 0; \
+	if (remaining == 0) goto done; \
+	index = (pc - MEM_TEXT_BEGIN) >> 2; \
+	if ((pc & 0x3) || index >= DECODE_COUNT || (inst = &DECODE_CACHE[index])->handler == NULL) goto slow; \
+	remaining--; \
+	count++; \
+	FAST_DISPATCH(); \
+} while (0)
+
+uint32_t run_fast(uint32_t budget) {
+#if defined(__GNUC__)
+	static void *const dispatch[FAST_OP_COUNT] = { &&do_SLOW, FAST_OPS(FAST_LABEL) };
+#endif
+	uint32_t *regs = CURRENT_STATE.REGS;
+	uint32_t pc = CURRENT_STATE.PC;
+	uint32_t remaining = budget, count = 0, index, executed;
+	const decoded_inst_t *inst;
+
+	FAST_NEXT();
+
+do_ADD:	regs[inst->rd] = regs[inst->rs1] + regs[inst->rs2]; pc += 4; FAST_NEXT();
+do_SUB:	regs[inst->rd] = regs[inst->rs1] - regs[inst->rs2]; pc += 4; FAST_NEXT();
+do_OR:	regs[inst->rd] = regs[inst->rs1] | regs[inst->rs2]; pc += 4; FAST_NEXT();
+do_AND:	regs[inst->rd] = regs[inst->rs1] & regs[inst->rs2]; pc += 4; FAST_NEXT();
+
+do_LB:	regs[inst->rd] = byte_to_word(mem_read_8(regs[inst->rs1] + inst->imm)); pc += 4; FAST_NEXT();
+do_LH:	regs[inst->rd] = half_to_word(mem_read_16(regs[inst->rs1] + inst->imm)); pc += 4; FAST_NEXT();
+do_LW:	regs[inst->rd] = mem_read_32(regs[inst->rs1] + inst->imm); pc += 4; FAST_NEXT();
+do_LBU:	regs[inst->rd] = mem_read_8(regs[inst->rs1] + inst->imm); pc += 4; FAST_NEXT();
+do_LHU:	regs[inst->rd] = mem_read_16(regs[inst->rs1] + inst->imm); pc += 4; FAST_NEXT();
+
+do_ADDI:	regs[inst->rd] = regs[inst->rs1] + inst->imm; pc += 4; FAST_NEXT();
+do_XORI:	regs[inst->rd] = regs[inst->rs1] ^ inst->imm; pc += 4; FAST_NEXT();
+do_ORI:	regs[inst->rd] = regs[inst->rs1] | inst->imm; pc += 4; FAST_NEXT();
+do_ANDI:	regs[inst->rd] = regs[inst->rs1] & inst->imm; pc += 4; FAST_NEXT();
+do_SLLI:	regs[inst->rd] = regs[inst->rs1] << (inst->imm & 0x1F); pc += 4; FAST_NEXT();
+do_SRLI:	regs[inst->rd] = regs[inst->rs1] >> (inst->imm & 0x1F); pc += 4; FAST_NEXT();
+do_SRAI:	regs[inst->rd] = (int32_t)regs[inst->rs1] >> (inst->imm & 0x1F); pc += 4; FAST_NEXT();
+do_SLTI:	regs[inst->rd] = (int32_t)regs[inst->rs1] < inst->imm; pc += 4; FAST_NEXT();
+do_SLTIU:	regs[inst->rd] = regs[inst->rs1] < (uint32_t)inst->imm; pc += 4; FAST_NEXT();
+
+// A store may land in the text and clear a decode entry, which FAST_NEXT() then sends down the slow path
+do_SB:	mem_write_8(regs[inst->rs1] + inst->imm, regs[inst->rs2] & 0xFF); pc += 4; FAST_NEXT();
+do_SH:	mem_write_16(regs[inst->rs1] + inst->imm, regs[inst->rs2] & 0xFFFF); pc += 4; FAST_NEXT();
+do_SW:	mem_write_32(regs[inst->rs1] + inst->imm, regs[inst->rs2]); pc += 4; FAST_NEXT();
+
+do_BEQ:	if (regs[inst->rs1] == regs[inst->rs2]) goto taken; pc += 4; FAST_NEXT();
+do_BLT:	if ((int32_t)regs[inst->rs1] < (int32_t)regs[inst->rs2]) goto taken; pc += 4; FAST_NEXT();
+do_BGE:	if ((int32_t)regs[inst->rs1] >= (int32_t)regs[inst->rs2]) goto taken; pc += 4; FAST_NEXT();
+do_JAL:	regs[inst->rd] = pc + 4; goto taken;
+
+taken:
+	// Same convention as B_Processing()/J_Processing(): the offset is taken from PC, then the usual +4 applies
+	pc += inst->imm + 4;
+	regs[0] = 0;
+	// Every taken branch/jump lands on a potential loop head: run its trace, or count towards building one
+	index = (pc - MEM_TEXT_BEGIN) >> 2;
+	if (TRACE_ENABLED && (pc & 0x3) == 0 && index < DECODE_COUNT) {
+		if (TRACE_STALE) {
+			trace_flush();
+		}
+		if (TRACE_TABLE[index] != NULL) {
+			if (TRACE_TABLE[index]->length <= remaining) {
+				executed = run_trace(TRACE_TABLE[index], &pc, remaining);
+				remaining -= executed;
+				count += executed;
+			}
+		}else if (++TRACE_COUNTERS[index] == TRACE_THRESHOLD) {
+			trace_build(pc);
+		}
+	}
+	FAST_NEXT();
+
+do_SLOW:
+	// Rare instruction: hand it back to the ordinary handler below
+	remaining++;
+	count--;
+slow:
+	// Outside the loaded program, freshly overwritten, or not a fast op: one ordinary cycle()
+	CURRENT_STATE.PC = pc;
+	NEXT_STATE = CURRENT_STATE;
+	cycle();
+	pc = CURRENT_STATE.PC;
+	remaining--;
+	if (RUN_FLAG == FALSE) {
+		goto done;
+	}
+	FAST_NEXT();
+
+done:
+	CURRENT_STATE.PC = pc;
+	NEXT_STATE = CURRENT_STATE;
+	INSTRUCTION_COUNT += count;
+	return budget - remaining;
+}
+
+/***************************************************************/
+/* Run a trace, looping while it closes on itself and the budget allows    */
+/* Only the side exits touch the PC; returns instructions executed.        */
+/***************************************************************/
+#define TRACE_NEXT() do { \
+	regs[0] = 0; \
+	if (++op == end) goto iteration_done; \
+	FAST_DISPATCH_ON(op->op); \
+} while (0)
+
+uint32_t run_trace(const trace_t *trace, uint32_t *pc, uint32_t budget) {
+#if defined(__GNUC__)
+	static void *const dispatch[FAST_OP_COUNT] = { &&do_SLOW, FAST_OPS(FAST_LABEL) };
+#endif
+	uint32_t *regs = CURRENT_STATE.REGS;
+	const trace_op_t *op = trace->ops, *end = trace->ops + trace->length;
+	uint32_t executed = 0;
+
+	TRACE_STATS.entries++;
+	FAST_DISPATCH_ON(op->op);
+
+do_ADD:	regs[op->rd] = regs[op->rs1] + regs[op->rs2]; TRACE_NEXT();
+do_SUB:	regs[op->rd] = regs[op->rs1] - regs[op->rs2]; TRACE_NEXT();
+do_OR:	regs[op->rd] = regs[op->rs1] | regs[op->rs2]; TRACE_NEXT();
+do_AND:	regs[op->rd] = regs[op->rs1] & regs[op->rs2]; TRACE_NEXT();
+
+do_LB:	regs[op->rd] = byte_to_word(mem_read_8(regs[op->rs1] + op->imm)); TRACE_NEXT();
+do_LH:	regs[op->rd] = half_to_word(mem_read_16(regs[op->rs1] + op->imm)); TRACE_NEXT();
+do_LW:	regs[op->rd] = mem_read_32(regs[op->rs1] + op->imm); TRACE_NEXT();
+do_LBU:	regs[op->rd] = mem_read_8(regs[op->rs1] + op->imm); TRACE_NEXT();
+do_LHU:	regs[op->rd] = mem_read_16(regs[op->rs1] + op->imm); TRACE_NEXT();
+
+do_ADDI:	regs[op->rd] = regs[op->rs1] + op->imm; TRACE_NEXT();
+do_XORI:	regs[op->rd] = regs[op->rs1] ^ op->imm; TRACE_NEXT();
+do_ORI:	regs[op->rd] = regs[op->rs1] | op->imm; TRACE_NEXT();
+do_ANDI:	regs[op->rd] = regs[op->rs1] & op->imm; TRACE_NEXT();
+do_SLLI:	regs[op->rd] = regs[op->rs1] << (op->imm & 0x1F); TRACE_NEXT();
+do_SRLI:	regs[op->rd] = regs[op->rs1] >> (op->imm & 0x1F); TRACE_NEXT();
+do_SRAI:	regs[op->rd] = (int32_t)regs[op->rs1] >> (op->imm & 0x1F); TRACE_NEXT();
+do_SLTI:	regs[op->rd] = (int32_t)regs[op->rs1] < op->imm; TRACE_NEXT();
+do_SLTIU:	regs[op->rd] = regs[op->rs1] < (uint32_t)op->imm; TRACE_NEXT();
+
+// A store into the text ends the trace right after it; the trace is rebuilt from the new code later
+do_SB:	mem_write_8(regs[op->rs1] + op->imm, regs[op->rs2] & 0xFF); if (TRACE_STALE) goto stale; TRACE_NEXT();
+do_SH:	mem_write_16(regs[op->rs1] + op->imm, regs[op->rs2] & 0xFFFF); if (TRACE_STALE) goto stale; TRACE_NEXT();
+do_SW:	mem_write_32(regs[op->rs1] + op->imm, regs[op->rs2]); if (TRACE_STALE) goto stale; TRACE_NEXT();
+
+do_BEQ:	if ((regs[op->rs1] == regs[op->rs2]) != op->taken) goto side_exit; TRACE_NEXT();
+do_BLT:	if (((int32_t)regs[op->rs1] < (int32_t)regs[op->rs2]) != op->taken) goto side_exit; TRACE_NEXT();
+do_BGE:	if (((int32_t)regs[op->rs1] >= (int32_t)regs[op->rs2]) != op->taken) goto side_exit; TRACE_NEXT();
+do_JAL:	regs[op->rd] = op->pc + 4; TRACE_NEXT();
+
+do_SLOW:
+	// trace_build() never puts one in a trace; leave before it just in case
+	executed += op - trace->ops;
+	*pc = op->pc;
+	goto done;
+
+iteration_done:
+	executed += trace->length;
+	if (trace->loops && budget - executed >= trace->length) {
+		op = trace->ops;
+		FAST_DISPATCH_ON(op->op);
+	}
+	*pc = trace->loops ? trace->ops[0].pc : trace->end_pc;
+	goto done;
+
+side_exit:
+	TRACE_STATS.side_exits++;
+	executed += op - trace->ops + 1;
+	*pc = op->exit_pc;
+	goto done;
+
+stale:
+	regs[0] = 0;
+	executed += op - trace->ops + 1;
+	*pc = op->pc + 4;
+
+done:
+	TRACE_STATS.instructions += executed;
+	return executed;
+}
+
+/***************************************************************/
+/* Lay out the hot path from head as one straight line, following        */
+/* backward branches and falling through forward ones (loops stay in,    */
+/* early exits leave), until it returns to head or reaches TRACE_MAX.     */
+/***************************************************************/
+void trace_build(uint32_t head) {
+	trace_t *trace;
+	trace_op_t *op;
+	decoded_inst_t *inst;
+	uint32_t pc = head, index;
+
+	trace = calloc(1, sizeof(trace_t));
+	if (trace == NULL) {
+		return;
+	}
+	while (trace->length < TRACE_MAX) {
+		index = (pc - MEM_TEXT_BEGIN) >> 2;
+		if ((pc & 0x3) != 0 || index >= DECODE_COUNT) {
+			break;
+		}
+		inst = &DECODE_CACHE[index];
+		if (inst->handler == NULL || inst->op == OP_SLOW) {
+			break;
+		}
+
+		op = &trace->ops[trace->length++];
+		op->op = inst->op;
+		op->rd = inst->rd;
+		op->rs1 = inst->rs1;
+		op->rs2 = inst->rs2;
+		op->imm = inst->imm;
+		op->pc = pc;
+		if (inst->op == OP_BEQ || inst->op == OP_BLT || inst->op == OP_BGE) {
+			op->taken = inst->imm < 0;
+			op->exit_pc = op->taken ? pc + 4 : pc + inst->imm + 4;
+			pc = op->taken ? pc + inst->imm + 4 : pc + 4;
+		}else if (inst->op == OP_JAL) {
+			pc += inst->imm + 4;
+		}else {
+			pc += 4;
+		}
+
+		if (pc == head) {
+			trace->loops = TRUE;
+			break;
+		}
+	}
+	trace->end_pc = pc;
+
+	if (trace->length == 0) {
+		free(trace);
+		return;
+	}
+	TRACE_TABLE[(head - MEM_TEXT_BEGIN) >> 2] = trace;
+	TRACE_STATS.built++;
+}
+
+/***************************************************************/
+/* Drop every trace and counter (text written or reloaded)                    */
+/***************************************************************/
+void trace_flush() {
+	static uint32_t entries;	/* size of the current table */
+	uint32_t i;
+
+	for (i = 0; TRACE_TABLE != NULL && i < entries; i++) {
+		free(TRACE_TABLE[i]);
+	}
+	free(TRACE_TABLE);
+	free(TRACE_COUNTERS);
+
+	entries = DECODE_COUNT;
+	TRACE_TABLE = calloc(entries + 1, sizeof(trace_t *));
+	TRACE_COUNTERS = calloc(entries + 1, sizeof(uint32_t));
+	if (TRACE_TABLE == NULL || TRACE_COUNTERS == NULL) {
+		printf("Error: Out of memory allocating the trace table\n");
+		exit(-1);
+	}
+	TRACE_STALE = FALSE;
+}
+
+/***************************************************************/
+/* Print how much of the run stayed inside traces                             */
+/***************************************************************/
+void trace_stats() {
+	printf("-------------------------------------\n");
+	printf("Traces built\t\t: %u\n", TRACE_STATS.built);
+	printf("Trace entries\t\t: %u\n", TRACE_STATS.entries);
+	printf("Side exits\t\t: %u\n", TRACE_STATS.side_exits);
+	printf("Instructions in traces\t: %u of %u (%.1f%% hit rate)\n", TRACE_STATS.instructions, INSTRUCTION_COUNT,
+		INSTRUCTION_COUNT ? 100.0 * TRACE_STATS.instructions / INSTRUCTION_COUNT : 0);
+	printf("-------------------------------------\n\n");
+}
+
+/***************************************************************/
+/* Basic-block translator to x86-64                                                                    */
+/* Guest registers stay in CURRENT_STATE.REGS (rbx points at them), r12d   */
+/* counts down the instruction budget, and memory goes through the same  */
+/* mem_* functions as the interpreters, so rdump/mdump see the same state. */
+/***************************************************************/
+#if MU_JIT
+typedef uint32_t (*jit_entry_t)(uint8_t *code, uint32_t *regs, uint32_t budget, uint32_t *left);
+
+#define JIT_EAX 0
+#define JIT_ECX 1
+#define JIT_ESI 6
+#define JIT_EMIT(...) jit_emit((const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+static void jit_emit(const uint8_t *bytes, size_t size) {
+	memcpy(JIT_CURSOR, bytes, size);
+	JIT_CURSOR += size;
+}
+
+static void jit_u32(uint32_t value) {
+	memcpy(JIT_CURSOR, &value, sizeof(value));
+	JIT_CURSOR += sizeof(value);
+}
+
+/* rel32 operand of the jmp/jcc just emitted */
+static void jit_rel32(const uint8_t *target) {
+	jit_u32((uint32_t)(target - (JIT_CURSOR + 4)));
+}
+
+/* mov reg, [rbx + 4*r] */
+static void jit_load_reg(uint8_t reg, uint32_t r) {
+	JIT_EMIT(0x8B, 0x43 | (reg << 3), r << 2);
+}
+
+/* mov [rbx + 4*rd], eax; x0 is never written */
+static void jit_store_reg(uint32_t rd) {
+	if (rd != 0) {
+		JIT_EMIT(0x89, 0x43, rd << 2);
+	}
+}
+
+/* mov rax, fn; call rax (the trampoline leaves rsp 16-byte aligned) */
+static void jit_call(uintptr_t fn) {
+	JIT_EMIT(0x48, 0xB8);
+	jit_u32((uint32_t)fn);
+	jit_u32((uint32_t)((uint64_t)fn >> 32));
+	JIT_EMIT(0xFF, 0xD0);
+}
+
+/* edi = rs1 + imm */
+static void jit_address(const decoded_inst_t *inst) {
+	jit_load_reg(JIT_EAX, inst->rs1);
+	if (inst->imm != 0) {
+		JIT_EMIT(0x05);
+		jit_u32(inst->imm);
+	}
+	JIT_EMIT(0x89, 0xC7);
+}
+
+/* Leave the block for guest address pc: jump straight into its translation if there is one */
+static void jit_exit(uint32_t pc) {
+	uint32_t index = (pc - MEM_TEXT_BEGIN) >> 2;
+	int known = (pc & 0x3) == 0 && index < DECODE_COUNT;
+
+	JIT_EMIT(0xB8);
+	jit_u32(pc);
+	JIT_EMIT(0xE9);
+	if (known && JIT_BLOCKS[index].code != NULL) {
+		jit_rel32(JIT_BLOCKS[index].code);
+		return;
+	}
+	// Chain it later if the target gets translated
+	if (known && JIT_BLOCKS[index].count == 0 && JIT_PATCH_COUNT < JIT_MAX_PATCHES) {
+		JIT_PATCHES[JIT_PATCH_COUNT].rel = JIT_CURSOR;
+		JIT_PATCHES[JIT_PATCH_COUNT].pc = pc;
+		JIT_PATCH_COUNT++;
+	}
+	jit_rel32(JIT_EPILOGUE);
+}
+
+/* Stores report whether they hit the text, so the block can stop before running stale code */
+static uint32_t jit_store_8(uint32_t address, uint32_t value) {
+	mem_write_8(address, value);
+	return JIT_STALE;
+}
+
+static uint32_t jit_store_16(uint32_t address, uint32_t value) {
+	mem_write_16(address, value);
+	return JIT_STALE;
+}
+
+static uint32_t jit_store_32(uint32_t address, uint32_t value) {
+	mem_write_32(address, value);
+	return JIT_STALE;
+}
+
+/* refund = instructions of the block after this one, handed back if a store ends it early */
+static void jit_emit_inst(const decoded_inst_t *inst, uint32_t pc, uint32_t refund) {
+	static const uint8_t alu_rr[FAST_OP_COUNT] = { [OP_ADD] = 0x01, [OP_SUB] = 0x29, [OP_OR] = 0x09, [OP_AND] = 0x21 };
+	static const uint8_t alu_imm[FAST_OP_COUNT] = { [OP_ADDI] = 0x05, [OP_XORI] = 0x35, [OP_ORI] = 0x0D, [OP_ANDI] = 0x25 };
+	static const uint8_t shift[FAST_OP_COUNT] = { [OP_SLLI] = 0xE0, [OP_SRLI] = 0xE8, [OP_SRAI] = 0xF8 };
+	static const uint8_t branch[FAST_OP_COUNT] = { [OP_BEQ] = 0x84, [OP_BLT] = 0x8C, [OP_BGE] = 0x8D };
+
+	switch (inst->op) {
+	case OP_ADD: case OP_SUB: case OP_OR: case OP_AND:
+		if (inst->rd != 0) {
+			jit_load_reg(JIT_EAX, inst->rs1);
+			jit_load_reg(JIT_ECX, inst->rs2);
+			JIT_EMIT(alu_rr[inst->op], 0xC8);
+			jit_store_reg(inst->rd);
+		}
+		break;
+
+	case OP_ADDI: case OP_XORI: case OP_ORI: case OP_ANDI:
+		if (inst->rd != 0) {
+			jit_load_reg(JIT_EAX, inst->rs1);
+			JIT_EMIT(alu_imm[inst->op]);
+			jit_u32(inst->imm);
+			jit_store_reg(inst->rd);
+		}
+		break;
+
+	case OP_SLLI: case OP_SRLI: case OP_SRAI:
+		if (inst->rd != 0) {
+			jit_load_reg(JIT_EAX, inst->rs1);
+			JIT_EMIT(0xC1, shift[inst->op], inst->imm & 0x1F);
+			jit_store_reg(inst->rd);
+		}
+		break;
+
+	case OP_SLTI: case OP_SLTIU:
+		if (inst->rd != 0) {
+			// cmp eax, imm; setl/setb al; movzx eax, al
+			jit_load_reg(JIT_EAX, inst->rs1);
+			JIT_EMIT(0x3D);
+			jit_u32(inst->imm);
+			JIT_EMIT(0x0F, inst->op == OP_SLTI ? 0x9C : 0x92, 0xC0, 0x0F, 0xB6, 0xC0);
+			jit_store_reg(inst->rd);
+		}
+		break;
+
+	case OP_LB: case OP_LBU:
+		jit_address(inst);
+		jit_call((uintptr_t)mem_read_8);
+		JIT_EMIT(0x0F, inst->op == OP_LB ? 0xBE : 0xB6, 0xC0);
+		jit_store_reg(inst->rd);
+		break;
+
+	case OP_LH: case OP_LHU:
+		jit_address(inst);
+		jit_call((uintptr_t)mem_read_16);
+		JIT_EMIT(0x0F, inst->op == OP_LH ? 0xBF : 0xB7, 0xC0);
+		jit_store_reg(inst->rd);
+		break;
+
+	case OP_LW:
+		jit_address(inst);
+		jit_call((uintptr_t)mem_read_32);
+		jit_store_reg(inst->rd);
+		break;
+
+	case OP_SB: case OP_SH: case OP_SW:
+		jit_address(inst);
+		jit_load_reg(JIT_ESI, inst->rs2);
+		jit_call(inst->op == OP_SB ? (uintptr_t)jit_store_8 : inst->op == OP_SH ? (uintptr_t)jit_store_16 : (uintptr_t)jit_store_32);
+		// test eax, eax; jz over; add r12d, refund; mov eax, pc + 4; jmp epilogue
+		JIT_EMIT(0x85, 0xC0, 0x74, 17, 0x41, 0x81, 0xC4);
+		jit_u32(refund);
+		JIT_EMIT(0xB8);
+		jit_u32(pc + 4);
+		JIT_EMIT(0xE9);
+		jit_rel32(JIT_EPILOGUE);
+		break;
+
+	case OP_BEQ: case OP_BLT: case OP_BGE:
+		// cmp eax, [rs2]; jcc over the fall-through exit; both exits keep the interpreter's +4
+		jit_load_reg(JIT_EAX, inst->rs1);
+		JIT_EMIT(0x3B, 0x43, inst->rs2 << 2, 0x0F, branch[inst->op]);
+		jit_u32(10);
+		jit_exit(pc + 4);
+		jit_exit(pc + inst->imm + 4);
+		break;
+
+	case OP_JAL:
+		if (inst->rd != 0) {
+			JIT_EMIT(0xC7, 0x43, inst->rd << 2);
+			jit_u32(pc + 4);
+		}
+		jit_exit(pc + inst->imm + 4);
+		break;
+	}
+}
+
+int jit_init() {
+	if (JIT_CACHE == NULL) {
+		JIT_CACHE = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (JIT_CACHE == MAP_FAILED) {
+			JIT_CACHE = NULL;
+			return FALSE;
+		}
+		JIT_STALE = TRUE;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Throw away every translation (text written, reloaded, or cache full)    */
+/***************************************************************/
+void jit_flush() {
+	JIT_CURSOR = JIT_CACHE;
+
+	// Entry: push rbx/r12/r13; rbx = regs; r12d = budget; r13 = &left; jmp code
+	JIT_EMIT(0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xF3, 0x41, 0x89, 0xD4, 0x49, 0x89, 0xCD, 0xFF, 0xE7);
+	// Exit with eax = next guest PC: *left = r12d; pop r13/r12/rbx; ret
+	JIT_EPILOGUE = JIT_CURSOR;
+	JIT_EMIT(0x45, 0x89, 0x65, 0x00, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+	free(JIT_BLOCKS);
+	JIT_BLOCKS = calloc(DECODE_COUNT + 1, sizeof(jit_block_t));
+	if (JIT_BLOCKS == NULL) {
+		printf("Error: Out of memory allocating the JIT block table\n");
+		exit(-1);
+	}
+	JIT_PATCH_COUNT = 0;
+	JIT_STALE = FALSE;
+	JIT_FLUSHES++;
+}
+
+/***************************************************************/
+/* Translate the block at pc (inside the loaded program)                      */
+/* Returns NULL if its first instruction is one the JIT leaves alone.    */
+/***************************************************************/
+uint8_t *jit_translate(uint32_t pc) {
+	uint32_t index = (pc - MEM_TEXT_BEGIN) >> 2;
+	uint32_t count = 0, i;
+	decoded_inst_t *inst = NULL;
+	jit_block_t *block;
+
+	// The block runs up to and including the first branch or jal
+	while (count < JIT_MAX_BLOCK && index + count < DECODE_COUNT) {
+		inst = &DECODE_CACHE[index + count];
+		if (inst->handler == NULL) {
+			decode_instruction(mem_read_32(pc + (count << 2)), inst);
+		}
+		if (inst->op == OP_SLOW) {
+			break;
+		}
+		count++;
+		if (inst->op == OP_BEQ || inst->op == OP_BLT || inst->op == OP_BGE || inst->op == OP_JAL) {
+			break;
+		}
+	}
+	if (count == 0) {
+		JIT_BLOCKS[index].count = 1;
+		return NULL;
+	}
+
+	// Worst case is well under 64 bytes per instruction plus the exits
+	if (JIT_CURSOR + (count + 1) * 64 > JIT_CACHE + JIT_CACHE_SIZE) {
+		jit_flush();
+	}
+	block = &JIT_BLOCKS[index];
+	block->code = JIT_CURSOR;
+	block->count = count;
+	JIT_TRANSLATED++;
+
+	// Exits already emitted towards this block can now jump straight in
+	for (i = 0; i < JIT_PATCH_COUNT; ) {
+		if (JIT_PATCHES[i].pc == pc) {
+			uint8_t *rel = JIT_PATCHES[i].rel;
+			uint32_t offset = (uint32_t)(block->code - (rel + 4));
+			memcpy(rel, &offset, sizeof(offset));
+			JIT_PATCHES[i] = JIT_PATCHES[--JIT_PATCH_COUNT];
+		}else {
+			i++;
+		}
+	}
+
+	// cmp r12d, count; jae run; mov eax, pc; jmp epilogue; run: sub r12d, count
+	// (a block that does not fit the remaining budget is left to the interpreter)
+	JIT_EMIT(0x41, 0x81, 0xFC);
+	jit_u32(count);
+	JIT_EMIT(0x73, 10, 0xB8);
+	jit_u32(pc);
+	JIT_EMIT(0xE9);
+	jit_rel32(JIT_EPILOGUE);
+	JIT_EMIT(0x41, 0x81, 0xEC);
+	jit_u32(count);
+
+	for (i = 0; i < count; i++) {
+		jit_emit_inst(&DECODE_CACHE[index + i], pc + (i << 2), count - i - 1);
+	}
+	if (inst->op != OP_BEQ && inst->op != OP_BLT && inst->op != OP_BGE && inst->op != OP_JAL) {
+		jit_exit(pc + (count << 2));
+	}
+	return block->code;
+}
+
+/***************************************************************/
+/* Run up to budget instructions, translated where possible                   */
+/***************************************************************/
+uint32_t run_jit(uint32_t budget) {
+	uint32_t remaining = budget, left, index;
+	jit_block_t *block;
+
+	if (!jit_init()) {
+		return run_fast(budget);
+	}
+
+	while (remaining > 0 && RUN_FLAG) {
+		if (JIT_STALE) {
+			jit_flush();
+		}
+		index = (CURRENT_STATE.PC - MEM_TEXT_BEGIN) >> 2;
+		block = NULL;
+		if ((CURRENT_STATE.PC & 0x3) == 0 && index < DECODE_COUNT) {
+			if (JIT_BLOCKS[index].count == 0) {
+				jit_translate(CURRENT_STATE.PC);
+			}
+			block = &JIT_BLOCKS[index];
+		}
+
+		// Outside the program, untranslatable, or the block would overshoot the budget
+		if (block == NULL || block->code == NULL || block->count > remaining) {
+			remaining -= run_fast(1);
+			continue;
+		}
+
+		CURRENT_STATE.REGS[0] = 0;
+		CURRENT_STATE.PC = ((jit_entry_t)JIT_CACHE)(block->code, CURRENT_STATE.REGS, remaining, &left);
+		INSTRUCTION_COUNT += remaining - left;
+		remaining = left;
+	}
+	NEXT_STATE = CURRENT_STATE;
+	return budget - remaining;
+}
+#else
+int jit_init() {
+	return FALSE;
+}
+
+void jit_flush() {
+	JIT_STALE = FALSE;
+}
+
+uint8_t *jit_translate(uint32_t pc) {
+	return NULL;
+}
+
+uint32_t run_jit(uint32_t budget) {
+	return run_fast(budget);
+}
+#endif
+
 /***************************************************************/ 
 /* Dump a word-aligned region of memory to the terminal                              */
 /***************************************************************/
@@ -176,6 +1018,67 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("\n");
 }
 
+/***************************************************************/
+/* Compare 16 bytes of two pages, using SSE2 where the host has it         */
+/***************************************************************/
+static inline int mem_block_differs(const uint8_t *a, const uint8_t *b) {
+#ifdef __SSE2__
+	__m128i x = _mm_loadu_si128((const __m128i *)a);
+	__m128i y = _mm_loadu_si128((const __m128i *)b);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF;
+#else
+	return memcmp(a, b, 16) != 0;
+#endif
+}
+
+/***************************************************************/
+/* List the words changed since load or since the last checkpoint          */
+/***************************************************************/
+void mdiff(int since_load) {
+	static const uint8_t zero_page[MEM_PAGE_SIZE];
+	uint32_t *bits = since_load ? MEM_DIRTY_BITS : MEM_CHECKPOINT_BITS;
+	uint8_t **baseline = (since_load || !CHECKPOINT_TAKEN) ? MEM_SNAPSHOT_TABLE : MEM_CHECKPOINT_TABLE;
+	uint32_t word, bit, block, offset;
+	uint32_t words_changed = 0, pages_changed = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory changed since %s :\n", (since_load || !CHECKPOINT_TAKEN) ? "load" : "checkpoint");
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Address in Hex (Dec) ]\t[Old]\t\t[New]\n");
+
+	// Only pages flagged in the dirty bitmap can differ from the baseline
+	for (word = 0; word < MEM_PAGE_COUNT / 32; word++) {
+		for (bit = 0; bits[word] != 0 && bit < 32; bit++) {
+			uint32_t page_num = (word << 5) | bit;
+			if (!MEM_BIT_TEST(bits, page_num)) {
+				continue;
+			}
+
+			const uint8_t *old_page = baseline[page_num] ? baseline[page_num] : zero_page;
+			const uint8_t *new_page = MEM_PAGE_TABLE[page_num] ? MEM_PAGE_TABLE[page_num] : zero_page;
+			uint32_t before = words_changed;
+
+			for (block = 0; block < MEM_PAGE_SIZE; block += 16) {
+				if (!mem_block_differs(old_page + block, new_page + block)) {
+					continue;
+				}
+				for (offset = block; offset < block + 16; offset += 4) {
+					uint32_t old_word, new_word;
+					uint32_t address = (page_num << MEM_PAGE_SHIFT) | offset;
+					memcpy(&old_word, old_page + offset, sizeof(old_word));
+					memcpy(&new_word, new_page + offset, sizeof(new_word));
+					if (old_word != new_word) {
+						printf("\t0x%08x (%d) :\t0x%08x\t0x%08x\n", address, address, old_word, new_word);
+						words_changed++;
+					}
+				}
+			}
+			pages_changed += (words_changed != before);
+		}
+	}
+	printf("%u words changed in %u pages\n\n", words_changed, pages_changed);
+}
+
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */   
 /***************************************************************/
@@ -217,15 +1120,70 @@ void handle_command() {
 	switch(buffer[0]) {
 		case 'S':
 		case 's':
-			runAll(); 
+			if (buffer[1] == 't' || buffer[1] == 'T'){
+				mem_stats();
+			}else {
+				runAll();
+			}
 			break;
 		case 'M':
 		case 'm':
+			if (buffer[1] == 'd' && (buffer[2] == 'i' || buffer[2] == 'I')){
+				if (scanf("%19s", buffer) != 1){
+					break;
+				}
+				if (buffer[0] == 'l' || buffer[0] == 'L'){
+					mdiff(TRUE);
+				}else if (buffer[0] == 'c' || buffer[0] == 'C'){
+					mdiff(FALSE);
+				}else {
+					printf("Invalid Command.\n");
+				}
+				break;
+			}
 			if (scanf("%x %x", &start, &stop) != 2){
 				break;
 			}
 			mdump(start, stop);
 			break;
+		case 'C':
+		case 'c':
+			mem_checkpoint();
+			printf("Checkpoint taken after %u instructions.\n\n", INSTRUCTION_COUNT);
+			break;
+		case 'B':
+		case 'b':
+			if (scanf("%19s", buffer) != 1){
+				break;
+			}
+			if (strcmp(buffer, "mem") == 0){
+				bench_memory();
+			}else if (strcmp(buffer, "decode") == 0){
+				bench_decode();
+			}else if (strcmp(buffer, "run") == 0){
+				bench_program();
+			}else {
+				printf("Invalid Command.\n");
+			}
+			break;
+		case 'F':
+		case 'f':
+			FAST_MODE = !FAST_MODE;
+			printf("Threaded dispatch %s.\n\n", FAST_MODE ? "on" : "off");
+			break;
+		case 'T':
+		case 't':
+			trace_stats();
+			break;
+		case 'J':
+		case 'j':
+			if (!jit_init()) {
+				printf("The JIT is only available on x86-64 hosts.\n\n");
+				break;
+			}
+			JIT_MODE = !JIT_MODE;
+			printf("JIT %s.\n\n", JIT_MODE ? "on" : "off");
+			break;
 		case '?':
 			help();
 			break;
@@ -284,42 +1242,316 @@ void handle_command() {
 }
 
 /***************************************************************/
-/* reset registers/memory and reload program                                                    */
+/* reset registers/memory to the program as it was loaded                          */
+/***************************************************************/
+void reset() {
+	/*throw away every page written since the program was loaded*/
+	mem_restore();
+	/*the restored text may differ from what self-modifying stores left decoded*/
+	predecode_program();
+
+	/*restore the registers*/
+	CURRENT_STATE = LOADED_STATE;
+	NEXT_STATE = CURRENT_STATE;
+	INSTRUCTION_COUNT = 0;
+	RUN_FLAG = TRUE;
+	memset(&TRACE_STATS, 0, sizeof(TRACE_STATS));
+}
+
+/***************************************************************/
+/* Remember the freshly loaded program so reset() can return to it         */
 /***************************************************************/
-void reset() {   
+void snapshot_program() {
+	mem_snapshot();
+	LOADED_STATE = CURRENT_STATE;
+}
+
+/***************************************************************/
+/* Allocate the (empty) page directories covering the address space               */
+/***************************************************************/
+void init_memory() {
 	int i;
-	/*reset registers*/
-	for (i = 0; i < RISCV_REGS; i++){
-		CURRENT_STATE.REGS[i] = 0;
+	MEM_PAGE_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	MEM_SNAPSHOT_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	MEM_CHECKPOINT_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	MEM_DIRTY_BITS = calloc(MEM_PAGE_COUNT / 32, sizeof(uint32_t));
+	MEM_CHECKPOINT_BITS = calloc(MEM_PAGE_COUNT / 32, sizeof(uint32_t));
+	if (MEM_PAGE_TABLE == NULL || MEM_SNAPSHOT_TABLE == NULL || MEM_CHECKPOINT_TABLE == NULL ||
+		MEM_DIRTY_BITS == NULL || MEM_CHECKPOINT_BITS == NULL) {
+		printf("Error: Out of memory allocating the page directory\n");
+		exit(-1);
 	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
-	
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		MEM_REGIONS[i].touched = 0;
 	}
-	
-	/*load program*/
-	load_program();
-	
-	/*reset PC*/
-	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+	mem_invalidate();
+}
+
+/***************************************************************/
+/* Forget the cached last read/write pages                                              */
+/***************************************************************/
+void mem_invalidate() {
+	LAST_PAGE_NUM = MEM_PAGE_COUNT;
+	LAST_PAGE = NULL;
+	LAST_WRITE_PAGE_NUM = MEM_PAGE_COUNT;
+	LAST_WRITE_PAGE = NULL;
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Make everything written so far the shared, read-only load image          */
 /***************************************************************/
-void init_memory() {                                           
+void mem_snapshot() {
+	uint32_t i, page_num;
+
+	// Before the snapshot every page is private and on the dirty list
+	for (i = 0; i < MEM_DIRTY_COUNT; i++) {
+		page_num = MEM_DIRTY_LIST[i];
+		MEM_SNAPSHOT_TABLE[page_num] = MEM_PAGE_TABLE[page_num];
+		MEM_BIT_CLEAR(MEM_DIRTY_BITS, page_num);
+	}
+	MEM_DIRTY_COUNT = 0;
+	mem_clear_checkpoint();
+	mem_invalidate();
+}
+
+/***************************************************************/
+/* Drop a page's private copy so it reads as the snapshot again                   */
+/***************************************************************/
+void mem_discard_page(uint32_t page_num) {
+	uint8_t *page = MEM_PAGE_TABLE[page_num];
+
+	if (page != NULL && page != MEM_SNAPSHOT_TABLE[page_num]) {
+		free(page);
+		mem_region(page_num << MEM_PAGE_SHIFT)->touched--;
+		MEM_PAGE_TABLE[page_num] = MEM_SNAPSHOT_TABLE[page_num];
+	}
+}
+
+/***************************************************************/
+/* Return all of memory to the snapshot; costs one step per dirty page       */
+/***************************************************************/
+void mem_restore() {
+	uint32_t i, page_num;
+
+	for (i = 0; i < MEM_DIRTY_COUNT; i++) {
+		page_num = MEM_DIRTY_LIST[i];
+		mem_discard_page(page_num);
+		MEM_BIT_CLEAR(MEM_DIRTY_BITS, page_num);
+	}
+	MEM_DIRTY_COUNT = 0;
+	mem_clear_checkpoint();
+	mem_invalidate();
+}
+
+/***************************************************************/
+/* Forget the checkpoint: diffs are taken against the load image again    */
+/***************************************************************/
+void mem_clear_checkpoint() {
+	uint32_t word, bit;
+
+	for (word = 0; word < MEM_PAGE_COUNT / 32; word++) {
+		for (bit = 0; MEM_CHECKPOINT_BITS[word] != 0 && bit < 32; bit++) {
+			uint32_t page_num = (word << 5) | bit;
+			if (MEM_BIT_TEST(MEM_CHECKPOINT_BITS, page_num)) {
+				free(MEM_CHECKPOINT_TABLE[page_num]);
+				MEM_CHECKPOINT_TABLE[page_num] = NULL;
+				MEM_BIT_CLEAR(MEM_CHECKPOINT_BITS, page_num);
+			}
+		}
+	}
+	CHECKPOINT_TAKEN = FALSE;
+	LAST_WRITE_PAGE_NUM = MEM_PAGE_COUNT;
+	LAST_WRITE_PAGE = NULL;
+}
+
+/***************************************************************/
+/* Start a new checkpoint: later diffs only show writes made after it         */
+/***************************************************************/
+void mem_checkpoint() {
+	// The write cache must miss so the next write to each page gets tracked
+	mem_clear_checkpoint();
+	CHECKPOINT_TAKEN = TRUE;
+}
+
+/***************************************************************/
+/* Return the pages of [begin, end] to their snapshot contents                    */
+/***************************************************************/
+void mem_release(uint32_t begin, uint32_t end) {
+	uint32_t page_num;
+
+	for (page_num = begin >> MEM_PAGE_SHIFT; page_num <= (end >> MEM_PAGE_SHIFT); page_num++) {
+		mem_discard_page(page_num);
+	}
+	mem_invalidate();
+}
+
+/***************************************************************/
+/* Print how many pages have been touched and the bytes they use                  */
+/***************************************************************/
+void mem_stats() {
 	int i;
+	uint32_t total = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory usage (page size %d bytes)\n", MEM_PAGE_SIZE);
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Region]\t\t\t[Pages]\t[Resident bytes]\n");
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		printf("\t0x%08x..0x%08x\t%u\t%u\n", MEM_REGIONS[i].begin, MEM_REGIONS[i].end,
+			   MEM_REGIONS[i].touched, MEM_REGIONS[i].touched * MEM_PAGE_SIZE);
+		total += MEM_REGIONS[i].touched;
+	}
+	printf("\tTotal\t\t\t\t%u\t%u\n\n", total, total * MEM_PAGE_SIZE);
+}
+
+/***************************************************************/
+/* Millions of operations per second since a clock() start time                      */
+/***************************************************************/
+double bench_rate(uint32_t operations, clock_t start) {
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	return seconds > 0 ? operations / seconds / 1e6 : 0;
+}
+
+/***************************************************************/
+/* Time the memory layer in word accesses per second                                 */
+/***************************************************************/
+void bench_memory() {
+	const uint32_t accesses = 1 << 24;
+	const uint32_t window = 1 << 20; /* scratch pages in kernel data, released afterwards */
+	const uint32_t base = MEM_KDATA_BEGIN;
+	uint32_t i, checksum = 0;
+	clock_t start;
+
+	printf("Timing %u word accesses per pattern...\n\n", accesses);
+
+	start = clock();
+	for (i = 0; i < accesses; i++) {
+		mem_write_32(base + ((i << 2) & (window - 1)), i);
+	}
+	printf("sequential writes\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+
+	start = clock();
+	for (i = 0; i < accesses; i++) {
+		checksum += mem_read_32(base + ((i << 2) & (window - 1)));
+	}
+	printf("sequential reads\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+
+	// One access per page defeats the last-page shortcut and exercises the directory
+	start = clock();
+	for (i = 0; i < accesses; i++) {
+		checksum += mem_read_32(base + ((i * (MEM_PAGE_SIZE + 4)) & (window - 1)));
+	}
+	printf("page-strided reads\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+	printf("(checksum 0x%08x)\n\n", checksum);
+
+	mem_release(base, base + window - 1);
+}
+
+/***************************************************************/
+/* Time the loaded program from the current state in both interpreters   */
+/***************************************************************/
+/***************************************************************/
+/* Time the decoder over a mix of RV32I encodings and random words */
+/***************************************************************/
+void bench_decode() {
+	const uint32_t decodes = 1 << 24;
+	const uint32_t window = 1 << 12; /* words, small enough to stay in L1 */
+	uint32_t *words = malloc(window * sizeof(uint32_t));
+	uint32_t i, seed = 12345, checksum = 0;
+	decoded_inst_t inst;
+	clock_t start;
+
+	if (words == NULL) {
+		printf("Error: Out of memory allocating the decode benchmark\n");
+		return;
 	}
+	// Mostly valid instructions with random operands; every eighth word is arbitrary
+	for (i = 0; i < window; i++) {
+		uint32_t id = 1 + (seed >> 16) % (INST_COUNT - 1);
+		seed = seed * 1103515245 + 12345;
+		words[i] = (i & 7) ? ISA_MATCH[id] | (seed & ~ISA_MASK[id]) : seed;
+		seed = seed * 1103515245 + 12345;
+	}
+
+	printf("Timing %u decodes...\n\n", decodes);
+
+	start = clock();
+	for (i = 0; i < decodes; i++) {
+		uint32_t word = words[i & (window - 1)];
+		uint32_t id = isa_decode(word);
+		checksum += id + isa_imm(word, ISA_FORMAT[id]);
+	}
+	printf("table lookup\t\t: %.1f M decodes/s\n", bench_rate(decodes, start));
+
+	start = clock();
+	for (i = 0; i < decodes; i++) {
+		decode_instruction(words[i & (window - 1)], &inst);
+		checksum += inst.op + inst.imm;
+	}
+	printf("decode_instruction\t: %.1f M decodes/s\n", bench_rate(decodes, start));
+	printf("(checksum 0x%08x)\n\n", checksum);
+
+	free(words);
+}
+
+double bench_mode(int mode, const CPU_State *start, uint32_t total) {
+	uint32_t executed = 0;
+	clock_t begin = clock();
+
+	// Short programs are simply run again until enough instructions have gone by
+	while (executed < total) {
+		CURRENT_STATE = *start;
+		NEXT_STATE = CURRENT_STATE;
+		RUN_FLAG = TRUE;
+		INSTRUCTION_COUNT = 0;
+		if (mode == 2) {
+			run_jit(total - executed);
+		}else if (mode == 1) {
+			run_fast(total - executed);
+		}else {
+			while (RUN_FLAG && INSTRUCTION_COUNT < total - executed) {
+				cycle();
+			}
+		}
+		if (INSTRUCTION_COUNT == 0) {
+			break;
+		}
+		executed += INSTRUCTION_COUNT;
+	}
+	return bench_rate(executed, begin);
+}
+
+void bench_program() {
+	const uint32_t total = 1 << 25;
+	CPU_State start = CURRENT_STATE;
+	uint32_t count = INSTRUCTION_COUNT;
+	int flag = RUN_FLAG, traces = TRACE_ENABLED;
+	trace_stats_t stats = TRACE_STATS;
+	double slow, fast, jit;
+
+	printf("Timing %u instructions per mode...\n\n", total);
+	slow = bench_mode(FALSE, &start, total);
+	printf("switch dispatch\t\t: %.1f MIPS\n", slow);
+	TRACE_ENABLED = FALSE;
+	fast = bench_mode(TRUE, &start, total);
+	printf("threaded dispatch\t: %.1f MIPS (%.1fx)\n", fast, slow > 0 ? fast / slow : 0);
+	TRACE_ENABLED = TRUE;
+	memset(&TRACE_STATS, 0, sizeof(TRACE_STATS));
+	fast = bench_mode(TRUE, &start, total);
+	printf("threaded + traces\t: %.1f MIPS (%.1fx, %.1f%% of instructions in traces)\n", fast, slow > 0 ? fast / slow : 0,
+		100.0 * TRACE_STATS.instructions / total);
+	TRACE_ENABLED = traces;
+	if (jit_init()) {
+		jit = bench_mode(2, &start, total);
+		printf("x86-64 JIT\t\t: %.1f MIPS (%.1fx, %u blocks translated)\n", jit, slow > 0 ? jit / slow : 0, JIT_TRANSLATED);
+	}
+	printf("\n");
+
+	CURRENT_STATE = start;
+	NEXT_STATE = CURRENT_STATE;
+	INSTRUCTION_COUNT = count;
+	RUN_FLAG = flag;
+	TRACE_STATS = stats;
 }
 
 /**************************************************************/
@@ -349,49 +1581,60 @@ void load_program() {
 	PROGRAM_SIZE = i/4;
 	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
 	fclose(fp);
+	predecode_program();
 }
 
-void R_Processing(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t f7) {
-	switch(f3){
-		case 0:
-			switch(f7){
-				case 0:		//add
-					NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] + NEXT_STATE.REGS[rs2];
-					break;
-				case 32:	//sub
-					NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] - NEXT_STATE.REGS[rs2];
-					break;
-				default:
-					RUN_FLAG = FALSE;
-					break;
-				}	
+void R_Processing(const decoded_inst_t *inst) {
+	uint32_t rd = inst->rd, rs1 = inst->rs1, rs2 = inst->rs2;
+
+	switch(inst->id){
+		case INST_ADD:
+			NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] + NEXT_STATE.REGS[rs2];
 			break;
-		case 6: 			//or
+		case INST_SUB:
+			NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] - NEXT_STATE.REGS[rs2];
+			break;
+		case INST_OR:
 			NEXT_STATE.REGS[rd] = (NEXT_STATE.REGS[rs1] | NEXT_STATE.REGS[rs2]);
 			break;
-		case 7:				//and
+		case INST_AND:
 			NEXT_STATE.REGS[rd] = (NEXT_STATE.REGS[rs1] & NEXT_STATE.REGS[rs2]);
 			break;
+		// RV32M
+		case INST_MUL: case INST_MULH: case INST_MULHSU: case INST_MULHU:
+		case INST_DIV: case INST_DIVU: case INST_REM: case INST_REMU:
+			NEXT_STATE.REGS[rd] = isa_execute(inst->id, NEXT_STATE.REGS[rs1], NEXT_STATE.REGS[rs2], 0, 0);
+			break;
 		default:
 			RUN_FLAG = FALSE;
 			break;
 	} 			
 }
 
-void ILoad_Processing(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t imm) {
-	switch (f3)
+void ILoad_Processing(const decoded_inst_t *inst) {
+	uint32_t rd = inst->rd, rs1 = inst->rs1, imm = inst->imm;
+
+	switch (inst->id)
 	{
-	case 0: //lb
-		NEXT_STATE.REGS[rd] = byte_to_word((mem_read_32(NEXT_STATE.REGS[rs1] + imm)) & 0xFF);
+	case INST_LB:
+		NEXT_STATE.REGS[rd] = byte_to_word(mem_read_8(NEXT_STATE.REGS[rs1] + imm));
 		break;
 
-	case 1: //lh
-		NEXT_STATE.REGS[rd] = half_to_word((mem_read_32(NEXT_STATE.REGS[rs1] + imm)) & 0xFFFF);
+	case INST_LH:
+		NEXT_STATE.REGS[rd] = half_to_word(mem_read_16(NEXT_STATE.REGS[rs1] + imm));
 		break;
 
-	case 2: //lw
+	case INST_LW:
 		NEXT_STATE.REGS[rd] = mem_read_32(NEXT_STATE.REGS[rs1] + imm);
 		break;
+
+	case INST_LBU:
+		NEXT_STATE.REGS[rd] = mem_read_8(NEXT_STATE.REGS[rs1] + imm);
+		break;
+
+	case INST_LHU:
+		NEXT_STATE.REGS[rd] = mem_read_16(NEXT_STATE.REGS[rs1] + imm);
+		break;
 	
 	default:
 		printf("Invalid instruction");
@@ -400,53 +1643,45 @@ void ILoad_Processing(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t imm) {
 	}
 }
 
-void Iimm_Processing(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t imm) {
-	uint32_t imm0_4 = (imm << 7) >> 7;
-	uint32_t imm5_11 = imm >> 5;
+void Iimm_Processing(const decoded_inst_t *inst) {
+	uint32_t rd = inst->rd, rs1 = inst->rs1, imm = inst->imm;
 
-	switch (f3)
+	switch (inst->id)
 	{
-	case 0: //addi
+	case INST_ADDI:
 		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] + imm;
 		break;
 
-	case 4: //xori
+	case INST_XORI:
 		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] ^ imm;
 		break;
 	
-	case 6: //ori
+	case INST_ORI:
 		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] | imm;
 		break;
 	
-	case 7: //andi
+	case INST_ANDI:
 		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] & imm;
 		break;
 	
-	case 1: //slli
-		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] << imm0_4;
+	case INST_SLLI: // imm is already the shift amount
+		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] << imm;
 		break;
 	
-	case 5: //srli and srai
-		switch (imm5_11)
-		{
-		case 0: //srli
-			NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] >> imm0_4;
-			break;
+	case INST_SRLI:
+		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] >> imm;
+		break;
 
-		case 32: //srai
-			//NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] >> imm0_4;
-			break;
-		
-		default:
-			RUN_FLAG = FALSE;
-			break;
-		}
+	case INST_SRAI:
+		NEXT_STATE.REGS[rd] = (int32_t)NEXT_STATE.REGS[rs1] >> imm;
 		break;
 	
-	case 2:
+	case INST_SLTI:
+		NEXT_STATE.REGS[rd] = (int32_t)NEXT_STATE.REGS[rs1] < (int32_t)imm;
 		break;
 
-	case 3:
+	case INST_SLTIU:
+		NEXT_STATE.REGS[rd] = NEXT_STATE.REGS[rs1] < imm;
 		break;
 
 	default:
@@ -456,21 +1691,20 @@ void Iimm_Processing(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t imm) {
 	}
 }
 
-void S_Processing(uint32_t imm4, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t imm11) {
-	// Recombine immediate
-	uint32_t imm = (imm11 << 5) + imm4;
+void S_Processing(const decoded_inst_t *inst) {
+	uint32_t rs1 = inst->rs1, rs2 = inst->rs2, imm = inst->imm;
 
-	switch (f3)
+	switch (inst->id)
 	{
-	case 0: //sb
-		mem_write_32((NEXT_STATE.REGS[rs1] + imm), NEXT_STATE.REGS[rs2]);
+	case INST_SB:
+		mem_write_8((NEXT_STATE.REGS[rs1] + imm), NEXT_STATE.REGS[rs2] & 0xFF);
 		break;
 	
-	case 1: //sh
-		mem_write_32((NEXT_STATE.REGS[rs1] + imm), NEXT_STATE.REGS[rs2]);
+	case INST_SH:
+		mem_write_16((NEXT_STATE.REGS[rs1] + imm), NEXT_STATE.REGS[rs2] & 0xFFFF);
 		break;
 
-	case 2: //sw
+	case INST_SW:
 		mem_write_32((NEXT_STATE.REGS[rs1] + imm), NEXT_STATE.REGS[rs2]);
 		break;
 
@@ -481,24 +1715,23 @@ void S_Processing(uint32_t imm4, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32
 	}
 }
 
-void B_Processing(uint32_t imm11, uint32_t imm4, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t imm10, uint32_t imm12) {
-	//recombine immediates
-	uint32_t imm = (imm12 << 12) + (imm11 << 11) + (imm10 << 5) + (imm4 << 1);
-	int32_t offset = signExtend_13b(imm); //convert to signed
+void B_Processing(const decoded_inst_t *inst) {
+	uint32_t rs1 = inst->rs1, rs2 = inst->rs2;
+	int32_t offset = inst->imm;
 
-	switch (f3)
+	switch (inst->id)
 	{
-		case 5: //bge
-			if(NEXT_STATE.REGS[rs1] >= NEXT_STATE.REGS[rs2]){
+		case INST_BGE:
+			if((int32_t)NEXT_STATE.REGS[rs1] >= (int32_t)NEXT_STATE.REGS[rs2]){
 				NEXT_STATE.PC += offset;
 			}
 			break;
-		case 4: //blt:
-			if(NEXT_STATE.REGS[rs1] < NEXT_STATE.REGS[rs2]){
+		case INST_BLT:
+			if((int32_t)NEXT_STATE.REGS[rs1] < (int32_t)NEXT_STATE.REGS[rs2]){
 				NEXT_STATE.PC += offset;
 			}
 			break;
-		case 0: // beq
+		case INST_BEQ:
 			if(NEXT_STATE.REGS[rs1] == NEXT_STATE.REGS[rs2]){
 				NEXT_STATE.PC += offset;
 			}
@@ -508,101 +1741,93 @@ void B_Processing(uint32_t imm11, uint32_t imm4, uint32_t f3, uint32_t rs1, uint
 			RUN_FLAG = FALSE;
 			break;
 	}
-	printf("\n b offset = %x", NEXT_STATE.PC);
 }
 
-void J_Processing(uint32_t imm20, uint32_t imm10, uint32_t imm11, uint32_t imm19, uint32_t rd) {
-	//recombine immediate
-	uint32_t imm = (imm20 << 20) + (imm19 << 12) + (imm11 << 11) + (imm10 << 1);
-	int32_t offset = signExtend_21b(imm); //convert to signed
-	printf("\n%x, %x", imm, offset);
+void J_Processing(const decoded_inst_t *inst) {
+	int32_t offset = inst->imm;
 
 	//jal/j is the only J-type instruction needed
-	NEXT_STATE.REGS[rd] = NEXT_STATE.PC + 4;
+	NEXT_STATE.REGS[inst->rd] = NEXT_STATE.PC + 4;
 	NEXT_STATE.PC += offset;
 
 }
 
+void Invalid_Processing(const decoded_inst_t *inst) {
+	// Unrecognized opcode or zero instruction
+	RUN_FLAG = FALSE;
+}
+
 void U_Processing() {
 	// hi
 }
 
+/************************************************************/
+/* Split an instruction word into its fields, once                    */
+/************************************************************/
+void decode_instruction(uint32_t instruction, decoded_inst_t *inst) {
+	// functional-core handler per operand format; lui/auipc are not implemented here
+	static void (*const handlers[FMT_COUNT])(const decoded_inst_t *) = {
+		[FMT_NONE] = Invalid_Processing, [FMT_R] = R_Processing, [FMT_I] = Iimm_Processing,
+		[FMT_SHIFT] = Iimm_Processing, [FMT_LOAD] = ILoad_Processing, [FMT_S] = S_Processing,
+		[FMT_B] = B_Processing, [FMT_U] = Invalid_Processing, [FMT_J] = J_Processing,
+	};
+	// threaded interpreter leaf operation per instruction; anything not listed runs through SLOW
+#define FAST_OP_OF(name) [INST_##name] = OP_##name,
+	static const uint8_t fast_ops[INST_COUNT] = { FAST_OPS(FAST_OP_OF) };
+#undef FAST_OP_OF
+	uint32_t id = isa_decode(instruction);
+	uint32_t format = ISA_FORMAT[id];
+
+	inst->id = id;
+	inst->rd = (instruction & 0xF80) >> 7;
+	inst->rs1 = (instruction & 0xF8000) >> 15;
+	inst->rs2 = (instruction & 0x1F00000) >> 20;
+	inst->imm = isa_imm(instruction, format);
+	inst->handler = handlers[format];
+	inst->op = fast_ops[id];
+}
+
+/************************************************************/
+/* Decode every word of the loaded program up front                */
+/************************************************************/
+void predecode_program() {
+	uint32_t i;
+
+	free(DECODE_CACHE);
+	DECODE_COUNT = PROGRAM_SIZE;
+	DECODE_CACHE = calloc(DECODE_COUNT + 1, sizeof(decoded_inst_t));
+	if (DECODE_CACHE == NULL) {
+		printf("Error: Out of memory allocating the decode cache\n");
+		exit(-1);
+	}
+	for (i = 0; i < DECODE_COUNT; i++) {
+		decode_instruction(mem_read_32(MEM_TEXT_BEGIN + (i << 2)), &DECODE_CACHE[i]);
+	}
+	JIT_STALE = TRUE;
+	TRACE_STALE = TRUE;
+}
+
 /************************************************************/
 /* decode and execute instruction                           */ 
 /************************************************************/
 void handle_instruction()
 {
-	// Read the instruction at the address in the program counter
-	uint32_t instruction = mem_read_32(CURRENT_STATE.PC);
-
-	// Read opcode
-	uint8_t opcode_bitmask = 0x7f; //0111 1111 to low quarter word
-	uint8_t opcode = instruction & opcode_bitmask;
-
-	switch(opcode)
-	{
-	case 0x33: //R-type Instruction
-		R_Processing(
-			(instruction & 0xF80) >> 7, //rd
-			(instruction & 0x7000) >> 12, //f3
-			(instruction & 0xF80000) >> 15, //rs1
-			(instruction & 0x1F00000) >> 20, //rs2
-			(instruction & 0xFE000000) >> 25 //f7
-		);
-		break;
-
-	case 0x13://I-type Immediate Instruction
-		Iimm_Processing(
-			(instruction & 0xF80) >> 7, //rd
-			(instruction & 0x7000) >> 12, //f3
-			(instruction & 0xF80000) >> 15, //rs1
-			(instruction & 0xFFF00000) >> 20 //imm
-		);
-		break;
-
-	case 0x03: //I-type Load Instruction:
-		ILoad_Processing(
-			(instruction & 0xF80) >> 7, //rd
-			(instruction & 0x7000) >> 12, //f3
-			(instruction & 0xF80000) >> 15, //rs1
-			(instruction & 0xFFF00000) >> 20 //imm
-		);
-		break;
-
-	case 0x23: //S-type Store Instruction
-		S_Processing(
-			(instruction & 0xF80) >> 7, // imm[4:0]
-			(instruction & 0x7000) >> 12, //f3
-			(instruction & 0xF80000) >> 15, //rs1
-			(instruction & 0x1F00000) >> 20, //rs2
-			(instruction & 0xFE000000) >> 25 // imm[11:5]
-		);
-		break;
-	case 0x63: //B-type Branch Instruction
-		B_Processing(
-			(instruction & 0x80) >> 7, // imm[11]
-			(instruction & 0xF00) >> 8, // imm[4:1]
-			(instruction & 0x7000) >> 12, // f3
-			(instruction & 0xF80000) >> 15, //rs1
-			(instruction & 0x1F00000) >> 20, //rs2
-			(instruction & 0x7E000000) >> 25, // imm[10:5]
-			(instruction & 0x80000000) >> 31  // imm[12]
-		);
-		break;
-	case 0x6F: //J-type Jump Instruction
-		J_Processing(
-			(instruction & 0xF80) >> 7, //rd
-			(instruction & 0xFF000) >> 12, //imm[19:12]
-			(instruction & 0x00100000) >> 20, //imm[11]
-			(instruction & 0x7FE00000) >> 21, //imm[10:1]
-			(instruction & 0x80000000) >> 31 //imm[20]
-		);
-		break;
-
-	default: // Unrecognized opcode or zero instruction
-		RUN_FLAG = FALSE;
-		break;
+	static decoded_inst_t scratch;
+	decoded_inst_t *inst = &scratch;
+	uint32_t index = (CURRENT_STATE.PC - MEM_TEXT_BEGIN) >> 2;
+
+	if ((CURRENT_STATE.PC & 0x3) == 0 && index < DECODE_COUNT) {
+		// Loaded program: decoded at load time, or again after a store into it
+		inst = &DECODE_CACHE[index];
+		if (inst->handler == NULL) {
+			decode_instruction(mem_read_32(CURRENT_STATE.PC), inst);
+		}
+	}else {
+		decode_instruction(mem_read_32(CURRENT_STATE.PC), inst);
 	}
+	inst->handler(inst);
+	// x0 is hardwired to zero, whatever the handler wrote to it
+	NEXT_STATE.REGS[0] = 0;
 
 	//Increment to next instruction
 	NEXT_STATE.PC += 4;
@@ -618,6 +1843,23 @@ void initialize() {
 	CURRENT_STATE.REGS[2] = MEM_STACK_BEGIN;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
+	TRACE_ENABLED = TRUE;
+}
+
+/************************************************************/
+/* Print one decoded instruction in RISCV assembly format             */
+/************************************************************/
+void print_operands(uint32_t id, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm, uint32_t target, const char *label) {
+	switch (ISA_FORMAT[id]) {
+		case FMT_R: printf("%s x%d, x%d, x%d\n", ISA_NAME[id], rd, rs1, rs2); break;
+		case FMT_I: case FMT_SHIFT: printf("%s x%d, x%d, %d\n", ISA_NAME[id], rd, rs1, imm); break;
+		case FMT_LOAD: printf("%s x%d, %d(x%d)\n", ISA_NAME[id], rd, imm, rs1); break;
+		case FMT_S: printf("%s x%d, %d(x%d)\n", ISA_NAME[id], rs2, imm, rs1); break;
+		case FMT_B: printf("%s x%d, x%d, %s%x\n", ISA_NAME[id], rs1, rs2, label, target); break;
+		case FMT_U: printf("%s x%d, 0x%x\n", ISA_NAME[id], rd, (uint32_t)imm >> 12); break;
+		case FMT_J: printf("%s x%d, %s%x\n", ISA_NAME[id], rd, label, target); break;
+		default: printf("unknown instruction\n");
+	}
 }
 
 /************************************************************/
@@ -634,32 +1876,13 @@ void print_program(){
 	//Have to check for branching beforehand so labels can be generated
 	for(addr = CURRENT_STATE.PC; addr < MEM_TEXT_END; addr += 4){
         uint32_t instruction = mem_read_32(addr);
+		uint32_t format = ISA_FORMAT[isa_decode(instruction)];
 
-        uint32_t opcode = instruction & 0x7F;
-		uint32_t imm = 0;
-		int32_t offset;
-
-		if(opcode == 0x63){ //B-type
-			imm += ((instruction & 0x80) >> 7) << 11; // imm[11]
-			imm += ((instruction & 0xF00) >> 8) << 1; // imm[4:1]
-			imm += ((instruction & 0x7E000000) >> 25) << 5; // imm[10:5]
-			imm += ((instruction & 0x80000000) >> 31) << 12;  // imm[12]
-
-			offset = signExtend_13b(imm);
-		}
-		else if(opcode == 0x6F){ //J-type
-			imm += ((instruction & 0xFF000) >> 12) << 12; //imm[19:12]
-			imm += ((instruction & 0x00100000) >> 20) << 11; //imm[11]
-			imm += ((instruction & 0x7FE00000) >> 21) << 1; //imm[10:1]
-			imm += ((instruction & 0x80000000) >> 31) << 20; //imm[20]
-
-			offset = signExtend_21b(imm);
-		}
-		else{
+		if(format != FMT_B && format != FMT_J){
 			continue;
 		}
 
-		branches[numBranches] = addr + offset; //imm is the offset
+		branches[numBranches] = addr + isa_imm(instruction, format); //imm is the offset
 		numBranches++;
 
 		if(numBranches == MAX_BRANCHES){
@@ -670,123 +1893,22 @@ void print_program(){
 
     for(addr = CURRENT_STATE.PC; addr < MEM_TEXT_END; addr += 4){
         uint32_t instruction = mem_read_32(addr);
+		uint32_t id = isa_decode(instruction);
+		uint32_t format = ISA_FORMAT[id];
 
-        uint32_t opcode = instruction & 0x7F;
         uint32_t rd = (instruction >> 7) & 0x1F;
-        uint32_t funct3 = (instruction >> 12) & 0x7;
         uint32_t rs1 = (instruction >> 15) & 0x1F;
         uint32_t rs2 = (instruction >> 20) & 0x1F;
-        uint32_t funct7 = (instruction >> 25) & 0x7F;
-
-        uint32_t imm=0; // immediate value
-		int32_t offset; //offset for jumps
-		uint32_t branchAddress;
+		int32_t imm = isa_imm(instruction, format);
 
 		char branchHeader[] = "Br-";
 
-		if (opcode == 00000000) { // kind of hard coded? not sure what to do here but this is a band-aid for now
+		if ((instruction & 0x7F) == 0) { // end of the loaded program
 			break;
 		}
 
         printf("%08x: %08x ", addr, instruction);
-
-        switch (opcode) {
-            case 0x33: // R-type
-                switch (funct3) {
-                    case 0x0:
-                        if (funct7 == 0x00) printf("add ");
-                        else if (funct7 == 0x20) printf("sub ");
-                        break;
-                    case 0x1: printf("sll "); break;
-                    case 0x2: printf("slt "); break;
-                    case 0x3: printf("sltu "); break;
-                    case 0x4: printf("xor "); break;
-                    case 0x5:
-                        if (funct7 == 0x00) printf("srl ");
-                        else if (funct7 == 0x20) printf("sra ");
-                        break;
-                    case 0x6: printf("or "); break;
-                    case 0x7: printf("and "); break;
-                }
-                printf("x%d, x%d, x%d\n", rd, rs1, rs2);
-                break;
-            case 0x03: // I-type (load)
-                imm = (instruction >> 20);
-                switch (funct3) {
-                    case 0x0: printf("lb "); break;
-                    case 0x1: printf("lh "); break;
-                    case 0x2: printf("lw "); break;
-                    case 0x4: printf("lbu "); break;
-                    case 0x5: printf("lhu "); break;
-                }
-                printf("x%d, %d(x%d)\n", rd, imm, rs1);
-                break;
-            case 0x13: // I-type (addi, slti, sltiu, xori, ori, andi, slli, srli, srai)
-                imm = (instruction >> 20);
-                switch (funct3) {
-                    case 0x0: printf("addi "); break;
-                    case 0x2: printf("slti "); break;
-                    case 0x3: printf("sltiu "); break;
-                    case 0x4: printf("xori "); break;
-                    case 0x6: printf("ori "); break;
-                    case 0x7: printf("andi "); break;
-                    case 0x1: printf("slli "); break;
-                    case 0x5:
-                        if (funct7 == 0x00) printf("srli ");
-                        else if (funct7 == 0x20) printf("srai ");
-                        break;
-                }
-                printf("x%d, x%d, %d\n", rd, rs1, imm);
-                break;
-            case 0x23: // S-type
-                imm = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
-                switch (funct3) {
-                    case 0x0: printf("sb "); break;
-                    case 0x1: printf("sh "); break;
-                    case 0x2: printf("sw "); break;
-                }
-                printf("x%d, %d(x%d)\n", rs2, imm, rs1);
-                break;
-			case 0x63: // B-type branching
-				imm += ((instruction & 0x80) >> 7) << 11; // imm[11]
-				imm += ((instruction & 0xF00) >> 8) << 1; // imm[4:1]
-				imm += ((instruction & 0x7E000000) >> 25) << 5; // imm[10:5]
-				imm += ((instruction & 0x80000000) >> 31) << 12;  // imm[12]
-
-				switch (funct3){
-					case 0x0: printf("beq "); break;
-					case 0x1: printf("bne "); break;
-					case 0x4: printf("blt "); break;
-					case 0x5: printf("bge "); break;
-					case 0x6: printf("bltu "); break;
-					case 0x7: printf("bgeu "); break;
-				}
-
-				offset = signExtend_13b(imm);
-				
-				//convert from unsigned to signed
-				branchAddress = addr + offset + 4;
-
-				printf("x%d, x%d, %s%x\n", rs1, rs2, branchHeader, branchAddress);
-				break;
-
-			case 0x6F: // J-type instruction (only jal)
-				imm += ((instruction & 0xFF000) >> 12) << 12; //imm[19:12]
-				imm += ((instruction & 0x00100000) >> 20) << 11; //imm[11]
-				imm += ((instruction & 0x7FE00000) >> 21) << 1; //imm[10:1]
-				imm += ((instruction & 0x80000000) >> 31) << 20; //imm[20]
-
-				offset = signExtend_21b(imm);
-				
-				//convert from unsigned to signed
-				branchAddress = addr + offset + 4;
-
-				printf("jal x%d, %s%x\n", rd, branchHeader, branchAddress);
-				break;
-
-            default:
-                printf("unknown instruction\n");
-        }
+		print_operands(id, rd, rs1, rs2, imm, addr + imm + 4, branchHeader);
 
 		//Check to see if a branch is for this value of the PC
 		for(int i = 0; i<numBranches; i++){
@@ -806,32 +1928,13 @@ void print_program(){
 /* Print the instruction at given memory address (in RISCV assembly format)    */
 /************************************************************/
 void print_instruction(uint32_t addr){
-
 	uint32_t instruction = mem_read_32(addr);
-		uint32_t maskopcode = 0x7F;
-		uint32_t opcode = instruction & maskopcode;
-		if(opcode == 51) { //R-type
-			uint32_t maskrd = 0xF80;
-			uint32_t rd = instruction & maskrd;
-			rd = rd >> 7;
-			uint32_t maskf3 = 0x7000;
-			uint32_t f3 = instruction & maskf3;
-			f3 = f3 >> 12;
-			uint32_t maskrs1 = 0xF8000;
-			uint32_t rs1 = instruction & maskrs1;
-			rs1 = rs1 >> 15;
-			uint32_t maskrs2 = 0x1F00000;
-			uint32_t rs2 = instruction & maskrs2;
-			rs2 = rs2 >> 20;
-			uint32_t maskf7 = 0xFE000000;
-			uint32_t f7 = instruction & maskf7;
-			f7 = f7 >> 25;
-			//R_Print(rd,f3,rs1,rs2,f7);
-		} else {
-			printf("instruction print not yet created\n");
-		}
-		CURRENT_STATE = NEXT_STATE;
-	return;
+	uint32_t id = isa_decode(instruction);
+	int32_t imm = isa_imm(instruction, ISA_FORMAT[id]);
+
+	// branch targets follow the simulator's convention of offset from PC, then +4
+	print_operands(id, (instruction >> 7) & 0x1F, (instruction >> 15) & 0x1F, (instruction >> 20) & 0x1F,
+		imm, addr + imm + 4, "");
 }
 
 /***************************************************************/
@@ -850,6 +1953,7 @@ int main(int argc, char *argv[]) {
 	strcpy(prog_file, argv[1]);
 	initialize();
 	load_program();
+	snapshot_program();
 	help();
 	while (1){
 		handle_command();
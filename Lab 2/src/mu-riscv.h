@@ -25,19 +25,44 @@
 #ifdef __cplusplus
 extern "C"{
 #endif
+/* guest memory is allocated one page at a time, the first time the page is written */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_PAGE_COUNT (1 << (32 - MEM_PAGE_SHIFT))
+
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
+	uint32_t touched; /* number of pages allocated so far */
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
 mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
+	{ MEM_TEXT_BEGIN, MEM_TEXT_END, 0 },
+	{ MEM_DATA_BEGIN, MEM_DATA_END, 0 },
+	{ MEM_KDATA_BEGIN, MEM_KDATA_END, 0 },
+	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, 0 }
 };
 
+/* flat page directory indexed by guest page number, NULL until the page is written */
+uint8_t **MEM_PAGE_TABLE;
+/* pages as they were right after loading; shared with MEM_PAGE_TABLE until written */
+uint8_t **MEM_SNAPSHOT_TABLE;
+/* the most recently read page and the most recently written (private) page */
+uint32_t LAST_PAGE_NUM, LAST_WRITE_PAGE_NUM;
+uint8_t *LAST_PAGE, *LAST_WRITE_PAGE;
+/* pages written since the snapshot, as a bitmap and as a list */
+uint32_t *MEM_DIRTY_BITS;
+uint32_t *MEM_DIRTY_LIST;
+uint32_t MEM_DIRTY_COUNT, MEM_DIRTY_CAPACITY;
+/* pages written since the last checkpoint, and their contents at the checkpoint */
+uint32_t *MEM_CHECKPOINT_BITS;
+uint8_t **MEM_CHECKPOINT_TABLE;
+int CHECKPOINT_TAKEN;
+
+#define MEM_BIT_TEST(bits, page_num) ((bits)[(page_num) >> 5] & (1u << ((page_num) & 0x1F)))
+#define MEM_BIT_SET(bits, page_num) ((bits)[(page_num) >> 5] |= (1u << ((page_num) & 0x1F)))
+#define MEM_BIT_CLEAR(bits, page_num) ((bits)[(page_num) >> 5] &= ~(1u << ((page_num) & 0x1F)))
+
 #define NUM_MEM_REGION 4
 #define RISCV_REGS 32
 
@@ -49,37 +74,157 @@ typedef struct CPU_State_Struct {
 } CPU_State;
 
 
+/* leaf operations the threaded interpreter dispatches on directly; anything else goes through OP_SLOW */
+/* each name is also an enum isa_inst (INST_<name>) in mu-decode.h */
+#define FAST_OPS(X) \
+	X(ADD) X(SUB) X(OR) X(AND) \
+	X(LB) X(LH) X(LW) X(LBU) X(LHU) \
+	X(ADDI) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) X(SLTI) X(SLTIU) \
+	X(SB) X(SH) X(SW) X(BEQ) X(BLT) X(BGE) X(JAL)
+
+#define FAST_OP_ENUM(name) OP_##name,
+enum fast_op { OP_SLOW, FAST_OPS(FAST_OP_ENUM) FAST_OP_COUNT };
+
+/* an instruction word decoded once at load time, so execution skips the field extraction */
+typedef struct decoded_inst {
+	void (*handler)(const struct decoded_inst *inst);	/* NULL until (re)decoded */
+	uint32_t op;	/* enum fast_op */
+	uint32_t id;	/* enum isa_inst */
+	uint32_t rd, rs1, rs2;
+	int32_t imm;	/* already reassembled and sign-extended for the format */
+} decoded_inst_t;
+
 /***************************************************************/
 /* CPU State info.                                                                                                               */
 /***************************************************************/
 
 CPU_State CURRENT_STATE, NEXT_STATE;
+CPU_State LOADED_STATE; /* state right after load_program(), restored by reset() */
 int RUN_FLAG;	/* run flag*/
+int FAST_MODE;	/* run/sim use the threaded interpreter */
 uint32_t INSTRUCTION_COUNT;
 uint32_t PROGRAM_SIZE; /*in words*/
 
 char prog_file[32];
 
+decoded_inst_t *DECODE_CACHE;	/* one entry per word of the loaded program */
+uint32_t DECODE_COUNT;
+
+/* x86-64 translation of the basic block starting at each word of the loaded program */
+#define JIT_CACHE_SIZE (4 << 20)
+#define JIT_MAX_BLOCK 64	/* instructions per translated block */
+#define JIT_MAX_PATCHES 4096	/* block exits waiting for their target to be translated */
+
+typedef struct {
+	uint8_t *code;	/* NULL if not translated (yet) */
+	uint32_t count;	/* guest instructions in the block; 0 = never tried */
+} jit_block_t;
+
+typedef struct {
+	uint8_t *rel;	/* rel32 of the exit jump to retarget */
+	uint32_t pc;	/* guest address it leaves to */
+} jit_patch_t;
+
+/* superblocks: straight-line copies of hot loops, branches turned into side exits */
+#define TRACE_THRESHOLD 16	/* taken branches to a target before a trace is built there */
+#define TRACE_MAX 64	/* instructions per trace */
+
+typedef struct {
+	uint8_t op;	/* enum fast_op */
+	uint8_t rd, rs1, rs2;
+	uint8_t taken;	/* branches: the direction the trace follows */
+	int32_t imm;
+	uint32_t pc;	/* guest address of the instruction */
+	uint32_t exit_pc;	/* branches: where to continue if the branch goes the other way */
+} trace_op_t;
+
+typedef struct {
+	uint32_t length;
+	int loops;	/* the last instruction leads back to the first */
+	uint32_t end_pc;	/* where execution continues after a trace that does not loop */
+	trace_op_t ops[TRACE_MAX];
+} trace_t;
+
+typedef struct {
+	uint32_t built, entries, side_exits;
+	uint32_t instructions;	/* executed inside traces since load/reset */
+} trace_stats_t;
+
+int TRACE_ENABLED;	/* the threaded interpreter forms and runs traces */
+int TRACE_STALE;	/* text was written (or reloaded) since traces were built */
+trace_t **TRACE_TABLE;	/* trace headed at each word of the loaded program */
+uint32_t *TRACE_COUNTERS;	/* taken branches/jumps seen to each word */
+trace_stats_t TRACE_STATS;
+
+int JIT_MODE;	/* run/sim use translated code where possible */
+int JIT_STALE;	/* text was written (or reloaded) since the last flush */
+jit_block_t *JIT_BLOCKS;
+jit_patch_t JIT_PATCHES[JIT_MAX_PATCHES];
+uint32_t JIT_PATCH_COUNT;
+uint8_t *JIT_CACHE, *JIT_CURSOR, *JIT_EPILOGUE;
+uint32_t JIT_TRANSLATED, JIT_FLUSHES;
+
 
 /***************************************************************/
 /* Function Declerations.                                                                                                */
 /***************************************************************/
 void help();
+mem_region_t *mem_region(uint32_t address);
+void mem_mark_dirty(uint32_t page_num);
+void mem_mark_checkpoint(uint32_t page_num);
+uint8_t *mem_write_fault(uint32_t address);
+uint8_t mem_read_8(uint32_t address);
+uint16_t mem_read_16(uint32_t address);
 uint32_t mem_read_32(uint32_t address);
+void mem_write_8(uint32_t address, uint8_t value);
+void mem_write_16(uint32_t address, uint16_t value);
 void mem_write_32(uint32_t address, uint32_t value);
 void cycle();
 void run(int num_cycles);
 void runAll();
+uint32_t run_fast(uint32_t budget);
+uint32_t run_trace(const trace_t *trace, uint32_t *pc, uint32_t budget);
+void trace_build(uint32_t head);
+void trace_flush();
+void trace_stats();
+uint32_t run_jit(uint32_t budget);
+int jit_init();
+void jit_flush();
+uint8_t *jit_translate(uint32_t pc);
 void mdump(uint32_t start, uint32_t stop) ;
+void mdiff(int since_load);
 void rdump();
 void handle_command();
 void reset();
 void init_memory();
+void mem_invalidate();
+void mem_snapshot();
+void mem_discard_page(uint32_t page_num);
+void mem_restore();
+void mem_clear_checkpoint();
+void mem_checkpoint();
+void mem_release(uint32_t begin, uint32_t end);
+void mem_stats();
+void bench_memory();
+void bench_decode();
+double bench_mode(int mode, const CPU_State *start, uint32_t total);
+void bench_program();
 void load_program();
+void snapshot_program();
 uint32_t assemble_instruction(char* instruction, uint32_t address);
+void decode_instruction(uint32_t instruction, decoded_inst_t *inst);
+void predecode_program();
+void R_Processing(const decoded_inst_t *inst);
+void ILoad_Processing(const decoded_inst_t *inst);
+void Iimm_Processing(const decoded_inst_t *inst);
+void S_Processing(const decoded_inst_t *inst);
+void B_Processing(const decoded_inst_t *inst);
+void J_Processing(const decoded_inst_t *inst);
+void Invalid_Processing(const decoded_inst_t *inst);
 void handle_instruction();
 void initialize();
 void print_program(); 
+void print_operands(uint32_t id, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm, uint32_t target, const char *label);
 void print_instruction(uint32_t);
 
 #ifdef __cplusplus
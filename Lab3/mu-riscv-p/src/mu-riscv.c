@@ -22,45 +22,80 @@ void help() {
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
 	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("stats\t-- show memory pages touched and resident bytes\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Find the memory region holding an address (NULL if unmapped)                  */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
-{
+mem_region_t *mem_region(uint32_t address) {
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
+		if ((address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end)) {
+			return &MEM_REGIONS[i];
 		}
 	}
-	return 0;
+	return NULL;
+}
+
+/***************************************************************/
+/* Locate a byte of a region, allocating its page on first write                 */
+/***************************************************************/
+uint8_t *mem_byte(mem_region_t *region, uint32_t offset, int allocate) {
+	uint8_t **page = &region->pages[offset >> MEM_PAGE_SHIFT];
+
+	if (*page == NULL) {
+		// Untouched pages read as zero, so only a write needs to back them
+		if (!allocate) {
+			return NULL;
+		}
+		*page = calloc(1, MEM_PAGE_SIZE);
+		if (*page == NULL) {
+			printf("Error: Out of memory allocating page 0x%08x\n", region->begin + offset);
+			exit(-1);
+		}
+		region->touched++;
+	}
+	return *page + (offset & (MEM_PAGE_SIZE - 1));
+}
+
+/***************************************************************/
+/* Read a 32-bit word from memory                                                                            */
+/***************************************************************/
+uint32_t mem_read_32(uint32_t address) {
+	int i;
+	uint32_t value = 0;
+	mem_region_t *region = mem_region(address);
+
+	if (region == NULL) {
+		return 0;
+	}
+
+	uint32_t offset = address - region->begin;
+	for (i = 3; i >= 0; i--) {
+		uint8_t *byte = (address + i <= region->end) ? mem_byte(region, offset + i, FALSE) : NULL;
+		value = (value << 8) | (byte ? *byte : 0);
+	}
+	return value;
 }
 
 /***************************************************************/
 /* Write a 32-bit word to memory                                                                                */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
-{
+void mem_write_32(uint32_t address, uint32_t value) {
 	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
+	mem_region_t *region = mem_region(address);
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
-		}
+	if (region == NULL) {
+		return;
+	}
+
+	uint32_t offset = address - region->begin;
+	for (i = 0; i < 4 && address + i <= region->end; i++) {
+		*mem_byte(region, offset + i, TRUE) = (value >> (8 * i)) & 0xFF;
 	}
 }
 
@@ -169,6 +204,8 @@ void handle_command() {
 		case 's':
 			if (buffer[1] == 'h' || buffer[1] == 'H'){
 				show_pipeline();
+			}else if (buffer[1] == 't' || buffer[1] == 'T'){
+				mem_stats();
 			}else {
 				runAll();
 			}
@@ -249,10 +286,8 @@ void reset() {
 	CURRENT_STATE.HI = 0;
 	CURRENT_STATE.LO = 0;
 
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
-	}
+	/*release every page written so far; they read as zero again*/
+	free_memory();
 
 	/*load program*/
 	load_program();
@@ -265,15 +300,56 @@ void reset() {
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Allocate the (empty) page tables of each memory region                            */
 /***************************************************************/
 void init_memory() {
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		uint32_t region_pages = ((MEM_REGIONS[i].end - MEM_REGIONS[i].begin) >> MEM_PAGE_SHIFT) + 1;
+		MEM_REGIONS[i].pages = calloc(region_pages, sizeof(uint8_t *));
+		MEM_REGIONS[i].touched = 0;
+		if (MEM_REGIONS[i].pages == NULL) {
+			printf("Error: Out of memory allocating page tables\n");
+			exit(-1);
+		}
+	}
+}
+
+/***************************************************************/
+/* Free every allocated page, leaving the page tables empty                          */
+/***************************************************************/
+void free_memory() {
+	int i;
+	uint32_t page;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		uint32_t region_pages = ((MEM_REGIONS[i].end - MEM_REGIONS[i].begin) >> MEM_PAGE_SHIFT) + 1;
+		for (page = 0; page < region_pages && MEM_REGIONS[i].touched > 0; page++) {
+			if (MEM_REGIONS[i].pages[page] != NULL) {
+				free(MEM_REGIONS[i].pages[page]);
+				MEM_REGIONS[i].pages[page] = NULL;
+				MEM_REGIONS[i].touched--;
+			}
+		}
+	}
+}
+
+/***************************************************************/
+/* Print how many pages have been touched and the bytes they use                  */
+/***************************************************************/
+void mem_stats() {
+	int i;
+	uint32_t total = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory usage (page size %d bytes)\n", MEM_PAGE_SIZE);
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Region]\t\t\t[Pages]\t[Resident bytes]\n");
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		printf("\t0x%08x..0x%08x\t%u\t%u\n", MEM_REGIONS[i].begin, MEM_REGIONS[i].end,
+			   MEM_REGIONS[i].touched, MEM_REGIONS[i].touched * MEM_PAGE_SIZE);
+		total += MEM_REGIONS[i].touched;
 	}
+	printf("\tTotal\t\t\t\t%u\t%u\n\n", total, total * MEM_PAGE_SIZE);
 }
 
 /**************************************************************/
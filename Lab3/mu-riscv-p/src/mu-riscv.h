@@ -22,12 +22,17 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END  0x10010000
 
+/* guest memory is allocated one page at a time, the first time the page is written */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
+	uint8_t **pages;  /* one slot per page, NULL until the page is first written */
+	uint32_t touched; /* number of pages allocated so far */
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
+/* page tables will be dynamically allocated at initialization */
 mem_region_t MEM_REGIONS[] = {
 	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
 	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
@@ -82,6 +87,8 @@ char prog_file[32];
 /* Function Declerations.                                                                                                */
 /***************************************************************/
 void help();
+mem_region_t *mem_region(uint32_t address);
+uint8_t *mem_byte(mem_region_t *region, uint32_t offset, int allocate);
 uint32_t mem_read_32(uint32_t address);
 void mem_write_32(uint32_t address, uint32_t value);
 void cycle();
@@ -92,6 +99,8 @@ void rdump();
 void handle_command();
 void reset();
 void init_memory();
+void free_memory();
+void mem_stats();
 void load_program();
 void handle_pipeline(); /*IMPLEMENT THIS*/
 void WB();/*IMPLEMENT THIS*/
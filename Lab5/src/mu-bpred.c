@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mu-bpred.h"
+
+/***************************************************************/
+/* Allocate the tables; returns 0 if a size is out of range                      */
+/***************************************************************/
+int bpred_init(bpred_t *bpred, bpred_kind_t kind, uint32_t bits, uint32_t btb_bits)
+{
+	if (bits < 1 || bits > BPRED_MAX_BITS || btb_bits < 1 || btb_bits > BPRED_MAX_BITS)
+	{
+		printf("Error: predictor and BTB sizes must be between 2 and 2^%d entries\n", BPRED_MAX_BITS);
+		return 0;
+	}
+
+	bpred_free(bpred);
+	bpred->kind = kind;
+	bpred->bits = bits;
+	bpred->btb_bits = btb_bits;
+	bpred->bimodal = malloc(1u << bits);
+	bpred->gshare = malloc(1u << bits);
+	bpred->chooser = malloc(1u << bits);
+	bpred->btb = malloc((1u << btb_bits) * sizeof(btb_entry_t));
+	if (bpred->bimodal == NULL || bpred->gshare == NULL || bpred->chooser == NULL || bpred->btb == NULL)
+	{
+		printf("Error: Out of memory allocating the branch predictor\n");
+		exit(-1);
+	}
+	bpred_reset(bpred);
+	return 1;
+}
+
+void bpred_free(bpred_t *bpred)
+{
+	free(bpred->bimodal);
+	free(bpred->gshare);
+	free(bpred->chooser);
+	free(bpred->btb);
+	bpred->bimodal = NULL;
+	bpred->gshare = NULL;
+	bpred->chooser = NULL;
+	bpred->btb = NULL;
+}
+
+/***************************************************************/
+/* Counters weakly not taken, chooser weakly bimodal, BTB empty          */
+/***************************************************************/
+void bpred_reset(bpred_t *bpred)
+{
+	memset(bpred->bimodal, 1, 1u << bpred->bits);
+	memset(bpred->gshare, 1, 1u << bpred->bits);
+	memset(bpred->chooser, 1, 1u << bpred->bits);
+	memset(bpred->btb, 0, (1u << bpred->btb_bits) * sizeof(btb_entry_t));
+	memset(&bpred->stats, 0, sizeof(bpred->stats));
+	bpred->history = 0;
+	bpred->ras_top = 0;
+	bpred->ras_count = 0;
+}
+
+/***************************************************************/
+/* Size the return address stack; returns 0 if the depth is out of range */
+/***************************************************************/
+int bpred_ras_init(bpred_t *bpred, uint32_t depth)
+{
+	if (depth > BPRED_RAS_MAX)
+	{
+		printf("Error: the return address stack holds at most %d entries\n", BPRED_RAS_MAX);
+		return 0;
+	}
+	bpred->ras_depth = depth;
+	bpred->ras_top = 0;
+	bpred->ras_count = 0;
+	return 1;
+}
+
+/***************************************************************/
+/* RAS operations of a jump, following the RISC-V link register hints  */
+/***************************************************************/
+uint8_t bpred_ras_hint(branch_kind_t kind, uint32_t rd, uint32_t rs1)
+{
+	const int rd_link = rd == 1 || rd == 5, rs1_link = rs1 == 1 || rs1 == 5;
+
+	if (kind == BRANCH_JUMP)
+	{
+		return rd_link ? RAS_PUSH : 0;
+	}
+	if (kind != BRANCH_INDIRECT)
+	{
+		return 0;
+	}
+	// jalr x1, x5 (or x5, x1) is a coroutine swap: return, then call
+	if (rd_link && rs1_link)
+	{
+		return rd == rs1 ? RAS_PUSH : RAS_POP | RAS_PUSH;
+	}
+	return rd_link ? RAS_PUSH : rs1_link ? RAS_POP : 0;
+}
+
+// The slot a push writes: the only one a checkpoint has to save
+static uint32_t ras_above(const bpred_t *bpred, uint32_t top)
+{
+	return bpred->ras_depth > 0 ? (top + 1) % bpred->ras_depth : 0;
+}
+
+// Apply a jump's RAS operations; returns the predicted return address, or fallback if the stack
+// is empty. Overflows and underflows are counted at fetch, not again when a repair replays them.
+static uint32_t ras_apply(bpred_t *bpred, uint8_t ras, uint32_t pc, uint32_t fallback, int fetch)
+{
+	uint32_t target = fallback;
+
+	if ((ras & RAS_POP) && bpred->ras_count == 0)
+	{
+		bpred->stats.ras_underflows += fetch;
+	}
+	else if (ras & RAS_POP)
+	{
+		target = bpred->ras[bpred->ras_top];
+		bpred->ras_top = (bpred->ras_top + bpred->ras_depth - 1) % bpred->ras_depth;
+		bpred->ras_count--;
+	}
+	if (ras & RAS_PUSH)
+	{
+		// A full stack loses its oldest entry
+		bpred->ras_top = ras_above(bpred, bpred->ras_top);
+		bpred->ras[bpred->ras_top] = pc + 4;
+		if (bpred->ras_count == bpred->ras_depth)
+		{
+			bpred->stats.ras_overflows += fetch;
+		}
+		else
+		{
+			bpred->ras_count++;
+		}
+	}
+	return target;
+}
+
+static uint32_t bpred_index(const bpred_t *bpred, uint32_t pc)
+{
+	return (pc >> 2) & ((1u << bpred->bits) - 1);
+}
+
+static uint32_t gshare_index(const bpred_t *bpred, uint32_t pc, uint32_t history)
+{
+	return ((pc >> 2) ^ history) & ((1u << bpred->bits) - 1);
+}
+
+static btb_entry_t *btb_entry(const bpred_t *bpred, uint32_t pc)
+{
+	return &bpred->btb[(pc >> 2) & ((1u << bpred->btb_bits) - 1)];
+}
+
+static void counter_train(uint8_t *counter, int up)
+{
+	if (up && *counter < 3)
+	{
+		(*counter)++;
+	}
+	else if (!up && *counter > 0)
+	{
+		(*counter)--;
+	}
+}
+
+// Direction of a conditional branch the BTB knows the target of
+static int bpred_taken(const bpred_t *bpred, uint32_t pc, uint32_t target, uint32_t history)
+{
+	uint32_t index = bpred_index(bpred, pc);
+
+	switch (bpred->kind)
+	{
+	case BPRED_BTFN:
+		return target < pc;
+	case BPRED_BIMODAL:
+		return bpred->bimodal[index] >= 2;
+	case BPRED_GSHARE:
+		return bpred->gshare[gshare_index(bpred, pc, history)] >= 2;
+	case BPRED_TOURNAMENT:
+		return bpred->chooser[index] >= 2 ? bpred->gshare[gshare_index(bpred, pc, history)] >= 2
+										  : bpred->bimodal[index] >= 2;
+	default:
+		return 0;
+	}
+}
+
+/***************************************************************/
+/* Next PC for the instruction at pc, looked up before it is decoded     */
+/***************************************************************/
+bpred_info_t bpred_predict(bpred_t *bpred, uint32_t pc)
+{
+	const btb_entry_t *entry = btb_entry(bpred, pc);
+	bpred_info_t info;
+
+	info.next = pc + 4;
+	info.history = bpred->history;
+	info.ras = 0;
+	info.ras_top = bpred->ras_top;
+	info.ras_count = bpred->ras_count;
+	info.ras_saved = bpred->ras[ras_above(bpred, bpred->ras_top)];
+	if (!entry->valid || entry->tag != pc)
+	{
+		return info;
+	}
+	if (entry->kind != BRANCH_CONDITIONAL || bpred_taken(bpred, pc, entry->target, bpred->history))
+	{
+		info.next = entry->target;
+	}
+	if (bpred->ras_depth > 0 && entry->ras)
+	{
+		info.ras = entry->ras;
+		info.next = ras_apply(bpred, entry->ras, pc, info.next, 1);
+	}
+	return info;
+}
+
+/***************************************************************/
+/* Train on a resolved branch or jump                                                    */
+/***************************************************************/
+void bpred_update(bpred_t *bpred, uint32_t pc, branch_kind_t kind, uint8_t ras, int taken, uint32_t target,
+				  const bpred_info_t *info)
+{
+	const int mispredicted = (taken ? target : pc + 4) != info->next;
+	btb_entry_t *entry = btb_entry(bpred, pc);
+
+	if (bpred->ras_depth > 0)
+	{
+		if (info->ras & RAS_POP)
+		{
+			bpred->stats.returns++;
+			bpred->stats.return_misses += mispredicted;
+		}
+		// Wrong-path fetches moved the stack, or this jump's own operations were missed: roll back
+		if (mispredicted || info->ras != ras)
+		{
+			bpred->ras_top = info->ras_top;
+			bpred->ras_count = info->ras_count;
+			bpred->ras[ras_above(bpred, info->ras_top)] = info->ras_saved;
+			ras_apply(bpred, ras, pc, target, 0);
+			bpred->stats.ras_repairs++;
+		}
+	}
+
+	if (kind == BRANCH_CONDITIONAL)
+	{
+		uint8_t *bimodal = &bpred->bimodal[bpred_index(bpred, pc)];
+		uint8_t *gshare = &bpred->gshare[gshare_index(bpred, pc, info->history)];
+		const int bimodal_right = (*bimodal >= 2) == taken, gshare_right = (*gshare >= 2) == taken;
+
+		bpred->stats.branches++;
+		bpred->stats.branch_misses += mispredicted;
+		// The chooser only learns when its two predictors disagree
+		if (bimodal_right != gshare_right)
+		{
+			counter_train(&bpred->chooser[bpred_index(bpred, pc)], gshare_right);
+		}
+		counter_train(bimodal, taken);
+		counter_train(gshare, taken);
+		bpred->history = ((bpred->history << 1) | (taken != 0)) & ((1u << bpred->bits) - 1);
+	}
+	else
+	{
+		bpred->stats.jumps++;
+		bpred->stats.jump_misses += mispredicted;
+	}
+
+	if (taken)
+	{
+		if (entry->valid && entry->tag == pc)
+		{
+			bpred->stats.btb_hits++;
+		}
+		else
+		{
+			bpred->stats.btb_misses++;
+		}
+		entry->valid = 1;
+		entry->tag = pc;
+		entry->target = target;
+		entry->kind = kind;
+		entry->ras = ras;
+	}
+}
+
+const char *bpred_name(bpred_kind_t kind)
+{
+	switch (kind)
+	{
+	case BPRED_BTFN:
+		return "BTFN";
+	case BPRED_BIMODAL:
+		return "bimodal";
+	case BPRED_GSHARE:
+		return "gshare";
+	case BPRED_TOURNAMENT:
+		return "tournament";
+	default:
+		return "not-taken";
+	}
+}
+
+/***************************************************************/
+/* Print accuracy, mispredictions per kilo-instruction and CPI           */
+/***************************************************************/
+void bpred_print_stats(const bpred_t *bpred, uint32_t instructions, uint32_t cycles)
+{
+	const bpred_stats_t *stats = &bpred->stats;
+	const uint64_t misses = stats->branch_misses + stats->jump_misses;
+	const uint64_t lookups = stats->btb_hits + stats->btb_misses;
+
+	printf("Branch predictor: %s, %u counters, %u-entry BTB\n", bpred_name(bpred->kind), 1u << bpred->bits,
+		   1u << bpred->btb_bits);
+	printf("  branches\t: %llu (%llu mispredicted)\n", (unsigned long long)stats->branches,
+		   (unsigned long long)stats->branch_misses);
+	printf("  jumps\t\t: %llu (%llu mispredicted)\n", (unsigned long long)stats->jumps,
+		   (unsigned long long)stats->jump_misses);
+	printf("  accuracy\t: %.2f%%\n",
+		   stats->branches ? 100.0 * (stats->branches - stats->branch_misses) / stats->branches : 0.0);
+	printf("  BTB hit rate\t: %.2f%%\n", lookups ? 100.0 * stats->btb_hits / lookups : 0.0);
+	if (bpred->ras_depth > 0)
+	{
+		printf("  RAS\t\t: %u entries, %llu returns, %.2f%% correct\n", bpred->ras_depth,
+			   (unsigned long long)stats->returns,
+			   stats->returns ? 100.0 * (stats->returns - stats->return_misses) / stats->returns : 0.0);
+		printf("  RAS overflows\t: %llu (%llu underflows, %llu repairs)\n", (unsigned long long)stats->ras_overflows,
+			   (unsigned long long)stats->ras_underflows, (unsigned long long)stats->ras_repairs);
+	}
+	printf("  MPKI\t\t: %.2f\n", instructions ? 1000.0 * misses / instructions : 0.0);
+	printf("  CPI\t\t: %.3f\n\n", instructions ? (double)cycles / instructions : 0.0);
+}
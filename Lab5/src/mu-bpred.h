@@ -0,0 +1,92 @@
+#ifndef MU_BPRED_H
+#define MU_BPRED_H
+
+#include <stdint.h>
+
+/***************************************************************/
+/* Branch prediction for the fetch stage                                                    */
+/* IF asks for the next PC before the instruction is decoded: the BTB    */
+/* says whether the PC holds a branch or jump and where it goes, the     */
+/* direction predictor decides conditional branches. EX reports every   */
+/* resolved branch and jump back with bpred_update().                            */
+/* Returns are predicted from a return address stack that calls push   */
+/* and returns pop when they are fetched; a misprediction repairs it    */
+/* from the checkpoint the mispredicted instruction took.                    */
+/***************************************************************/
+
+typedef enum
+{
+	BPRED_NOT_TAKEN, /* static: conditional branches fall through */
+	BPRED_BTFN,		 /* static: backward taken, forward not taken */
+	BPRED_BIMODAL,	 /* 2-bit counters indexed by PC */
+	BPRED_GSHARE,	 /* 2-bit counters indexed by PC xor global history */
+	BPRED_TOURNAMENT /* bimodal and gshare, a chooser per PC picks one */
+} bpred_kind_t;
+
+/* what the BTB knows about the instruction at a PC */
+typedef enum
+{
+	BRANCH_CONDITIONAL, /* B-type */
+	BRANCH_JUMP,		/* jal */
+	BRANCH_INDIRECT		/* jalr, predicted with its last target */
+} branch_kind_t;
+
+/* what a jump does to the return address stack, from the x1/x5 link hints */
+#define RAS_PUSH 0x1 /* a call: rd is x1 or x5 */
+#define RAS_POP 0x2	 /* a return: jalr through x1 or x5 */
+
+#define BPRED_MAX_BITS 20
+#define BPRED_RAS_MAX 64
+
+typedef struct
+{
+	uint64_t branches, branch_misses; /* conditional branches */
+	uint64_t jumps, jump_misses;	  /* jal and jalr */
+	uint64_t btb_hits, btb_misses;	  /* lookups for taken branches and jumps */
+	uint64_t returns, return_misses;  /* returns whose target came from the RAS */
+	uint64_t ras_overflows;			  /* pushes that overwrote the oldest entry */
+	uint64_t ras_underflows;		  /* returns fetched with the stack empty */
+	uint64_t ras_repairs;			  /* restores from a checkpoint */
+} bpred_stats_t;
+
+typedef struct
+{
+	uint32_t tag, target;
+	uint8_t valid, kind, ras;
+} btb_entry_t;
+
+typedef struct
+{
+	bpred_kind_t kind;
+	uint32_t bits;	   /* log2 of the counters in each table */
+	uint32_t btb_bits; /* log2 of the BTB entries, direct mapped */
+	uint32_t history;  /* global taken/not-taken history, newest in bit 0 */
+	uint8_t *bimodal, *gshare, *chooser;
+	btb_entry_t *btb;
+	uint32_t ras_depth; /* entries, 0 predicts returns from the BTB */
+	uint32_t ras[BPRED_RAS_MAX];
+	uint32_t ras_top, ras_count; /* top is the newest entry */
+	bpred_stats_t stats;
+} bpred_t;
+
+/* what IF predicted, carried down the pipeline for the update */
+typedef struct
+{
+	uint32_t next;	  /* predicted next PC */
+	uint32_t history; /* global history at the prediction */
+	uint8_t ras;	  /* RAS operations done at fetch */
+	uint32_t ras_top, ras_count, ras_saved; /* RAS checkpoint before them */
+} bpred_info_t;
+
+int bpred_init(bpred_t *bpred, bpred_kind_t kind, uint32_t bits, uint32_t btb_bits);
+void bpred_free(bpred_t *bpred);
+void bpred_reset(bpred_t *bpred);
+int bpred_ras_init(bpred_t *bpred, uint32_t depth);
+uint8_t bpred_ras_hint(branch_kind_t kind, uint32_t rd, uint32_t rs1);
+bpred_info_t bpred_predict(bpred_t *bpred, uint32_t pc);
+void bpred_update(bpred_t *bpred, uint32_t pc, branch_kind_t kind, uint8_t ras, int taken, uint32_t target,
+				  const bpred_info_t *info);
+void bpred_print_stats(const bpred_t *bpred, uint32_t instructions, uint32_t cycles);
+const char *bpred_name(bpred_kind_t kind);
+
+#endif
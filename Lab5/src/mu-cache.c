@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mu-cache.h"
+
+/***************************************************************/
+/* log2 of a power of two                                                                            */
+/***************************************************************/
+static uint32_t cache_log2(uint32_t value)
+{
+	uint32_t bits = 0;
+
+	while ((1u << bits) < value)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+static int is_power_of_two(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+/***************************************************************/
+/* Check a configuration, printing why it is rejected                              */
+/***************************************************************/
+int cache_config_valid(const cache_config_t *config)
+{
+	if (!is_power_of_two(config->size) || !is_power_of_two(config->assoc) || !is_power_of_two(config->block))
+	{
+		printf("Error: cache size, associativity and block size must be powers of two\n");
+		return 0;
+	}
+	if (config->block < 4 || config->size < config->assoc * config->block)
+	{
+		printf("Error: cache blocks must be at least 4 bytes and fit at least one set\n");
+		return 0;
+	}
+	if (config->repl == REPL_PLRU && config->assoc > 64)
+	{
+		printf("Error: pseudo-LRU supports at most 64 ways\n");
+		return 0;
+	}
+	return 1;
+}
+
+/***************************************************************/
+/* Allocate an empty cache; returns 0 if the configuration is rejected    */
+/***************************************************************/
+int cache_init(cache_t *cache, const char *name, const cache_config_t *config)
+{
+	if (!cache_config_valid(config))
+	{
+		return 0;
+	}
+
+	// Reconfiguring keeps the cache's place in the hierarchy
+	cache_free(cache);
+	cache->name = name;
+	cache->config = *config;
+	cache->sets = config->size / (config->assoc * config->block);
+	cache->offset_bits = cache_log2(config->block);
+	cache->index_bits = cache_log2(cache->sets);
+	cache->lines = malloc((size_t)cache->sets * config->assoc * sizeof(cache_line_t));
+	cache->plru = malloc((size_t)cache->sets * sizeof(uint64_t));
+	if (cache->lines == NULL || cache->plru == NULL)
+	{
+		printf("Error: Out of memory allocating the %s cache\n", name);
+		exit(-1);
+	}
+	cache_reset(cache);
+	return 1;
+}
+
+void cache_free(cache_t *cache)
+{
+	free(cache->lines);
+	free(cache->plru);
+	cache->lines = NULL;
+	cache->plru = NULL;
+}
+
+/***************************************************************/
+/* Invalidate every block and clear the statistics                                   */
+/***************************************************************/
+void cache_reset(cache_t *cache)
+{
+	memset(cache->lines, 0, (size_t)cache->sets * cache->config.assoc * sizeof(cache_line_t));
+	memset(cache->plru, 0, (size_t)cache->sets * sizeof(uint64_t));
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->clock = 0;
+	cache->random = 0x9E3779B9;
+}
+
+/***************************************************************/
+/* Replacement state                                                                                  */
+/***************************************************************/
+static void cache_touch(cache_t *cache, uint32_t set, uint32_t way)
+{
+	uint32_t levels = cache_log2(cache->config.assoc);
+	uint32_t node = 1, level;
+
+	cache->lines[set * cache->config.assoc + way].last_use = cache->clock;
+	if (cache->config.repl != REPL_PLRU)
+	{
+		return;
+	}
+	// Point every node on the path away from the way just used
+	for (level = 0; level < levels; level++)
+	{
+		uint32_t bit = (way >> (levels - 1 - level)) & 1;
+
+		if (bit)
+		{
+			cache->plru[set] &= ~(1ull << node);
+		}
+		else
+		{
+			cache->plru[set] |= 1ull << node;
+		}
+		node = 2 * node + bit;
+	}
+}
+
+static uint32_t cache_victim(cache_t *cache, uint32_t set)
+{
+	const cache_line_t *lines = &cache->lines[set * cache->config.assoc];
+	uint32_t assoc = cache->config.assoc;
+	uint32_t way, victim = 0, node = 1;
+
+	for (way = 0; way < assoc; way++)
+	{
+		if (!lines[way].valid)
+		{
+			return way;
+		}
+	}
+
+	switch (cache->config.repl)
+	{
+	case REPL_LRU:
+		for (way = 1; way < assoc; way++)
+		{
+			if (lines[way].last_use < lines[victim].last_use)
+			{
+				victim = way;
+			}
+		}
+		return victim;
+	case REPL_PLRU:
+		while (node < assoc)
+		{
+			node = 2 * node + ((cache->plru[set] >> node) & 1);
+		}
+		return node - assoc;
+	default:
+		cache->random ^= cache->random << 13;
+		cache->random ^= cache->random >> 17;
+		cache->random ^= cache->random << 5;
+		return cache->random & (assoc - 1);
+	}
+}
+
+/***************************************************************/
+/* Lower-level plumbing                                                                              */
+/***************************************************************/
+static uint32_t cache_find(const cache_t *cache, uint32_t address)
+{
+	uint32_t set = (address >> cache->offset_bits) & (cache->sets - 1);
+	uint32_t tag = address >> (cache->offset_bits + cache->index_bits);
+	const cache_line_t *lines = &cache->lines[set * cache->config.assoc];
+	uint32_t way;
+
+	for (way = 0; way < cache->config.assoc; way++)
+	{
+		if (lines[way].valid && lines[way].tag == tag)
+		{
+			break;
+		}
+	}
+	return way;
+}
+
+static void cache_insert(cache_t *cache, uint32_t address, int dirty, uint64_t now);
+
+// Write a block (a write-back or a write-through store) to the level below; never stalls
+static void cache_write_below(cache_t *cache, uint32_t address, int victim, uint64_t now)
+{
+	if (cache->next != NULL && cache->next->inclusion == INCLUSION_EXCLUSIVE)
+	{
+		// Exclusive levels only take whole victims; stores written through skip them
+		if (victim)
+		{
+			cache_insert(cache->next, address, 1, now);
+		}
+		else
+		{
+			cache_write_below(cache->next, address, 0, now);
+		}
+	}
+	else if (cache->next != NULL)
+	{
+		cache_access(cache->next, address, 1, now);
+	}
+	else if (cache->memory != NULL)
+	{
+		dram_access(cache->memory, address, 1, now);
+	}
+}
+
+// Bring a block up from the level below; returns its latency
+static uint32_t cache_fetch_below(cache_t *cache, uint32_t address, uint64_t now, int *dirty)
+{
+	cache_t *next = cache->next;
+	uint32_t way, cycles;
+
+	*dirty = 0;
+	if (next == NULL)
+	{
+		return cache->memory != NULL ? dram_access(cache->memory, address, 0, now) : 0;
+	}
+	if (next->inclusion != INCLUSION_EXCLUSIVE)
+	{
+		return cache_access(next, address, 0, now);
+	}
+
+	// An exclusive level gives the block up on a hit and is not filled on a miss
+	next->clock++;
+	next->stats.reads++;
+	way = cache_find(next, address);
+	if (way < next->config.assoc)
+	{
+		cache_line_t *line = &next->lines[((address >> next->offset_bits) & (next->sets - 1)) * next->config.assoc + way];
+
+		next->stats.hits++;
+		next->stats.cycles += next->config.latency;
+		*dirty = line->dirty;
+		line->valid = 0;
+		line->dirty = 0;
+		return next->config.latency;
+	}
+	next->stats.misses++;
+	cycles = next->config.latency + cache_fetch_below(next, address, now, dirty);
+	next->stats.cycles += cycles;
+	return cycles;
+}
+
+// Remove a block from the caches above; returns whether any of them held it dirty
+static int cache_back_invalidate(cache_t *cache, uint32_t address)
+{
+	uint32_t i, offset;
+	int dirty = 0;
+
+	for (i = 0; i < cache->upper_count; i++)
+	{
+		cache_t *upper = cache->upper[i];
+
+		for (offset = 0; offset < cache->config.block; offset += upper->config.block)
+		{
+			uint32_t block = address + offset;
+			uint32_t way = cache_find(upper, block);
+
+			if (way < upper->config.assoc)
+			{
+				cache_line_t *line = &upper->lines[((block >> upper->offset_bits) & (upper->sets - 1)) * upper->config.assoc + way];
+
+				cache->stats.back_invalidations++;
+				dirty |= line->dirty;
+				line->valid = 0;
+				line->dirty = 0;
+			}
+		}
+	}
+	return dirty;
+}
+
+// Make room in a set and install a block; returns the way and, if victim is not NULL, the evicted block
+static uint32_t cache_fill(cache_t *cache, uint32_t address, int dirty, uint64_t now, uint32_t *victim_block)
+{
+	uint32_t set = (address >> cache->offset_bits) & (cache->sets - 1);
+	uint32_t way = cache_victim(cache, set);
+	cache_line_t *line = &cache->lines[set * cache->config.assoc + way];
+
+	if (line->valid)
+	{
+		uint32_t victim = ((line->tag << cache->index_bits) | set) << cache->offset_bits;
+
+		cache->stats.evictions++;
+		if (victim_block != NULL)
+		{
+			*victim_block = victim;
+		}
+		if (cache->inclusion == INCLUSION_INCLUSIVE)
+		{
+			line->dirty |= cache_back_invalidate(cache, victim);
+		}
+		if (cache->next != NULL && cache->next->inclusion == INCLUSION_EXCLUSIVE)
+		{
+			cache_insert(cache->next, victim, line->dirty, now);
+		}
+		else if (line->dirty)
+		{
+			// Write-backs drain through a write buffer and do not stall the pipeline
+			cache->stats.writebacks++;
+			cache_write_below(cache, victim, 1, now);
+		}
+	}
+	line->valid = 1;
+	line->dirty = dirty;
+	line->prefetched = 0;
+	line->ready = 0;
+	line->tag = address >> (cache->offset_bits + cache->index_bits);
+	cache_touch(cache, set, way);
+	return way;
+}
+
+// Place a block evicted from the level above into an exclusive cache
+static void cache_insert(cache_t *cache, uint32_t address, int dirty, uint64_t now)
+{
+	uint32_t way = cache_find(cache, address);
+
+	cache->clock++;
+	cache->stats.writes++;
+	if (way < cache->config.assoc)
+	{
+		uint32_t set = (address >> cache->offset_bits) & (cache->sets - 1);
+
+		cache->lines[set * cache->config.assoc + way].dirty |= dirty;
+		cache_touch(cache, set, way);
+		return;
+	}
+	cache_fill(cache, address, dirty, now, NULL);
+}
+
+/***************************************************************/
+/* Connect a cache to the level below it (NULL for memory)                     */
+/***************************************************************/
+void cache_attach(cache_t *upper, cache_t *lower, dram_t *memory)
+{
+	upper->next = lower;
+	upper->memory = memory;
+	if (lower != NULL && lower->upper_count < CACHE_MAX_UPPER)
+	{
+		lower->upper[lower->upper_count++] = upper;
+	}
+}
+
+/***************************************************************/
+/* Look up one access and update the hierarchy; returns its latency     */
+/***************************************************************/
+uint32_t cache_access(cache_t *cache, uint32_t address, int write, uint64_t now)
+{
+	uint32_t way, cycles;
+	int dirty;
+
+	cache->clock++;
+	if (write)
+	{
+		cache->stats.writes++;
+	}
+	else
+	{
+		cache->stats.reads++;
+	}
+
+	way = cache_find(cache, address);
+	if (way < cache->config.assoc)
+	{
+		uint32_t set = (address >> cache->offset_bits) & (cache->sets - 1);
+
+		cache_line_t *line = &cache->lines[set * cache->config.assoc + way];
+
+		cache->stats.hits++;
+		if (write && cache->config.write == WRITE_BACK)
+		{
+			line->dirty = 1;
+		}
+		else if (write)
+		{
+			cache_write_below(cache, address, 0, now);
+		}
+		cache_touch(cache, set, way);
+		// A block still on its way (a prefetch in flight) is only as fast as its arrival
+		cycles = cache->config.latency + (line->ready > now ? (uint32_t)(line->ready - now) : 0);
+		cache->stats.cycles += cycles;
+		return cycles;
+	}
+
+	cache->stats.misses++;
+	// A write-through cache sends missing stores on without fetching the block
+	if (write && cache->config.write == WRITE_THROUGH)
+	{
+		cache_write_below(cache, address, 0, now);
+		cache->stats.cycles += cache->config.latency;
+		return cache->config.latency;
+	}
+
+	cycles = cache->config.latency + cache_fetch_below(cache, address, now, &dirty);
+	way = cache_fill(cache, address, dirty || write, now, NULL);
+	cache->lines[((address >> cache->offset_bits) & (cache->sets - 1)) * cache->config.assoc + way].ready = now + cycles;
+	cache->stats.cycles += cycles;
+	return cycles;
+}
+
+/***************************************************************/
+/* Side doors for prefetchers: look a block up without touching the     */
+/* statistics, fetch one from the level below without filling this cache, */
+/* and install one that arrives at a given cycle.                                */
+/***************************************************************/
+cache_line_t *cache_lookup(cache_t *cache, uint32_t address)
+{
+	uint32_t way = cache_find(cache, address);
+
+	if (way == cache->config.assoc)
+	{
+		return NULL;
+	}
+	return &cache->lines[((address >> cache->offset_bits) & (cache->sets - 1)) * cache->config.assoc + way];
+}
+
+uint32_t cache_fetch(cache_t *cache, uint32_t address, uint64_t now, int *dirty)
+{
+	return cache_fetch_below(cache, address & ~(cache->config.block - 1), now, dirty);
+}
+
+// victim is set to the evicted block's address, or UINT32_MAX if the way was free
+cache_line_t *cache_install(cache_t *cache, uint32_t address, int dirty, uint64_t ready, uint32_t *victim)
+{
+	uint32_t way;
+	cache_line_t *line;
+
+	*victim = UINT32_MAX;
+	cache->clock++;
+	line = cache_lookup(cache, address);
+	if (line != NULL)
+	{
+		line->dirty |= dirty;
+		return line;
+	}
+	// The victim leaves when the new block arrives
+	way = cache_fill(cache, address, dirty, ready, victim);
+	line = &cache->lines[((address >> cache->offset_bits) & (cache->sets - 1)) * cache->config.assoc + way];
+	line->ready = ready;
+	return line;
+}
+
+const char *cache_repl_name(cache_repl_t repl)
+{
+	switch (repl)
+	{
+	case REPL_LRU:
+		return "LRU";
+	case REPL_PLRU:
+		return "PLRU";
+	default:
+		return "random";
+	}
+}
+
+const char *cache_inclusion_name(cache_inclusion_t inclusion)
+{
+	switch (inclusion)
+	{
+	case INCLUSION_INCLUSIVE:
+		return "inclusive";
+	case INCLUSION_EXCLUSIVE:
+		return "exclusive";
+	default:
+		return "NINE";
+	}
+}
+
+/***************************************************************/
+/* Print the configuration and statistics of a cache                                */
+/***************************************************************/
+void cache_print_stats(const cache_t *cache)
+{
+	const cache_stats_t *stats = &cache->stats;
+	uint64_t accesses = stats->hits + stats->misses;
+
+	printf("%s: %u bytes, %u-way, %u-byte blocks, %s, %s, %u-cycle latency", cache->name,
+		   cache->config.size, cache->config.assoc, cache->config.block, cache_repl_name(cache->config.repl),
+		   cache->config.write == WRITE_BACK ? "write-back" : "write-through", cache->config.latency);
+	printf(cache->upper_count > 0 ? ", %s\n" : "\n", cache_inclusion_name(cache->inclusion));
+	printf("  reads\t\t: %llu\n", (unsigned long long)stats->reads);
+	printf("  writes\t: %llu\n", (unsigned long long)stats->writes);
+	printf("  hits\t\t: %llu\n", (unsigned long long)stats->hits);
+	printf("  misses\t: %llu\n", (unsigned long long)stats->misses);
+	printf("  evictions\t: %llu\n", (unsigned long long)stats->evictions);
+	printf("  writebacks\t: %llu\n", (unsigned long long)stats->writebacks);
+	if (cache->upper_count > 0)
+	{
+		printf("  back-invalidations\t: %llu\n", (unsigned long long)stats->back_invalidations);
+	}
+	printf("  miss rate\t: %.2f%%\n", accesses ? 100.0 * stats->misses / accesses : 0.0);
+	printf("  average latency\t: %.2f cycles\n\n", accesses ? (double)stats->cycles / accesses : 0.0);
+}
+
+/***************************************************************/
+/* MSHRs; returns 0 if the count is out of range                                    */
+/***************************************************************/
+int mshr_init(mshr_file_t *mshrs, uint32_t count)
+{
+	if (count > CACHE_MAX_MSHRS)
+	{
+		printf("Error: at most %d MSHRs\n", CACHE_MAX_MSHRS);
+		return 0;
+	}
+	mshrs->count = count;
+	mshr_reset(mshrs);
+	return 1;
+}
+
+void mshr_reset(mshr_file_t *mshrs)
+{
+	memset(mshrs->block, 0, sizeof(mshrs->block));
+	memset(mshrs->ready, 0, sizeof(mshrs->ready));
+	memset(&mshrs->stats, 0, sizeof(mshrs->stats));
+}
+
+// Index of the MSHR still fetching a block, -1 if none
+int mshr_find(const mshr_file_t *mshrs, uint32_t block, uint64_t now)
+{
+	uint32_t i;
+
+	for (i = 0; i < mshrs->count; i++)
+	{
+		if (mshrs->ready[i] > now && mshrs->block[i] == block)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+uint32_t mshr_outstanding(const mshr_file_t *mshrs, uint64_t now)
+{
+	uint32_t i, busy = 0;
+
+	for (i = 0; i < mshrs->count; i++)
+	{
+		busy += mshrs->ready[i] > now;
+	}
+	return busy;
+}
+
+// First cycle from now on with a free MSHR
+uint64_t mshr_free_at(const mshr_file_t *mshrs, uint64_t now)
+{
+	uint64_t first = UINT64_MAX;
+	uint32_t i;
+
+	for (i = 0; i < mshrs->count; i++)
+	{
+		if (mshrs->ready[i] <= now)
+		{
+			return now;
+		}
+		if (mshrs->ready[i] < first)
+		{
+			first = mshrs->ready[i];
+		}
+	}
+	return first;
+}
+
+// Takes a free MSHR; the caller waits for mshr_free_at() first
+void mshr_allocate(mshr_file_t *mshrs, uint32_t block, uint64_t ready, uint64_t now)
+{
+	uint32_t i;
+
+	for (i = 0; i < mshrs->count; i++)
+	{
+		if (mshrs->ready[i] <= now)
+		{
+			mshrs->block[i] = block;
+			mshrs->ready[i] = ready;
+			mshrs->stats.primary++;
+			return;
+		}
+	}
+}
+
+void mshr_print_stats(const mshr_file_t *mshrs)
+{
+	const mshr_stats_t *stats = &mshrs->stats;
+
+	if (mshrs->count == 0)
+	{
+		printf("MSHRs: none, the D-cache blocks on every miss\n\n");
+		return;
+	}
+	printf("MSHRs: %u\n", mshrs->count);
+	printf("  primary misses\t: %llu\n", (unsigned long long)stats->primary);
+	printf("  secondary misses\t: %llu\n", (unsigned long long)stats->secondary);
+	printf("  hits under miss\t: %llu\n", (unsigned long long)stats->hit_under_miss);
+	printf("  full\t\t: %llu (%llu cycles)\n", (unsigned long long)stats->full, (unsigned long long)stats->full_cycles);
+	printf("  data wait cycles\t: %llu\n\n", (unsigned long long)stats->use_cycles);
+}
+
+/***************************************************************/
+/* DRAM: a fixed latency, or banks with an open row each                     */
+/***************************************************************/
+int dram_init(dram_t *dram, const dram_config_t *config)
+{
+	uint32_t banks = config->banks ? config->banks : 1;
+
+	if (config->banks && (!is_power_of_two(config->banks) || !is_power_of_two(config->row_size)))
+	{
+		printf("Error: DRAM bank count and row size must be powers of two\n");
+		return 0;
+	}
+
+	dram_free(dram);
+	dram->config = *config;
+	dram->open_row = malloc(banks * sizeof(uint32_t));
+	dram->busy_until = malloc(banks * sizeof(uint64_t));
+	if (dram->open_row == NULL || dram->busy_until == NULL)
+	{
+		printf("Error: Out of memory allocating the DRAM model\n");
+		exit(-1);
+	}
+	dram_reset(dram);
+	return 1;
+}
+
+void dram_free(dram_t *dram)
+{
+	free(dram->open_row);
+	free(dram->busy_until);
+	dram->open_row = NULL;
+	dram->busy_until = NULL;
+}
+
+void dram_reset(dram_t *dram)
+{
+	uint32_t banks = dram->config.banks ? dram->config.banks : 1;
+
+	memset(dram->open_row, 0xFF, banks * sizeof(uint32_t));
+	memset(dram->busy_until, 0, banks * sizeof(uint64_t));
+	memset(&dram->stats, 0, sizeof(dram->stats));
+}
+
+// Returns the cycles until the data is back; writes occupy the bank but nobody waits for them
+uint32_t dram_access(dram_t *dram, uint32_t address, int write, uint64_t now)
+{
+	uint32_t bank = 0, row = 0, latency = dram->config.latency;
+	uint64_t start = now;
+
+	if (write)
+	{
+		dram->stats.writes++;
+	}
+	else
+	{
+		dram->stats.reads++;
+	}
+
+	if (dram->config.banks)
+	{
+		bank = (address / dram->config.row_size) & (dram->config.banks - 1);
+		row = address / dram->config.row_size / dram->config.banks;
+		if (dram->open_row[bank] == row)
+		{
+			dram->stats.row_hits++;
+		}
+		else
+		{
+			dram->stats.row_misses++;
+			dram->open_row[bank] = row;
+			latency = dram->config.row_miss_latency;
+		}
+		if (dram->busy_until[bank] > now)
+		{
+			start = dram->busy_until[bank];
+			dram->stats.queue_cycles += start - now;
+		}
+		dram->busy_until[bank] = start + latency;
+	}
+
+	latency = (uint32_t)(start - now) + latency;
+	if (!write)
+	{
+		dram->stats.cycles += latency;
+	}
+	return latency;
+}
+
+void dram_print_stats(const dram_t *dram)
+{
+	const dram_stats_t *stats = &dram->stats;
+
+	if (dram->config.banks)
+	{
+		printf("DRAM: %u banks, %u-byte rows, %u-cycle row hit, %u-cycle row miss\n", dram->config.banks,
+			   dram->config.row_size, dram->config.latency, dram->config.row_miss_latency);
+	}
+	else
+	{
+		printf("DRAM: fixed %u-cycle latency\n", dram->config.latency);
+	}
+	printf("  reads\t\t: %llu\n", (unsigned long long)stats->reads);
+	printf("  writes\t: %llu\n", (unsigned long long)stats->writes);
+	if (dram->config.banks)
+	{
+		printf("  row hits\t: %llu\n", (unsigned long long)stats->row_hits);
+		printf("  row misses\t: %llu\n", (unsigned long long)stats->row_misses);
+		printf("  queue cycles\t: %llu\n", (unsigned long long)stats->queue_cycles);
+	}
+	printf("  average read latency\t: %.2f cycles\n\n", stats->reads ? (double)stats->cycles / stats->reads : 0.0);
+}
@@ -0,0 +1,157 @@
+#ifndef MU_CACHE_H
+#define MU_CACHE_H
+
+#include <stdint.h>
+
+/***************************************************************/
+/* Set-associative cache and DRAM timing model                                          */
+/* Only tags are kept: the data always lives in simulated memory, the  */
+/* hierarchy decides how many cycles an access costs.                               */
+/***************************************************************/
+
+typedef enum
+{
+	REPL_LRU,	 /* least recently used, exact */
+	REPL_PLRU,	 /* tree pseudo-LRU, one bit per internal node */
+	REPL_RANDOM
+} cache_repl_t;
+
+typedef enum
+{
+	WRITE_BACK,	   /* write-allocate, dirty blocks written on eviction */
+	WRITE_THROUGH  /* no-write-allocate, every store goes to the next level */
+} cache_write_t;
+
+/* how a lower level holds the blocks of the caches above it */
+typedef enum
+{
+	INCLUSION_NINE,		  /* non-inclusive non-exclusive: filled on misses, evicts freely */
+	INCLUSION_INCLUSIVE,  /* evicting a block back-invalidates it above */
+	INCLUSION_EXCLUSIVE	  /* holds only blocks evicted from above; a hit moves the block up */
+} cache_inclusion_t;
+
+typedef struct
+{
+	uint32_t size;	  /* bytes, power of two */
+	uint32_t assoc;	  /* ways per set, power of two */
+	uint32_t block;	  /* bytes per block, power of two, at least 4 */
+	cache_repl_t repl;
+	cache_write_t write;
+	uint32_t latency; /* cycles to look up this level (L1 lookups overlap the stage) */
+} cache_config_t;
+
+typedef struct
+{
+	uint32_t banks;			   /* 0 for a fixed latency */
+	uint32_t row_size;		   /* bytes per row in one bank */
+	uint32_t latency;		   /* every access when fixed, an open-row hit when banked */
+	uint32_t row_miss_latency; /* precharge + activate + read when banked */
+} dram_config_t;
+
+typedef struct
+{
+	uint64_t reads, writes;
+	uint64_t row_hits, row_misses;
+	uint64_t queue_cycles; /* waiting for a busy bank */
+	uint64_t cycles;	   /* total latency of reads */
+} dram_stats_t;
+
+typedef struct dram
+{
+	dram_config_t config;
+	uint32_t *open_row;	   /* per bank, UINT32_MAX when closed */
+	uint64_t *busy_until;  /* per bank, cycle the bank is next free */
+	dram_stats_t stats;
+} dram_t;
+
+typedef struct
+{
+	uint32_t tag;
+	uint8_t valid, dirty;
+	uint8_t prefetched; /* filled by a prefetch and not used by a demand access yet */
+	uint64_t last_use;	/* access number of the last hit or fill, for LRU */
+	uint64_t ready;		/* cycle the block's data arrives; later accesses wait for it */
+} cache_line_t;
+
+typedef struct
+{
+	uint64_t reads, writes;
+	uint64_t hits, misses;
+	uint64_t evictions, writebacks;
+	uint64_t back_invalidations; /* blocks removed above to keep this level inclusive */
+	uint64_t cycles;			 /* total latency returned for demand accesses */
+} cache_stats_t;
+
+#define CACHE_MAX_UPPER 2
+
+typedef struct cache
+{
+	const char *name;
+	cache_config_t config;
+	uint32_t sets, offset_bits, index_bits;
+	cache_line_t *lines; /* sets * assoc, one set after another */
+	uint64_t *plru;		 /* tree bits per set, node n at bit n (root is 1) */
+	uint64_t clock;		 /* accesses so far, timestamps for LRU */
+	uint32_t random;	 /* xorshift state for REPL_RANDOM */
+	cache_stats_t stats;
+
+	/* hierarchy: misses go to next, or to memory at the last level */
+	cache_inclusion_t inclusion;
+	struct cache *next;
+	struct cache *upper[CACHE_MAX_UPPER];
+	uint32_t upper_count;
+	dram_t *memory;
+} cache_t;
+
+/***************************************************************/
+/* Miss status holding registers: one per block being fetched, so a     */
+/* cache with free MSHRs keeps serving hits while misses are out.        */
+/***************************************************************/
+#define CACHE_MAX_MSHRS 32
+
+typedef struct
+{
+	uint64_t primary;		  /* misses that took an MSHR */
+	uint64_t secondary;		  /* misses merged into the MSHR of their block */
+	uint64_t hit_under_miss;  /* hits while another miss was outstanding */
+	uint64_t full;			  /* misses that waited for a free MSHR */
+	uint64_t full_cycles;
+	uint64_t use_cycles;	  /* cycles instructions waited for missing data */
+} mshr_stats_t;
+
+typedef struct
+{
+	uint32_t count;					 /* 0 for a blocking cache */
+	uint32_t block[CACHE_MAX_MSHRS];
+	uint64_t ready[CACHE_MAX_MSHRS]; /* cycle the block arrives and the MSHR frees */
+	mshr_stats_t stats;
+} mshr_file_t;
+
+int cache_config_valid(const cache_config_t *config);
+int cache_init(cache_t *cache, const char *name, const cache_config_t *config);
+void cache_free(cache_t *cache);
+void cache_reset(cache_t *cache);
+void cache_attach(cache_t *upper, cache_t *lower, dram_t *memory);
+uint32_t cache_access(cache_t *cache, uint32_t address, int write, uint64_t now);
+cache_line_t *cache_lookup(cache_t *cache, uint32_t address);
+uint32_t cache_fetch(cache_t *cache, uint32_t address, uint64_t now, int *dirty);
+cache_line_t *cache_install(cache_t *cache, uint32_t address, int dirty, uint64_t ready, uint32_t *victim);
+void cache_print_stats(const cache_t *cache);
+const char *cache_repl_name(cache_repl_t repl);
+const char *cache_inclusion_name(cache_inclusion_t inclusion);
+
+int mshr_init(mshr_file_t *mshrs, uint32_t count);
+void mshr_reset(mshr_file_t *mshrs);
+int mshr_find(const mshr_file_t *mshrs, uint32_t block, uint64_t now);
+uint32_t mshr_outstanding(const mshr_file_t *mshrs, uint64_t now);
+uint64_t mshr_free_at(const mshr_file_t *mshrs, uint64_t now);
+void mshr_allocate(mshr_file_t *mshrs, uint32_t block, uint64_t ready, uint64_t now);
+void mshr_print_stats(const mshr_file_t *mshrs);
+
+int dram_init(dram_t *dram, const dram_config_t *config);
+void dram_free(dram_t *dram);
+void dram_reset(dram_t *dram);
+uint32_t dram_access(dram_t *dram, uint32_t address, int write, uint64_t now);
+void dram_print_stats(const dram_t *dram);
+
+#endif
@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mu-ooo.h"
+#include "mu-decode.h"
+
+#define OOO_NEVER UINT64_MAX
+
+/***************************************************************/
+/* Take a configuration; returns 0 if a size is out of range               */
+/***************************************************************/
+int ooo_configure(ooo_t *ooo, const ooo_config_t *config)
+{
+	uint32_t fu;
+
+	if (config->width < 1 || config->width > OOO_WIDTH_MAX || config->rob_size < 1 ||
+		config->rob_size > OOO_ROB_MAX || config->lsq_size < 1 || config->lsq_size > OOO_ROB_MAX)
+	{
+		printf("Error: the width must be 1 to %d, the ROB and LSQ 1 to %d entries\n", OOO_WIDTH_MAX, OOO_ROB_MAX);
+		return 0;
+	}
+	for (fu = 0; fu < FU_CLASSES; fu++)
+	{
+		if (config->rs_size[fu] < 1 || config->rs_size[fu] > OOO_RS_MAX || config->units[fu] < 1 ||
+			config->units[fu] > OOO_UNITS_MAX || config->latency[fu] < 1 || config->latency[fu] > OOO_LATENCY_MAX)
+		{
+			printf("Error: %s needs 1 to %d RS entries, 1 to %d units and a latency of 1 to %d\n",
+				   ooo_unit_name(fu), OOO_RS_MAX, OOO_UNITS_MAX, OOO_LATENCY_MAX);
+			return 0;
+		}
+	}
+	ooo->config = *config;
+	return 1;
+}
+
+/***************************************************************/
+/* Empty every queue and map each register onto its own physical one, */
+/* loaded from the architectural registers                                         */
+/***************************************************************/
+void ooo_reset(ooo_t *ooo, uint32_t pc)
+{
+	uint32_t r;
+
+	ooo->pc = pc;
+	ooo->fetch_pc = pc;
+	ooo->fetch_busy = 0;
+	ooo->redirect = 0;
+	ooo->fetch_head = 0;
+	ooo->fetch_count = 0;
+	ooo->rob_head = 0;
+	ooo->rob_count = 0;
+	memset(ooo->rs_count, 0, sizeof(ooo->rs_count));
+	ooo->lsq_count = 0;
+	memset(ooo->div_free, 0, sizeof(ooo->div_free));
+
+	for (r = 0; r < 32; r++)
+	{
+		ooo->rat[r] = r;
+		ooo->value[r] = r == 0 ? 0 : ooo->env.regs[r];
+		ooo->ready_at[r] = 0;
+	}
+	ooo->free_count = 0;
+	for (r = OOO_PREGS; r-- > 32;)
+	{
+		ooo->free_list[ooo->free_count++] = r;
+	}
+	memset(&ooo->stats, 0, sizeof(ooo->stats));
+}
+
+const char *ooo_unit_name(fu_class_t fu)
+{
+	switch (fu)
+	{
+	case FU_BRANCH:
+		return "branch";
+	case FU_MEM:
+		return "mem";
+	case FU_MUL:
+		return "mul";
+	case FU_DIV:
+		return "div";
+	default:
+		return "alu";
+	}
+}
+
+// The i-th oldest instruction in the ROB
+static rob_entry_t *rob_entry(ooo_t *ooo, uint32_t i)
+{
+	return &ooo->rob[(ooo->rob_head + i) % OOO_ROB_MAX];
+}
+
+static uint32_t rob_age(const ooo_t *ooo, uint32_t slot)
+{
+	return (slot + OOO_ROB_MAX - ooo->rob_head) % OOO_ROB_MAX;
+}
+
+static fu_class_t unit_class(uint32_t id)
+{
+	switch (ISA_FORMAT[id])
+	{
+	case FMT_B:
+	case FMT_J:
+		return FU_BRANCH;
+	case FMT_S:
+		return FU_MEM;
+	case FMT_LOAD:
+		return id == INST_JALR ? FU_BRANCH : FU_MEM;
+	default:
+		return isa_is_mul(id) ? FU_MUL : isa_is_div(id) ? FU_DIV : FU_ALU;
+	}
+}
+
+static int reads_rs1(uint32_t format)
+{
+	return format != FMT_NONE && format != FMT_U && format != FMT_J;
+}
+
+static int reads_rs2(uint32_t format)
+{
+	return format == FMT_R || format == FMT_S || format == FMT_B;
+}
+
+// funct3[1:0] is the access size for both loads and stores
+static uint32_t access_size(uint32_t ir)
+{
+	return 1u << ((ir >> 12) & 0x3);
+}
+
+/***************************************************************/
+/* Retire finished instructions from the ROB head, in program order      */
+/***************************************************************/
+static uint32_t ooo_commit(ooo_t *ooo, uint64_t now)
+{
+	uint32_t n, committed = 0;
+
+	for (n = 0; n < ooo->config.width && ooo->rob_count > 0; n++)
+	{
+		const rob_entry_t *e = rob_entry(ooo, 0);
+
+		if (e->state != ROB_DONE)
+		{
+			break;
+		}
+		// The mapping this instruction replaced can no longer be read by anyone
+		if (e->rd != 0)
+		{
+			ooo->env.regs[e->rd] = ooo->value[e->pdst];
+			ooo->free_list[ooo->free_count++] = e->pold;
+		}
+		if (ISA_FORMAT[e->id] == FMT_S)
+		{
+			// Memory only changes here; the write drains to the D-cache behind commit
+			ooo->env.store(ooo->env.context, e->address, access_size(e->ir), e->data);
+			ooo->env.data_ready(ooo->env.context, e->pc, e->address, 1, now);
+		}
+		if (e->fu == FU_MEM)
+		{
+			ooo->lsq_count--;
+		}
+		ooo->pc = e->next;
+		committed += e->ir != 0;
+		ooo->rob_head = (ooo->rob_head + 1) % OOO_ROB_MAX;
+		ooo->rob_count--;
+	}
+	ooo->stats.committed += committed;
+	return committed;
+}
+
+// Throw away every instruction younger than the first keep, undoing their renames youngest first
+static void ooo_squash(ooo_t *ooo, uint32_t keep)
+{
+	uint32_t fu, i, j;
+
+	while (ooo->rob_count > keep)
+	{
+		const rob_entry_t *e = rob_entry(ooo, ooo->rob_count - 1);
+
+		if (e->rd != 0)
+		{
+			ooo->rat[e->rd] = e->pold;
+			ooo->free_list[ooo->free_count++] = e->pdst;
+		}
+		if (e->fu == FU_MEM)
+		{
+			ooo->lsq_count--;
+		}
+		ooo->rob_count--;
+		ooo->stats.squashed++;
+	}
+	for (fu = 0; fu < FU_CLASSES; fu++)
+	{
+		for (i = j = 0; i < ooo->rs_count[fu]; i++)
+		{
+			if (rob_age(ooo, ooo->rs[fu][i]) < ooo->rob_count)
+			{
+				ooo->rs[fu][j++] = ooo->rs[fu][i];
+			}
+		}
+		ooo->rs_count[fu] = j;
+	}
+	ooo->stats.squashed += ooo->fetch_count;
+	ooo->fetch_count = 0;
+}
+
+// Train the predictor with a resolved branch or jump; returns whether fetch went the wrong way
+static int ooo_resolve(ooo_t *ooo, const rob_entry_t *e)
+{
+	const branch_kind_t kind = ISA_FORMAT[e->id] == FMT_B ? BRANCH_CONDITIONAL
+							   : e->id == INST_JALR			? BRANCH_INDIRECT
+															: BRANCH_JUMP;
+	const uint8_t ras = bpred_ras_hint(kind, (e->ir >> 7) & 0x1F, (e->ir >> 15) & 0x1F);
+
+	bpred_update(ooo->env.bpred, e->pc, kind, ras, e->taken, e->target, &e->prediction);
+	return e->next != e->prediction.next;
+}
+
+/***************************************************************/
+/* Mark instructions whose result is out as done; a mispredicted      */
+/* branch squashes everything behind it and redirects fetch              */
+/***************************************************************/
+static void ooo_complete(ooo_t *ooo, uint64_t now)
+{
+	uint32_t i;
+
+	for (i = 0; i < ooo->rob_count; i++)
+	{
+		rob_entry_t *e = rob_entry(ooo, i);
+
+		if (e->state != ROB_EXECUTING || e->done_at > now)
+		{
+			continue;
+		}
+		// A store issued with its address; it is done once its data is there too
+		if (ISA_FORMAT[e->id] == FMT_S)
+		{
+			if (ooo->ready_at[e->psrc2] > now)
+			{
+				continue;
+			}
+			e->data = ooo->value[e->psrc2];
+		}
+		e->state = ROB_DONE;
+		if (e->fu == FU_BRANCH && ooo_resolve(ooo, e))
+		{
+			ooo->stats.mispredicts++;
+			ooo_squash(ooo, i + 1);
+			ooo->redirect = 1;
+			ooo->redirect_pc = e->next;
+			break;
+		}
+	}
+}
+
+// Whether an older store keeps a load from issuing; *forward is set if one holds all its bytes
+static int load_blocked(ooo_t *ooo, uint32_t age, uint32_t address, uint32_t size, int *forward, uint32_t *value)
+{
+	uint32_t i;
+
+	*forward = 0;
+	for (i = age; i-- > 0;)
+	{
+		const rob_entry_t *store = rob_entry(ooo, i);
+		const uint32_t store_size = access_size(store->ir);
+
+		if (ISA_FORMAT[store->id] != FMT_S)
+		{
+			continue;
+		}
+		// An unknown address might be the load's
+		if (store->state == ROB_WAITING)
+		{
+			return 1;
+		}
+		if (address >= store->address + store_size || store->address >= address + size)
+		{
+			continue;
+		}
+		// The youngest overlapping store decides: it forwards if it covers the load and has its data,
+		// else the load waits for it
+		if (store->state == ROB_DONE && store->address <= address && address + size <= store->address + store_size)
+		{
+			*forward = 1;
+			*value = store->data >> (8 * (address - store->address));
+			if (size < 4)
+			{
+				*value &= (1u << (8 * size)) - 1;
+			}
+			return 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// Read the operands and compute the result; it reaches dependents at done_at
+static void ooo_execute(ooo_t *ooo, rob_entry_t *e, uint64_t now, int forward, uint32_t forwarded)
+{
+	const uint32_t a = ooo->value[e->psrc1], b = ooo->value[e->psrc2];
+	uint32_t result = isa_execute(e->id, a, b, e->imm, e->pc);
+
+	e->done_at = now + ooo->config.latency[e->fu];
+	e->next = e->pc + 4;
+	ooo->stats.busy[e->fu]++;
+	if (e->fu == FU_DIV)
+	{
+		const uint32_t cycles = isa_div_cycles(e->id, a, b, ooo->config.latency[FU_DIV]);
+
+		e->done_at = now + cycles;
+		ooo->stats.busy[FU_DIV] += cycles - 1;
+		ooo->stats.early_outs += cycles < ooo->config.latency[FU_DIV];
+	}
+	else if (e->fu == FU_BRANCH)
+	{
+		e->taken = e->id == INST_JAL || e->id == INST_JALR || isa_taken(e->id, a, b);
+		e->target = e->id == INST_JALR ? (a + e->imm) & ~1u : e->pc + e->imm;
+		e->next = e->taken ? e->target : e->pc + 4;
+	}
+	else if (e->fu == FU_MEM)
+	{
+		const uint32_t size = access_size(e->ir);
+
+		e->address = result;
+		if (ISA_FORMAT[e->id] == FMT_LOAD)
+		{
+			if (forward)
+			{
+				result = forwarded;
+				ooo->stats.forwarded++;
+			}
+			else
+			{
+				result = ooo->env.load(ooo->env.context, e->address, size);
+				e->done_at = ooo->env.data_ready(ooo->env.context, e->pc, e->address, 0, now) +
+							 ooo->config.latency[e->fu];
+			}
+			if (e->id == INST_LB)
+			{
+				result = (uint32_t)(int32_t)(int8_t)result;
+			}
+			else if (e->id == INST_LH)
+			{
+				result = (uint32_t)(int32_t)(int16_t)result;
+			}
+		}
+	}
+	if (e->rd != 0)
+	{
+		ooo->value[e->pdst] = result;
+		ooo->ready_at[e->pdst] = e->done_at;
+	}
+	e->state = ROB_EXECUTING;
+	ooo->stats.issued[e->fu]++;
+}
+
+/***************************************************************/
+/* Each unit class issues its oldest ready instructions, one per unit  */
+/***************************************************************/
+static void ooo_issue(ooo_t *ooo, uint64_t now)
+{
+	uint32_t fu, i, n;
+
+	for (fu = 0; fu < FU_CLASSES; fu++)
+	{
+		uint32_t ready[OOO_RS_MAX], forwarded[OOO_RS_MAX], count = 0;
+		int forward[OOO_RS_MAX];
+
+		for (i = 0; i < ooo->rs_count[fu]; i++)
+		{
+			const uint32_t slot = ooo->rs[fu][i];
+			const rob_entry_t *e = &ooo->rob[slot];
+
+			forward[i] = 0;
+			forwarded[i] = 0;
+			if (ooo->ready_at[e->psrc1] > now || (ISA_FORMAT[e->id] != FMT_S && ooo->ready_at[e->psrc2] > now))
+			{
+				continue;
+			}
+			if (ISA_FORMAT[e->id] == FMT_LOAD && fu == FU_MEM &&
+				load_blocked(ooo, rob_age(ooo, slot), ooo->value[e->psrc1] + e->imm, access_size(e->ir),
+							 &forward[i], &forwarded[i]))
+			{
+				ooo->stats.load_waits++;
+				continue;
+			}
+			ready[count++] = i;
+		}
+
+		for (n = 0; n < ooo->config.units[fu] && count > 0; n++)
+		{
+			uint32_t best = 0, oldest = 0;
+
+			if (fu == FU_DIV && ooo->div_free[n] > now)
+			{
+				continue;
+			}
+
+			for (i = 1; i < count; i++)
+			{
+				if (rob_age(ooo, ooo->rs[fu][ready[i]]) < rob_age(ooo, ooo->rs[fu][ready[best]]))
+				{
+					best = i;
+				}
+			}
+			// Branches go in program order, so a younger one never trains the predictor first
+			if (fu == FU_BRANCH)
+			{
+				for (i = 1; i < ooo->rs_count[fu]; i++)
+				{
+					if (rob_age(ooo, ooo->rs[fu][i]) < rob_age(ooo, ooo->rs[fu][oldest]))
+					{
+						oldest = i;
+					}
+				}
+				if (oldest != ready[best])
+				{
+					break;
+				}
+			}
+			ooo_execute(ooo, &ooo->rob[ooo->rs[fu][ready[best]]], now, forward[ready[best]],
+						forwarded[ready[best]]);
+			if (fu == FU_DIV)
+			{
+				ooo->div_free[n] = ooo->rob[ooo->rs[fu][ready[best]]].done_at;
+			}
+			ready[best] = ready[--count];
+		}
+
+		// Entries that issued are no longer waiting
+		for (i = n = 0; i < ooo->rs_count[fu]; i++)
+		{
+			if (ooo->rob[ooo->rs[fu][i]].state == ROB_WAITING)
+			{
+				ooo->rs[fu][n++] = ooo->rs[fu][i];
+			}
+		}
+		ooo->rs_count[fu] = n;
+	}
+}
+
+/***************************************************************/
+/* Rename fetched instructions into the ROB and reservation stations    */
+/***************************************************************/
+static void ooo_dispatch(ooo_t *ooo, uint64_t now)
+{
+	uint32_t n;
+
+	for (n = 0; n < ooo->config.width && ooo->fetch_count > 0; n++)
+	{
+		const fetch_entry_t *f = &ooo->fetchq[ooo->fetch_head];
+		const uint32_t id = isa_decode(f->ir);
+		const uint32_t format = ISA_FORMAT[id];
+		const fu_class_t fu = unit_class(id);
+		const uint32_t slot = (ooo->rob_head + ooo->rob_count) % OOO_ROB_MAX;
+		rob_entry_t *e = &ooo->rob[slot];
+
+		if (f->ready > now)
+		{
+			break;
+		}
+		if (ooo->rob_count == ooo->config.rob_size)
+		{
+			ooo->stats.rob_full++;
+			break;
+		}
+		if (ooo->rs_count[fu] == ooo->config.rs_size[fu])
+		{
+			ooo->stats.rs_full[fu]++;
+			break;
+		}
+		if (fu == FU_MEM && ooo->lsq_count == ooo->config.lsq_size)
+		{
+			ooo->stats.lsq_full++;
+			break;
+		}
+
+		e->pc = f->pc;
+		e->ir = f->ir;
+		e->id = id;
+		e->imm = isa_imm(f->ir, format);
+		e->fu = fu;
+		e->state = ROB_WAITING;
+		e->prediction = f->prediction;
+		e->psrc1 = reads_rs1(format) ? ooo->rat[(f->ir >> 15) & 0x1F] : 0;
+		e->psrc2 = reads_rs2(format) ? ooo->rat[(f->ir >> 20) & 0x1F] : 0;
+		e->rd = FMT_WRITES_RD[format] ? (f->ir >> 7) & 0x1F : 0;
+		if (e->rd != 0)
+		{
+			e->pold = ooo->rat[e->rd];
+			e->pdst = ooo->free_list[--ooo->free_count];
+			ooo->rat[e->rd] = e->pdst;
+			ooo->ready_at[e->pdst] = OOO_NEVER;
+		}
+
+		ooo->rs[fu][ooo->rs_count[fu]++] = slot;
+		ooo->rob_count++;
+		if (fu == FU_MEM)
+		{
+			ooo->lsq_count++;
+		}
+		ooo->fetch_head = (ooo->fetch_head + 1) % OOO_FETCH_MAX;
+		ooo->fetch_count--;
+	}
+}
+
+/***************************************************************/
+/* Fetch a group along the predicted path: one I-cache access, ending  */
+/* at a predicted-taken branch or the end of the block                       */
+/***************************************************************/
+static void ooo_fetch(ooo_t *ooo, uint64_t now)
+{
+	const uint32_t depth = 2 * ooo->config.width;
+	const uint32_t mask = ooo->env.fetch_block ? ~(ooo->env.fetch_block - 1) : 0;
+	uint32_t latency, n;
+
+	// The cycle a misprediction is found fetches nothing
+	if (ooo->redirect)
+	{
+		ooo->redirect = 0;
+		ooo->fetch_pc = ooo->redirect_pc;
+		return;
+	}
+	if (now < ooo->fetch_busy || ooo->fetch_count == depth || ooo->fetch_pc > ooo->env.last)
+	{
+		return;
+	}
+
+	latency = ooo->env.fetch_latency(ooo->env.context, ooo->fetch_pc, now);
+	ooo->fetch_busy = now + latency + 1;
+	for (n = 0; n < ooo->config.width && ooo->fetch_count < depth && ooo->fetch_pc <= ooo->env.last; n++)
+	{
+		fetch_entry_t *f = &ooo->fetchq[(ooo->fetch_head + ooo->fetch_count++) % OOO_FETCH_MAX];
+
+		f->pc = ooo->fetch_pc;
+		f->ir = ooo->env.load(ooo->env.context, f->pc, 4);
+		f->ready = ooo->fetch_busy;
+		f->prediction = bpred_predict(ooo->env.bpred, f->pc);
+		ooo->fetch_pc = f->prediction.next;
+		if (ooo->fetch_pc != f->pc + 4 || (ooo->fetch_pc & mask) != (f->pc & mask))
+		{
+			break;
+		}
+	}
+}
+
+/***************************************************************/
+/* Advance one cycle; returns the instructions committed                  */
+/* The stages run back to front so each sees the state of the last     */
+/* cycle, like the in-order pipeline's latches.                                 */
+/***************************************************************/
+uint32_t ooo_cycle(ooo_t *ooo, uint64_t now)
+{
+	const uint32_t committed = ooo_commit(ooo, now);
+
+	ooo_complete(ooo, now);
+	ooo_issue(ooo, now);
+	ooo_dispatch(ooo, now);
+	ooo_fetch(ooo, now);
+	ooo->stats.cycles++;
+	ooo->stats.occupancy[ooo->rob_count]++;
+	return committed;
+}
+
+/***************************************************************/
+/* Print the ROB, oldest first                                                            */
+/***************************************************************/
+void ooo_show(const ooo_t *ooo)
+{
+	static const char *const states[] = {"waiting", "executing", "done"};
+	uint32_t i;
+
+	printf("Commit PC\t0x%08x\n", ooo->pc);
+	printf("Fetch PC\t0x%08x (%u fetched)\n", ooo->fetch_pc, ooo->fetch_count);
+	printf("ROB\t\t%u of %u entries, LSQ %u of %u\n", ooo->rob_count, ooo->config.rob_size, ooo->lsq_count,
+		   ooo->config.lsq_size);
+	for (i = 0; i < ooo->rob_count; i++)
+	{
+		const rob_entry_t *e = &ooo->rob[(ooo->rob_head + i) % OOO_ROB_MAX];
+
+		printf("  [%3u] 0x%08x %-6s %-6s %-9s", i, e->pc, ISA_NAME[e->id], ooo_unit_name(e->fu),
+			   states[e->state]);
+		if (e->rd != 0)
+		{
+			printf(" x%u -> p%u", e->rd, e->pdst);
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/***************************************************************/
+/* Print IPC, stall causes and the ROB occupancy histogram            */
+/***************************************************************/
+void ooo_print_stats(const ooo_t *ooo)
+{
+	const ooo_stats_t *stats = &ooo->stats;
+	const uint32_t step = (ooo->config.rob_size + 8) / 8;
+	uint32_t fu, lo, i;
+
+	printf("Out-of-order core: width %u, %u-entry ROB, %u-entry LSQ\n", ooo->config.width, ooo->config.rob_size,
+		   ooo->config.lsq_size);
+	for (fu = 0; fu < FU_CLASSES; fu++)
+	{
+		printf("  %-6s\t: %u RS entries, %u units, latency %u, %llu issued, %.2f%% busy\n", ooo_unit_name(fu),
+			   ooo->config.rs_size[fu], ooo->config.units[fu], ooo->config.latency[fu],
+			   (unsigned long long)stats->issued[fu],
+			   stats->cycles ? 100.0 * stats->busy[fu] / (ooo->config.units[fu] * stats->cycles) : 0.0);
+	}
+	printf("  div early outs\t: %llu\n", (unsigned long long)stats->early_outs);
+	printf("  committed\t: %llu in %llu cycles\n", (unsigned long long)stats->committed,
+		   (unsigned long long)stats->cycles);
+	printf("  IPC\t\t: %.3f\n", stats->cycles ? (double)stats->committed / stats->cycles : 0.0);
+	printf("  mispredicts\t: %llu (%llu instructions squashed)\n", (unsigned long long)stats->mispredicts,
+		   (unsigned long long)stats->squashed);
+	printf("  dispatch stalls\t: ROB full %llu, LSQ full %llu, RS full %llu/%llu/%llu/%llu/%llu "
+		   "(alu/branch/mem/mul/div)\n",
+		   (unsigned long long)stats->rob_full, (unsigned long long)stats->lsq_full,
+		   (unsigned long long)stats->rs_full[FU_ALU], (unsigned long long)stats->rs_full[FU_BRANCH],
+		   (unsigned long long)stats->rs_full[FU_MEM], (unsigned long long)stats->rs_full[FU_MUL],
+		   (unsigned long long)stats->rs_full[FU_DIV]);
+	printf("  loads forwarded\t: %llu\n", (unsigned long long)stats->forwarded);
+	printf("  load waits\t: %llu (on an older store)\n", (unsigned long long)stats->load_waits);
+
+	printf("ROB occupancy:\n");
+	for (lo = 0; lo <= ooo->config.rob_size; lo += step)
+	{
+		const uint32_t hi = lo + step - 1 < ooo->config.rob_size ? lo + step - 1 : ooo->config.rob_size;
+		uint64_t cycles = 0;
+		double share;
+
+		for (i = lo; i <= hi; i++)
+		{
+			cycles += stats->occupancy[i];
+		}
+		share = stats->cycles ? (double)cycles / stats->cycles : 0.0;
+		printf("  %3u-%-3u\t: %6.2f%% ", lo, hi, 100.0 * share);
+		for (i = 0; i < (uint32_t)(40 * share + 0.5); i++)
+		{
+			printf("#");
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
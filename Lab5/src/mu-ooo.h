@@ -0,0 +1,147 @@
+#ifndef MU_OOO_H
+#define MU_OOO_H
+
+#include <stdint.h>
+
+#include "mu-bpred.h"
+
+/***************************************************************/
+/* Out-of-order core: Tomasulo with register renaming and a ROB          */
+/* Fetch follows the branch predictor into a fetch queue. Dispatch     */
+/* renames each destination onto a free physical register and puts the */
+/* instruction in the ROB and in the reservation station of its unit   */
+/* class. An instruction issues once its operands are ready, its result */
+/* is visible to dependents when it completes, and the ROB commits in  */
+/* program order: only then do the architectural registers and memory */
+/* change, so rdump and mdump always see a precise state.                  */
+/* Stores issue as soon as their address is known and pick their data  */
+/* up when it is ready. Loads issue once every older store address is */
+/* known and take their data from the youngest older store covering  */
+/* them. Branches issue in order among themselves so the predictor    */
+/* trains in program order.                                                                */
+/***************************************************************/
+
+typedef enum
+{
+	FU_ALU,	   /* integer ALU, lui, auipc */
+	FU_BRANCH, /* branches and jumps */
+	FU_MEM,	   /* address generation for loads and stores */
+	FU_MUL,	   /* pipelined multiplier */
+	FU_DIV,	   /* iterative divider, done early on short quotients */
+	FU_CLASSES
+} fu_class_t;
+
+#define OOO_WIDTH_MAX 8
+#define OOO_ROB_MAX 256
+#define OOO_RS_MAX 64
+#define OOO_UNITS_MAX 8
+#define OOO_LATENCY_MAX 64
+#define OOO_FETCH_MAX (2 * OOO_WIDTH_MAX)
+#define OOO_PREGS (32 + OOO_ROB_MAX)
+
+typedef struct
+{
+	uint32_t width;				  /* fetched, dispatched and committed per cycle */
+	uint32_t rob_size;
+	uint32_t lsq_size;			  /* loads and stores in flight */
+	uint32_t rs_size[FU_CLASSES]; /* reservation station entries */
+	uint32_t units[FU_CLASSES];	  /* one issue each per cycle; a divider takes none until it is done */
+	uint32_t latency[FU_CLASSES]; /* execute cycles; loads add the D-cache's, a divide's is its worst case */
+} ooo_config_t;
+
+/* what the core needs from the simulator around it; every call gets context back */
+typedef struct
+{
+	void *context;
+	uint32_t *regs; /* architectural registers, written at commit */
+	uint32_t (*load)(void *context, uint32_t address, uint32_t size);
+	void (*store)(void *context, uint32_t address, uint32_t size, uint32_t value);
+	/* I-cache cycles for a fetch group, and the cycle the D-cache is done with an access */
+	uint32_t (*fetch_latency)(void *context, uint32_t pc, uint64_t now);
+	uint64_t (*data_ready)(void *context, uint32_t pc, uint32_t address, int write, uint64_t now);
+	bpred_t *bpred;
+	uint32_t last;		  /* address of the last instruction: fetch stops past it */
+	uint32_t fetch_block; /* fetch groups end at this boundary, 0 for none */
+} ooo_env_t;
+
+typedef enum
+{
+	ROB_WAITING,   /* in a reservation station */
+	ROB_EXECUTING, /* issued, result at done_at */
+	ROB_DONE	   /* completed, waiting to commit */
+} rob_state_t;
+
+typedef struct
+{
+	uint32_t pc, ir, id;
+	uint32_t imm;
+	uint8_t fu, state;
+	uint32_t rd;		   /* architectural destination, 0 for none */
+	uint32_t pdst, pold;   /* its physical register and the one it replaced */
+	uint32_t psrc1, psrc2; /* physical sources, register 0 when unused */
+	uint64_t done_at;
+	uint32_t address, data; /* loads and stores */
+	uint32_t next, target;	/* next PC in program order, branch target */
+	int taken;
+	bpred_info_t prediction;
+} rob_entry_t;
+
+typedef struct
+{
+	uint32_t pc, ir;
+	uint64_t ready; /* cycle the I-cache delivers it */
+	bpred_info_t prediction;
+} fetch_entry_t;
+
+typedef struct
+{
+	uint64_t cycles, committed;
+	uint64_t occupancy[OOO_ROB_MAX + 1]; /* cycles the ROB held n instructions */
+	uint64_t rob_full, lsq_full;		 /* cycles dispatch stopped on a full structure */
+	uint64_t rs_full[FU_CLASSES];
+	uint64_t issued[FU_CLASSES];
+	uint64_t busy[FU_CLASSES]; /* unit cycles taken: one per issue, a divide's whole run */
+	uint64_t early_outs;	   /* divides done before the full latency */
+	uint64_t mispredicts;
+	uint64_t squashed;	  /* instructions thrown away behind them */
+	uint64_t forwarded;	  /* loads fed by an older store */
+	uint64_t load_waits;  /* cycles a ready load waited for an older store */
+} ooo_stats_t;
+
+typedef struct
+{
+	ooo_config_t config;
+	ooo_env_t env;
+	uint32_t pc; /* next instruction to commit: the architectural PC */
+
+	uint32_t fetch_pc;
+	uint64_t fetch_busy; /* I-cache busy with the last group until */
+	int redirect;
+	uint32_t redirect_pc;
+	fetch_entry_t fetchq[OOO_FETCH_MAX];
+	uint32_t fetch_head, fetch_count;
+
+	rob_entry_t rob[OOO_ROB_MAX];
+	uint32_t rob_head, rob_count;
+	uint16_t rs[FU_CLASSES][OOO_RS_MAX]; /* ROB slots waiting for each unit class */
+	uint32_t rs_count[FU_CLASSES];
+	uint32_t lsq_count;
+	uint64_t div_free[OOO_UNITS_MAX]; /* cycle each divider takes a new divide */
+
+	uint32_t rat[32]; /* architectural to physical register */
+	uint32_t value[OOO_PREGS];
+	uint64_t ready_at[OOO_PREGS]; /* cycle a dependent can issue */
+	uint16_t free_list[OOO_PREGS];
+	uint32_t free_count;
+
+	ooo_stats_t stats;
+} ooo_t;
+
+int ooo_configure(ooo_t *ooo, const ooo_config_t *config);
+void ooo_reset(ooo_t *ooo, uint32_t pc);
+uint32_t ooo_cycle(ooo_t *ooo, uint64_t now);
+const char *ooo_unit_name(fu_class_t fu);
+void ooo_show(const ooo_t *ooo);
+void ooo_print_stats(const ooo_t *ooo);
+
+#endif
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mu-prefetch.h"
+
+/***************************************************************/
+/* Choose a prefetcher; returns 0 if the degree is out of range           */
+/***************************************************************/
+int prefetch_init(prefetcher_t *prefetcher, prefetch_kind_t kind, uint32_t degree)
+{
+	if (degree < 1 || degree > PREFETCH_MAX_DEGREE)
+	{
+		printf("Error: prefetch degree must be between 1 and %d\n", PREFETCH_MAX_DEGREE);
+		return 0;
+	}
+	prefetcher->kind = kind;
+	prefetcher->degree = degree;
+	prefetch_reset(prefetcher);
+	return 1;
+}
+
+/***************************************************************/
+/* Forget every stride, stream and statistic                                           */
+/***************************************************************/
+void prefetch_reset(prefetcher_t *prefetcher)
+{
+	memset(prefetcher->stride, 0, sizeof(prefetcher->stride));
+	memset(prefetcher->streams, 0, sizeof(prefetcher->streams));
+	memset(prefetcher->pollution, 0, sizeof(prefetcher->pollution));
+	memset(&prefetcher->stats, 0, sizeof(prefetcher->stats));
+	prefetcher->clock = 0;
+}
+
+/***************************************************************/
+/* Pollution filter: remember which blocks prefetches pushed out           */
+/***************************************************************/
+static uint32_t *pollution_slot(prefetcher_t *prefetcher, const cache_t *cache, uint32_t address)
+{
+	return &prefetcher->pollution[(address >> cache->offset_bits) & (PREFETCH_POLLUTION_ENTRIES - 1)];
+}
+
+static void pollution_record(prefetcher_t *prefetcher, const cache_t *cache, uint32_t victim)
+{
+	if (victim != UINT32_MAX)
+	{
+		*pollution_slot(prefetcher, cache, victim) = (victim >> cache->offset_bits) + 1;
+	}
+}
+
+// Returns whether a demand miss is on a block a prefetch evicted, and forgets it
+static int pollution_check(prefetcher_t *prefetcher, const cache_t *cache, uint32_t address)
+{
+	uint32_t *slot = pollution_slot(prefetcher, cache, address);
+
+	if (*slot != (address >> cache->offset_bits) + 1)
+	{
+		return 0;
+	}
+	*slot = 0;
+	return 1;
+}
+
+/***************************************************************/
+/* Prefetch one block into the cache; blocks already there are skipped  */
+/***************************************************************/
+static void prefetch_fill(prefetcher_t *prefetcher, cache_t *cache, uint32_t block, uint64_t now)
+{
+	cache_line_t *line;
+	uint64_t ready;
+	uint32_t victim;
+	int dirty;
+
+	if (cache_lookup(cache, block) != NULL)
+	{
+		return;
+	}
+	ready = now + cache->config.latency + cache_fetch(cache, block, now, &dirty);
+	line = cache_install(cache, block, dirty, ready, &victim);
+	line->prefetched = 1;
+	prefetcher->stats.issued++;
+	pollution_check(prefetcher, cache, block);
+	pollution_record(prefetcher, cache, victim);
+}
+
+/***************************************************************/
+/* Stride table: one entry per load/store PC                                            */
+/***************************************************************/
+static void prefetch_stride(prefetcher_t *prefetcher, cache_t *cache, uint32_t pc, uint32_t address, uint64_t now)
+{
+	prefetch_stride_t *entry = &prefetcher->stride[(pc >> 2) & (PREFETCH_STRIDE_ENTRIES - 1)];
+	int32_t delta = (int32_t)(address - entry->last), step;
+	uint32_t i;
+
+	if (entry->pc != pc)
+	{
+		entry->pc = pc;
+		entry->last = address;
+		entry->stride = 0;
+		entry->confidence = 0;
+		return;
+	}
+	entry->last = address;
+	if (delta != 0 && delta == entry->stride)
+	{
+		entry->confidence += entry->confidence < 3;
+	}
+	else if (entry->confidence > 0)
+	{
+		entry->confidence--;
+	}
+	else
+	{
+		entry->stride = delta;
+	}
+	if (entry->confidence < 2)
+	{
+		return;
+	}
+
+	// Strides shorter than a block would keep landing in the same block
+	step = entry->stride;
+	if (step < (int32_t)cache->config.block && step > -(int32_t)cache->config.block)
+	{
+		step = step > 0 ? (int32_t)cache->config.block : -(int32_t)cache->config.block;
+	}
+	for (i = 1; i <= prefetcher->degree; i++)
+	{
+		prefetch_fill(prefetcher, cache, (address + i * step) & ~(cache->config.block - 1), now);
+	}
+}
+
+/***************************************************************/
+/* Stream buffers: FIFOs of the blocks after a miss, kept beside the    */
+/* cache so prefetches never evict anything until they are used.          */
+/***************************************************************/
+static void stream_top_up(prefetcher_t *prefetcher, cache_t *cache, prefetch_stream_t *stream, uint64_t now)
+{
+	while (stream->count < prefetcher->degree)
+	{
+		uint32_t slot = (stream->head + stream->count) % PREFETCH_MAX_DEGREE;
+		int dirty;
+
+		stream->ready[slot] = now + cache->config.latency + cache_fetch(cache, stream->next, now, &dirty);
+		stream->block[slot] = stream->next;
+		stream->dirty[slot] = dirty;
+		stream->count++;
+		stream->next += cache->config.block;
+		prefetcher->stats.issued++;
+	}
+}
+
+// Move a missing block from a stream buffer into the cache; returns 0 if no stream has it
+static int stream_lookup(prefetcher_t *prefetcher, cache_t *cache, uint32_t block, uint64_t now)
+{
+	uint32_t s, k, victim;
+
+	for (s = 0; s < PREFETCH_STREAMS; s++)
+	{
+		prefetch_stream_t *stream = &prefetcher->streams[s];
+
+		for (k = 0; k < stream->count; k++)
+		{
+			uint32_t slot = (stream->head + k) % PREFETCH_MAX_DEGREE;
+
+			if (stream->block[slot] != block)
+			{
+				continue;
+			}
+			prefetcher->stats.useful++;
+			prefetcher->stats.late += stream->ready[slot] > now;
+			cache_install(cache, block, stream->dirty[slot], stream->ready[slot], &victim);
+			// Blocks ahead of the one used were skipped by the stream
+			stream->head = (stream->head + k + 1) % PREFETCH_MAX_DEGREE;
+			stream->count -= k + 1;
+			stream->last_use = prefetcher->clock;
+			stream_top_up(prefetcher, cache, stream, now);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void stream_allocate(prefetcher_t *prefetcher, cache_t *cache, uint32_t block, uint64_t now)
+{
+	prefetch_stream_t *stream = &prefetcher->streams[0];
+	uint32_t s;
+
+	for (s = 1; s < PREFETCH_STREAMS; s++)
+	{
+		if (prefetcher->streams[s].last_use < stream->last_use)
+		{
+			stream = &prefetcher->streams[s];
+		}
+	}
+	stream->head = 0;
+	stream->count = 0;
+	stream->next = block + cache->config.block;
+	stream->last_use = prefetcher->clock;
+	stream_top_up(prefetcher, cache, stream, now);
+}
+
+/***************************************************************/
+/* A demand access through the prefetcher; returns its latency           */
+/***************************************************************/
+uint32_t prefetch_access(prefetcher_t *prefetcher, cache_t *cache, uint32_t pc, uint32_t address, int write,
+						 uint64_t now)
+{
+	uint32_t block = address & ~(cache->config.block - 1), cycles, i;
+	cache_line_t *line;
+	int miss, first_use = 0, streamed = 0;
+
+	if (prefetcher->kind == PREFETCH_NONE)
+	{
+		return cache_access(cache, address, write, now);
+	}
+
+	prefetcher->clock++;
+	line = cache_lookup(cache, address);
+	miss = line == NULL;
+	if (line != NULL && line->prefetched)
+	{
+		prefetcher->stats.useful++;
+		prefetcher->stats.late += line->ready > now;
+		line->prefetched = 0;
+		first_use = 1;
+	}
+	if (miss)
+	{
+		prefetcher->stats.polluting += pollution_check(prefetcher, cache, address);
+		if (prefetcher->kind == PREFETCH_STREAM)
+		{
+			streamed = stream_lookup(prefetcher, cache, block, now);
+		}
+	}
+
+	cycles = cache_access(cache, address, write, now);
+
+	// Prefetches go out after the demand access and run ahead of it
+	switch (prefetcher->kind)
+	{
+	case PREFETCH_NEXT_LINE:
+		if (miss || first_use)
+		{
+			for (i = 1; i <= prefetcher->degree; i++)
+			{
+				prefetch_fill(prefetcher, cache, block + i * cache->config.block, now);
+			}
+		}
+		break;
+	case PREFETCH_STRIDE:
+		prefetch_stride(prefetcher, cache, pc, address, now);
+		break;
+	default:
+		if (miss && !streamed)
+		{
+			stream_allocate(prefetcher, cache, block, now);
+		}
+		break;
+	}
+	return cycles;
+}
+
+const char *prefetch_name(prefetch_kind_t kind)
+{
+	switch (kind)
+	{
+	case PREFETCH_NEXT_LINE:
+		return "next-line";
+	case PREFETCH_STRIDE:
+		return "stride";
+	case PREFETCH_STREAM:
+		return "stream buffer";
+	default:
+		return "none";
+	}
+}
+
+/***************************************************************/
+/* Print the prefetcher and how well its prefetches did                         */
+/***************************************************************/
+void prefetch_print_stats(const prefetcher_t *prefetcher)
+{
+	const prefetch_stats_t *stats = &prefetcher->stats;
+
+	if (prefetcher->kind == PREFETCH_NONE)
+	{
+		printf("Prefetcher: none\n\n");
+		return;
+	}
+	printf("Prefetcher: %s, degree %u\n", prefetch_name(prefetcher->kind), prefetcher->degree);
+	printf("  issued\t: %llu\n", (unsigned long long)stats->issued);
+	printf("  useful\t: %llu\n", (unsigned long long)stats->useful);
+	printf("  late\t\t: %llu\n", (unsigned long long)stats->late);
+	printf("  polluting\t: %llu\n", (unsigned long long)stats->polluting);
+	printf("  accuracy\t: %.2f%%\n\n", stats->issued ? 100.0 * stats->useful / stats->issued : 0.0);
+}
@@ -0,0 +1,72 @@
+#ifndef MU_PREFETCH_H
+#define MU_PREFETCH_H
+
+#include <stdint.h>
+
+#include "mu-cache.h"
+
+/***************************************************************/
+/* Hardware prefetchers in front of a cache                                              */
+/* Prefetches never stall the pipeline: a prefetched block is installed  */
+/* with the cycle its data arrives, and a demand access that reaches it  */
+/* early waits only for the rest of the fetch (a late prefetch).               */
+/***************************************************************/
+
+typedef enum
+{
+	PREFETCH_NONE,
+	PREFETCH_NEXT_LINE, /* the next blocks after a miss or the first use of a prefetched block */
+	PREFETCH_STRIDE,	/* PC-indexed table of strides, prefetches once a stride repeats */
+	PREFETCH_STREAM		/* stream buffers beside the cache, filled on misses */
+} prefetch_kind_t;
+
+#define PREFETCH_MAX_DEGREE 16
+#define PREFETCH_STRIDE_ENTRIES 64
+#define PREFETCH_STREAMS 4
+#define PREFETCH_POLLUTION_ENTRIES 256
+
+typedef struct
+{
+	uint64_t issued;	/* blocks fetched from the level below */
+	uint64_t useful;	/* prefetched blocks a demand access used */
+	uint64_t late;		/* useful ones the demand access still had to wait for */
+	uint64_t polluting; /* demand misses on blocks a prefetch had evicted */
+} prefetch_stats_t;
+
+typedef struct
+{
+	uint32_t pc;
+	uint32_t last;		 /* last address the instruction accessed */
+	int32_t stride;
+	uint32_t confidence; /* 0-3, prefetches from 2 */
+} prefetch_stride_t;
+
+typedef struct
+{
+	uint32_t block[PREFETCH_MAX_DEGREE]; /* FIFO of block addresses */
+	uint64_t ready[PREFETCH_MAX_DEGREE];
+	uint8_t dirty[PREFETCH_MAX_DEGREE];
+	uint32_t head, count;
+	uint32_t next;		/* next block to prefetch into the buffer */
+	uint64_t last_use;	/* for replacing the least recently used stream */
+} prefetch_stream_t;
+
+typedef struct
+{
+	prefetch_kind_t kind;
+	uint32_t degree; /* blocks prefetched per trigger, the stream buffer depth */
+	prefetch_stride_t stride[PREFETCH_STRIDE_ENTRIES];
+	prefetch_stream_t streams[PREFETCH_STREAMS];
+	uint32_t pollution[PREFETCH_POLLUTION_ENTRIES]; /* blocks evicted by prefetches, block number + 1 */
+	uint64_t clock;
+	prefetch_stats_t stats;
+} prefetcher_t;
+
+int prefetch_init(prefetcher_t *prefetcher, prefetch_kind_t kind, uint32_t degree);
+void prefetch_reset(prefetcher_t *prefetcher);
+uint32_t prefetch_access(prefetcher_t *prefetcher, cache_t *cache, uint32_t pc, uint32_t address, int write,
+						 uint64_t now);
+void prefetch_print_stats(const prefetcher_t *prefetcher);
+const char *prefetch_name(prefetch_kind_t kind);
+
+#endif
@@ -3,165 +3,407 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mu-riscv.h"
+#include "mu-decode.h"
+
+static const mem_region_t MEM_LAYOUT[NUM_MEM_REGION] = {
+	{MEM_TEXT_BEGIN, MEM_TEXT_END, 0},
+	{MEM_DATA_BEGIN, MEM_DATA_END, 0},
+	{MEM_KDATA_BEGIN, MEM_KDATA_END, 0},
+	{MEM_KTEXT_BEGIN, MEM_KTEXT_END, 0}};
 
 /***************************************************************/
-/* Print out a list of commands available                                                                  */
+/* Find the memory region holding an address (NULL if unmapped)                  */
 /***************************************************************/
-void help()
+mem_region_t *mem_region(sim_t *sim, uint32_t address)
 {
-	printf("------------------------------------------------------------------\n\n");
-	printf("\t**********MU-RISCV Help MENU**********\n\n");
-	printf("sim\t-- simulate program to completion \n");
-	printf("run <n>\t-- simulate program for <n> instructions\n");
-	printf("rdump\t-- dump register values\n");
-	printf("reset\t-- clears all registers/memory and re-loads the program\n");
-	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
-	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
-	printf("high <val>\t-- set the HI register to <val>\n");
-	printf("low <val>\t-- set the LO register to <val>\n");
-	printf("print\t-- print the program loaded into memory\n");
-	printf("show\t-- print the current content of the pipeline registers\n");
-	printf("forward\t-- enable / disable forwarding\n");
-	printf("?\t-- display help menu\n");
-	printf("quit\t-- exit the simulator\n\n");
-	printf("------------------------------------------------------------------\n\n");
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++)
+	{
+		if ((address >= sim->MEM_REGIONS[i].begin) && (address <= sim->MEM_REGIONS[i].end))
+		{
+			return &sim->MEM_REGIONS[i];
+		}
+	}
+	return NULL;
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Remember that a page has diverged from the snapshot                                */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
+void mem_mark_dirty(sim_t *sim, uint32_t page_num)
 {
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++)
+	if (MEM_BIT_TEST(sim->MEM_DIRTY_BITS, page_num))
+	{
+		return;
+	}
+	MEM_BIT_SET(sim->MEM_DIRTY_BITS, page_num);
+
+	if (sim->MEM_DIRTY_COUNT == sim->MEM_DIRTY_CAPACITY)
 	{
-		if ((address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end))
+		sim->MEM_DIRTY_CAPACITY = sim->MEM_DIRTY_CAPACITY ? 2 * sim->MEM_DIRTY_CAPACITY : 256;
+		sim->MEM_DIRTY_LIST = realloc(sim->MEM_DIRTY_LIST, sim->MEM_DIRTY_CAPACITY * sizeof(uint32_t));
+		if (sim->MEM_DIRTY_LIST == NULL)
 		{
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset + 3] << 24) |
-				   (MEM_REGIONS[i].mem[offset + 2] << 16) |
-				   (MEM_REGIONS[i].mem[offset + 1] << 8) |
-				   (MEM_REGIONS[i].mem[offset + 0] << 0);
+			printf("Error: Out of memory tracking dirty pages\n");
+			exit(-1);
 		}
 	}
-	return 0;
+	sim->MEM_DIRTY_LIST[sim->MEM_DIRTY_COUNT++] = page_num;
 }
 
 /***************************************************************/
-/* Write a 32-bit word to memory                                                                                */
+/* First write since the checkpoint: keep the old page to diff against       */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
+void mem_mark_checkpoint(sim_t *sim, uint32_t page_num)
 {
-	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++)
+	uint8_t *page = sim->MEM_PAGE_TABLE[page_num];
+
+	MEM_BIT_SET(sim->MEM_CHECKPOINT_BITS, page_num);
+
+	// Before any checkpoint the snapshot already holds the old contents
+	if (sim->CHECKPOINT_TAKEN && page != NULL)
 	{
-		if ((address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end))
+		sim->MEM_CHECKPOINT_TABLE[page_num] = malloc(MEM_PAGE_SIZE);
+		if (sim->MEM_CHECKPOINT_TABLE[page_num] == NULL)
 		{
-			offset = address - MEM_REGIONS[i].begin;
+			printf("Error: Out of memory saving checkpoint page\n");
+			exit(-1);
+		}
+		memcpy(sim->MEM_CHECKPOINT_TABLE[page_num], page, MEM_PAGE_SIZE);
+	}
+}
+
+/***************************************************************/
+/* Write fault: give a page its own copy before it is first written              */
+/***************************************************************/
+uint8_t *mem_write_fault(sim_t *sim, uint32_t address)
+{
+	uint32_t page_num = address >> MEM_PAGE_SHIFT;
+	uint8_t *page = sim->MEM_PAGE_TABLE[page_num];
+	uint8_t *shared = sim->MEM_SNAPSHOT_TABLE[page_num];
+
+	// Writes outside every region are dropped
+	if (page == NULL && mem_region(sim, address) == NULL)
+	{
+		return NULL;
+	}
 
-			MEM_REGIONS[i].mem[offset + 3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset + 2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset + 1] = (value >> 8) & 0xFF;
-			MEM_REGIONS[i].mem[offset + 0] = (value >> 0) & 0xFF;
+	if (!MEM_BIT_TEST(sim->MEM_CHECKPOINT_BITS, page_num))
+	{
+		mem_mark_checkpoint(sim, page_num);
+	}
+
+	// A missing page reads as zero and a snapshot page is shared with the
+	// load image, so either way the write needs a private page
+	if (page == NULL || page == shared)
+	{
+		page = malloc(MEM_PAGE_SIZE);
+		if (page == NULL)
+		{
+			printf("Error: Out of memory allocating page 0x%08x\n", address & ~MEM_PAGE_MASK);
+			exit(-1);
+		}
+		if (shared != NULL)
+		{
+			memcpy(page, shared, MEM_PAGE_SIZE);
+		}
+		else
+		{
+			memset(page, 0, MEM_PAGE_SIZE);
+		}
+		sim->MEM_PAGE_TABLE[page_num] = page;
+		mem_region(sim, address)->touched++;
+		mem_mark_dirty(sim, page_num);
+
+		if (sim->LAST_PAGE_NUM == page_num)
+		{
+			sim->LAST_PAGE = page;
 		}
 	}
+
+	sim->LAST_WRITE_PAGE_NUM = page_num;
+	sim->LAST_WRITE_PAGE = page;
+	return page;
 }
 
-int32_t signExtend_13b(uint32_t number)
+/***************************************************************/
+/* Host page holding a guest address, for reading (NULL reads as zero)      */
+/***************************************************************/
+static inline uint8_t *mem_read_page(sim_t *sim, uint32_t address)
 {
-    // Appending leading zeroes to
-    // the 23-bit number
-    int32_t ans = number & 0x00001FFF;
- 
-    // Checking if sign-bit of number is 0 or 1
-    if (number & 0x00001000) {
- 
-        // If number is negative, append
-        // leading 1's to the 21-bit sequence
-        ans = ans | 0xFFFFE000;
-    }
- 
-    return ans;
+	uint32_t page_num = address >> MEM_PAGE_SHIFT;
+	uint8_t *page;
+
+	// Consecutive accesses (fetch, array walks) nearly always hit the same page
+	if (page_num == sim->LAST_PAGE_NUM)
+	{
+		return sim->LAST_PAGE;
+	}
+
+	page = sim->MEM_PAGE_TABLE[page_num];
+	if (page != NULL)
+	{
+		sim->LAST_PAGE_NUM = page_num;
+		sim->LAST_PAGE = page;
+	}
+	return page;
 }
 
-int32_t signExtend_21b(uint32_t number)
+/***************************************************************/
+/* Host page holding a guest address, for writing (NULL if unmapped)          */
+/***************************************************************/
+static inline uint8_t *mem_write_page(sim_t *sim, uint32_t address)
 {
-    // Appending leading zeroes to
-    // the 21-bit number
-    int32_t ans = number & 0x001FFFFF;
- 
-    // Checking if sign-bit of number is 0 or 1
-    if (number & 0x00100000) {
- 
-        // If number is negative, append
-        // leading 1's to the 21-bit sequence
-        ans = ans | 0xFFE00000;
-    }
- 
-    return ans;
+	// Only private pages are cached here, so a hit never needs copying
+	if ((address >> MEM_PAGE_SHIFT) == sim->LAST_WRITE_PAGE_NUM)
+	{
+		return sim->LAST_WRITE_PAGE;
+	}
+	return mem_write_fault(sim, address);
 }
 
 /***************************************************************/
-/* Execute one cycle                                                                                                              */
+/* Read a byte from memory                                                                                  */
 /***************************************************************/
-void cycle()
+uint8_t mem_read_8(sim_t *sim, uint32_t address)
 {
-	handle_pipeline();
-	CURRENT_STATE = NEXT_STATE;
-	CYCLE_COUNT++;
+	uint8_t *page = mem_read_page(sim, address);
+
+	return page ? page[address & MEM_PAGE_MASK] : 0;
 }
 
 /***************************************************************/
-/* Simulate RISCV for n cycles                                                                                       */
+/* Read a 16-bit halfword from memory                                                                  */
 /***************************************************************/
-void run(int num_cycles)
+uint16_t mem_read_16(sim_t *sim, uint32_t address)
 {
+	uint16_t value = 0;
+	uint8_t *page;
 
-	if (RUN_FLAG == FALSE)
+	if ((address & 0x1) == 0)
 	{
-		printf("Simulation Stopped\n\n");
+		page = mem_read_page(sim, address);
+		if (page != NULL)
+		{
+			memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
+		}
+		return value;
+	}
+
+	return mem_read_8(sim, address) | (mem_read_8(sim, address + 1) << 8);
+}
+
+/***************************************************************/
+/* Write a byte to memory                                                                                      */
+/***************************************************************/
+void mem_write_8(sim_t *sim, uint32_t address, uint8_t value)
+{
+	uint8_t *page = mem_write_page(sim, address);
+
+	if (page != NULL)
+	{
+		page[address & MEM_PAGE_MASK] = value;
+	}
+}
+
+/***************************************************************/
+/* Write a 16-bit halfword to memory                                                                    */
+/***************************************************************/
+void mem_write_16(sim_t *sim, uint32_t address, uint16_t value)
+{
+	uint8_t *page;
+
+	if ((address & 0x1) == 0)
+	{
+		page = mem_write_page(sim, address);
+		if (page != NULL)
+		{
+			memcpy(page + (address & MEM_PAGE_MASK), &value, sizeof(value));
+		}
 		return;
 	}
 
-	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	mem_write_8(sim, address, value & 0xFF);
+	mem_write_8(sim, address + 1, value >> 8);
+}
+
+/***************************************************************/
+/* Read a 32-bit word from memory                                                                            */
+/***************************************************************/
+uint32_t mem_read_32(sim_t *sim, uint32_t address)
+{
 	int i;
-	for (i = 0; i < num_cycles; i++)
+	uint32_t value = 0;
+	uint8_t *page;
+
+	if ((address & 0x3) == 0)
 	{
-		if (RUN_FLAG == FALSE)
+		// An aligned word never straddles a page, so it is a single host load
+		// (RISC-V and the x86/ARM hosts we run on are all little-endian)
+		page = mem_read_page(sim, address);
+		if (page != NULL)
 		{
-			printf("Simulation Stopped.\n\n");
-			break;
+			memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
 		}
-		cycle();
+		return value;
 	}
+
+	for (i = 3; i >= 0; i--)
+	{
+		page = mem_read_page(sim, address + i);
+		value = (value << 8) | (page ? page[(address + i) & MEM_PAGE_MASK] : 0);
+	}
+	return value;
 }
 
 /***************************************************************/
-/* simulate to completion                                                                                               */
+/* Write a 32-bit word to memory                                                                                */
 /***************************************************************/
-void runAll()
+void mem_write_32(sim_t *sim, uint32_t address, uint32_t value)
 {
-	if (RUN_FLAG == FALSE)
+	int i;
+	uint8_t *page;
+
+	if ((address & 0x3) == 0)
 	{
-		printf("Simulation Stopped.\n\n");
+		page = mem_write_page(sim, address);
+		if (page != NULL)
+		{
+			memcpy(page + (address & MEM_PAGE_MASK), &value, sizeof(value));
+		}
 		return;
 	}
 
-	printf("Simulation Started...\n\n");
-	while (CURRENT_STATE.PC != LAST_INST + 20)
+	for (i = 0; i < 4; i++)
+	{
+		page = mem_write_page(sim, address + i);
+		if (page != NULL)
+		{
+			page[(address + i) & MEM_PAGE_MASK] = (value >> (8 * i)) & 0xFF;
+		}
+	}
+}
+
+/***************************************************************/
+/* Turn a byte to a word                                                                          */
+/***************************************************************/
+uint32_t byte_to_word(uint8_t byte)
+{
+    return (byte & 0x80) ? (byte | 0xffffff80) : byte;
+}
+
+/***************************************************************/
+/* Turn a halfword to a word                                                                          */
+/***************************************************************/
+uint32_t half_to_word(uint16_t half)
+{
+    return (half & 0x8000) ? (half | 0xffff8000) : half;
+}
+
+/***************************************************************/
+/* Execute one cycle                                                                                                              */
+/***************************************************************/
+void cycle(sim_t *sim)
+{
+	handle_pipeline(sim);
+	sim->CURRENT_STATE = sim->NEXT_STATE;
+	sim->CYCLE_COUNT++;
+}
+
+/***************************************************************/
+/* Execute one cycle, or jump straight to the next event when nothing  */
+/* can happen before it; never past cycle limit. Returns the cycles run. */
+/***************************************************************/
+uint32_t cycle_until(sim_t *sim, uint64_t limit)
+{
+	unit_stats_t *unit = NULL;
+	uint64_t skip = idle_cycles(sim, &unit);
+
+	if (skip > limit - sim->CYCLE_COUNT)
+	{
+		skip = limit - sim->CYCLE_COUNT;
+	}
+	if (skip < 2)
+	{
+		cycle(sim);
+		return 1;
+	}
+
+	// Count what stepping each of those cycles would have
+	if (unit == NULL)
+	{
+		sim->PIPE_STALL -= skip;
+	}
+	else
+	{
+		unit->stalls += skip;
+		sim->ISSUE_STATS.bundles[0] += skip;
+		sim->PIPE_CLOCK += skip;
+	}
+	sim->CURRENT_STATE = sim->NEXT_STATE;
+	sim->CYCLE_COUNT += skip;
+	return skip;
+}
+
+/***************************************************************/
+/* Cycles from now in which no stage changes anything: the pipeline is */
+/* frozen, or it is empty behind ID and ID waits on a multiply or     */
+/* divide (the unit is returned). A store buffer that has to act cuts it */
+/* short. The out-of-order core is always stepped.                              */
+/***************************************************************/
+uint64_t idle_cycles(sim_t *sim, unit_stats_t **unit)
+{
+	const uint32_t format = ISA_FORMAT[isa_decode(sim->ID_IF[0].IR)];
+	uint64_t idle = 0, drain = UINT64_MAX;
+	uint32_t s;
+
+	if (sim->OOO_ENABLED)
+	{
+		return 0;
+	}
+	// The buffer only moves when its head write is done, or at once when it has one to start
+	if (sim->CACHE_ENABLED && sim->STORE_BUFFER.size > 0 && sim->STORE_BUFFER.draining)
+	{
+		drain = sim->STORE_BUFFER.busy_until > sim->CYCLE_COUNT ? sim->STORE_BUFFER.busy_until - sim->CYCLE_COUNT : 0;
+	}
+	else if (sim->CACHE_ENABLED && sim->STORE_BUFFER.size > 0 && sim->STORE_BUFFER.count > 0)
+	{
+		drain = 0;
+	}
+
+	if (sim->PIPE_STALL > 0)
 	{
-		cycle();
+		idle = sim->PIPE_STALL;
+	}
+	else if (sim->FETCHED == sim->ISSUE_WIDTH && bundle_wait(sim, sim->ID_IF, sim->FETCHED) == 0)
+	{
+		for (s = 0; s < sim->ISSUE_WIDTH; s++)
+		{
+			if (sim->IF_EX[s].IR != 0 || sim->EX_MEM[s].IR != 0 || sim->MEM_WB[s].IR != 0)
+			{
+				return 0;
+			}
+		}
+		// With the stages empty only the scoreboard can still hold ID, and it runs out on its own
+		if (sim->ENABLE_FORWARDING == FORWARD_BYPASS &&
+			scoreboard_hazard(sim, sim->ID_IF[0].IR, sim->BRANCH_IN_ID && format == FMT_B ? sim->PIPE_CLOCK : sim->PIPE_CLOCK + 1))
+		{
+			return 0;
+		}
+		idle = unit_wait(sim, sim->ID_IF[0].IR, sim->BRANCH_IN_ID && format == FMT_B ? sim->PIPE_CLOCK - 1 : sim->PIPE_CLOCK, unit);
 	}
-	printf("Simulation Finished.\n\n");
+	return idle < drain ? idle : drain;
 }
 
 /***************************************************************/
 /* Dump a word-aligned region of memory to the terminal                              */
 /***************************************************************/
-void mdump(uint32_t start, uint32_t stop)
+void mdump(sim_t *sim, uint32_t start, uint32_t stop)
 {
 	uint32_t address;
 
@@ -171,219 +413,531 @@ void mdump(uint32_t start, uint32_t stop)
 	printf("\t[Address in Hex (Dec) ]\t[Value]\n");
 	for (address = start; address <= stop; address += 4)
 	{
-		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(address));
+		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(sim, address));
 	}
 	printf("\n");
 }
 
+/***************************************************************/
+/* Compare 16 bytes of two pages, using SSE2 where the host has it         */
+/***************************************************************/
+static inline int mem_block_differs(const uint8_t *a, const uint8_t *b)
+{
+#ifdef __SSE2__
+	__m128i x = _mm_loadu_si128((const __m128i *)a);
+	__m128i y = _mm_loadu_si128((const __m128i *)b);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF;
+#else
+	return memcmp(a, b, 16) != 0;
+#endif
+}
+
+/***************************************************************/
+/* List the words changed since load or since the last checkpoint          */
+/***************************************************************/
+void mdiff(sim_t *sim, int since_load)
+{
+	static const uint8_t zero_page[MEM_PAGE_SIZE];
+	uint32_t *bits = since_load ? sim->MEM_DIRTY_BITS : sim->MEM_CHECKPOINT_BITS;
+	uint8_t **baseline = (since_load || !sim->CHECKPOINT_TAKEN) ? sim->MEM_SNAPSHOT_TABLE : sim->MEM_CHECKPOINT_TABLE;
+	uint32_t word, bit, block, offset;
+	uint32_t words_changed = 0, pages_changed = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory changed since %s :\n", (since_load || !sim->CHECKPOINT_TAKEN) ? "load" : "checkpoint");
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Address in Hex (Dec) ]\t[Old]\t\t[New]\n");
+
+	// Only pages flagged in the dirty bitmap can differ from the baseline
+	for (word = 0; word < MEM_PAGE_COUNT / 32; word++)
+	{
+		for (bit = 0; bits[word] != 0 && bit < 32; bit++)
+		{
+			uint32_t page_num = (word << 5) | bit;
+			if (!MEM_BIT_TEST(bits, page_num))
+			{
+				continue;
+			}
+
+			const uint8_t *old_page = baseline[page_num] ? baseline[page_num] : zero_page;
+			const uint8_t *new_page = sim->MEM_PAGE_TABLE[page_num] ? sim->MEM_PAGE_TABLE[page_num] : zero_page;
+			uint32_t before = words_changed;
+
+			for (block = 0; block < MEM_PAGE_SIZE; block += 16)
+			{
+				if (!mem_block_differs(old_page + block, new_page + block))
+				{
+					continue;
+				}
+				for (offset = block; offset < block + 16; offset += 4)
+				{
+					uint32_t old_word, new_word;
+					uint32_t address = (page_num << MEM_PAGE_SHIFT) | offset;
+					memcpy(&old_word, old_page + offset, sizeof(old_word));
+					memcpy(&new_word, new_page + offset, sizeof(new_word));
+					if (old_word != new_word)
+					{
+						printf("\t0x%08x (%d) :\t0x%08x\t0x%08x\n", address, address, old_word, new_word);
+						words_changed++;
+					}
+				}
+			}
+			pages_changed += (words_changed != before);
+		}
+	}
+	printf("%u words changed in %u pages\n\n", words_changed, pages_changed);
+}
+
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */
 /***************************************************************/
-void rdump()
+void rdump(sim_t *sim)
 {
 	int i;
 	printf("-------------------------------------\n");
 	printf("Dumping Register Content\n");
 	printf("-------------------------------------\n");
-	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
-	printf("PC\t: 0x%08x\n", CURRENT_STATE.PC);
+	printf("# Instructions Executed\t: %u\n", sim->INSTRUCTION_COUNT);
+	printf("PC\t: 0x%08x\n", sim->CURRENT_STATE.PC);
 	printf("-------------------------------------\n");
 	printf("[Register]\t[Value]\n");
 	printf("-------------------------------------\n");
 	for (i = 0; i < MIPS_REGS; i++)
 	{
-		printf("[R%d]\t: 0x%08x\n", i, CURRENT_STATE.REGS[i]);
+		printf("[R%d]\t: 0x%08x\n", i, sim->CURRENT_STATE.REGS[i]);
 	}
 	printf("-------------------------------------\n");
-	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
-	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
+	printf("[HI]\t: 0x%08x\n", sim->CURRENT_STATE.HI);
+	printf("[LO]\t: 0x%08x\n", sim->CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
 }
 
 /***************************************************************/
-/* Read a command from standard input.                                                               */
+/* reset registers/memory to the program as it was loaded                          */
 /***************************************************************/
-void handle_command()
+void reset(sim_t *sim)
 {
-	char buffer[20];
-	uint32_t start, stop, cycles, fwd;
-	uint32_t register_no;
-	int register_value;
-	int hi_reg_value, lo_reg_value;
+	/*throw away every page written since the program was loaded*/
+	mem_restore(sim);
+
+	/*restore the registers and empty the pipeline*/
+	sim->CURRENT_STATE = sim->LOADED_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	memset(&sim->ID_IF, 0, sizeof(sim->ID_IF));
+	memset(&sim->IF_EX, 0, sizeof(sim->IF_EX));
+	memset(&sim->EX_MEM, 0, sizeof(sim->EX_MEM));
+	memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+	sim->FETCHED = 0;
+	sim->REDIRECT = FALSE;
+
+	/*start again from cold caches*/
+	cache_reset(&sim->L1I);
+	cache_reset(&sim->L1D);
+	cache_reset(&sim->L2);
+	dram_reset(&sim->DRAM);
+	prefetch_reset(&sim->PREFETCH);
+	mshr_reset(&sim->MSHRS);
+	store_buffer_reset(&sim->STORE_BUFFER);
+	bpred_reset(&sim->BPRED);
+	memset(sim->REG_READY, 0, sizeof(sim->REG_READY));
+	memset(sim->SCOREBOARD, 0, sizeof(sim->SCOREBOARD));
+	memset(sim->SCOREBOARD_ISSUE, 0, sizeof(sim->SCOREBOARD_ISSUE));
+	memset(&sim->HAZARD_STATS, 0, sizeof(sim->HAZARD_STATS));
+	memset(&sim->ISSUE_STATS, 0, sizeof(sim->ISSUE_STATS));
+	memset(sim->UNIT_READY, 0, sizeof(sim->UNIT_READY));
+	memset(sim->UNIT_PRODUCER, 0, sizeof(sim->UNIT_PRODUCER));
+	memset(&sim->MUL_STATS, 0, sizeof(sim->MUL_STATS));
+	memset(&sim->DIV_STATS, 0, sizeof(sim->DIV_STATS));
+	sim->DIV_FREE = 0;
+	sim->OOO.config.width = sim->ISSUE_WIDTH;
+	ooo_reset(&sim->OOO, sim->CURRENT_STATE.PC);
+	sim->PIPE_CLOCK = 0;
+	sim->PIPE_STALL = 0;
+
+	sim->INSTRUCTION_COUNT = 0;
+	sim->CYCLE_COUNT = 0;
+	sim->RUN_FLAG = TRUE;
+}
 
-	printf("MU-RISCV SIM:> ");
+/***************************************************************/
+/* Remember the freshly loaded program so reset() can return to it         */
+/***************************************************************/
+void snapshot_program(sim_t *sim)
+{
+	mem_snapshot(sim);
+	sim->LOADED_STATE = sim->CURRENT_STATE;
+}
 
-	if (scanf("%s", buffer) == EOF)
+/***************************************************************/
+/* Allocate the (empty) page directories covering the address space;    */
+/* returns 0 when out of memory                                                              */
+/***************************************************************/
+int init_memory(sim_t *sim)
+{
+	int i;
+	sim->MEM_PAGE_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	sim->MEM_SNAPSHOT_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	sim->MEM_CHECKPOINT_TABLE = calloc(MEM_PAGE_COUNT, sizeof(uint8_t *));
+	sim->MEM_DIRTY_BITS = calloc(MEM_PAGE_COUNT / 32, sizeof(uint32_t));
+	sim->MEM_CHECKPOINT_BITS = calloc(MEM_PAGE_COUNT / 32, sizeof(uint32_t));
+	if (sim->MEM_PAGE_TABLE == NULL || sim->MEM_SNAPSHOT_TABLE == NULL || sim->MEM_CHECKPOINT_TABLE == NULL ||
+		sim->MEM_DIRTY_BITS == NULL || sim->MEM_CHECKPOINT_BITS == NULL)
 	{
-		exit(0);
+		printf("Error: Out of memory allocating the page directory\n");
+		return 0;
 	}
+	for (i = 0; i < NUM_MEM_REGION; i++)
+	{
+		sim->MEM_REGIONS[i] = MEM_LAYOUT[i];
+	}
+	mem_invalidate(sim);
+	return 1;
+}
+
+/***************************************************************/
+/* Forget the cached last read/write pages                                              */
+/***************************************************************/
+void mem_invalidate(sim_t *sim)
+{
+	sim->LAST_PAGE_NUM = MEM_PAGE_COUNT;
+	sim->LAST_PAGE = NULL;
+	sim->LAST_WRITE_PAGE_NUM = MEM_PAGE_COUNT;
+	sim->LAST_WRITE_PAGE = NULL;
+}
+
+/***************************************************************/
+/* Make everything written so far the shared, read-only load image          */
+/***************************************************************/
+void mem_snapshot(sim_t *sim)
+{
+	uint32_t i, page_num;
 
-	switch (buffer[0])
+	// Before the snapshot every page is private and on the dirty list
+	for (i = 0; i < sim->MEM_DIRTY_COUNT; i++)
 	{
-	case 'S':
-	case 's':
-		if (buffer[1] == 'h' || buffer[1] == 'H')
-		{
-			show_pipeline();
-		}
-		else
-		{
-			runAll();
-		}
-		break;
-	case 'M':
-	case 'm':
-		if (scanf("%x %x", &start, &stop) != 2)
-		{
-			break;
-		}
-		mdump(start, stop);
-		break;
-	case '?':
-		help();
-		break;
-	case 'Q':
-	case 'q':
-		printf("**************************\n");
-		printf("Exiting MU-RISCV! Good Bye...\n");
-		printf("**************************\n");
-		exit(0);
-	case 'R':
-	case 'r':
-		if (buffer[1] == 'd' || buffer[1] == 'D')
-		{
-			rdump();
-		}
-		else if (buffer[1] == 'e' || buffer[1] == 'E')
-		{
-			reset();
-		}
-		else
+		page_num = sim->MEM_DIRTY_LIST[i];
+		sim->MEM_SNAPSHOT_TABLE[page_num] = sim->MEM_PAGE_TABLE[page_num];
+		MEM_BIT_CLEAR(sim->MEM_DIRTY_BITS, page_num);
+	}
+	sim->MEM_DIRTY_COUNT = 0;
+	mem_clear_checkpoint(sim);
+	mem_invalidate(sim);
+}
+
+/***************************************************************/
+/* Drop a page's private copy so it reads as the snapshot again                   */
+/***************************************************************/
+void mem_discard_page(sim_t *sim, uint32_t page_num)
+{
+	uint8_t *page = sim->MEM_PAGE_TABLE[page_num];
+
+	if (page != NULL && page != sim->MEM_SNAPSHOT_TABLE[page_num])
+	{
+		free(page);
+		mem_region(sim, page_num << MEM_PAGE_SHIFT)->touched--;
+		sim->MEM_PAGE_TABLE[page_num] = sim->MEM_SNAPSHOT_TABLE[page_num];
+	}
+}
+
+/***************************************************************/
+/* Return all of memory to the snapshot; costs one step per dirty page       */
+/***************************************************************/
+void mem_restore(sim_t *sim)
+{
+	uint32_t i, page_num;
+
+	for (i = 0; i < sim->MEM_DIRTY_COUNT; i++)
+	{
+		page_num = sim->MEM_DIRTY_LIST[i];
+		mem_discard_page(sim, page_num);
+		MEM_BIT_CLEAR(sim->MEM_DIRTY_BITS, page_num);
+	}
+	sim->MEM_DIRTY_COUNT = 0;
+	mem_clear_checkpoint(sim);
+	mem_invalidate(sim);
+}
+
+/***************************************************************/
+/* Forget the checkpoint: diffs are taken against the load image again    */
+/***************************************************************/
+void mem_clear_checkpoint(sim_t *sim)
+{
+	uint32_t word, bit;
+
+	for (word = 0; word < MEM_PAGE_COUNT / 32; word++)
+	{
+		for (bit = 0; sim->MEM_CHECKPOINT_BITS[word] != 0 && bit < 32; bit++)
 		{
-			if (scanf("%d", &cycles) != 1)
+			uint32_t page_num = (word << 5) | bit;
+			if (MEM_BIT_TEST(sim->MEM_CHECKPOINT_BITS, page_num))
 			{
-				break;
+				free(sim->MEM_CHECKPOINT_TABLE[page_num]);
+				sim->MEM_CHECKPOINT_TABLE[page_num] = NULL;
+				MEM_BIT_CLEAR(sim->MEM_CHECKPOINT_BITS, page_num);
 			}
-			run(cycles);
 		}
-		break;
-	case 'I':
-	case 'i':
-		if (scanf("%u %i", &register_no, &register_value) != 2)
-		{
-			break;
-		}
-		CURRENT_STATE.REGS[register_no] = register_value;
-		NEXT_STATE.REGS[register_no] = register_value;
-		break;
-	case 'H':
-	case 'h':
-		if (scanf("%i", &hi_reg_value) != 1)
-		{
-			break;
-		}
-		CURRENT_STATE.HI = hi_reg_value;
-		NEXT_STATE.HI = hi_reg_value;
-		break;
-	case 'L':
-	case 'l':
-		if (scanf("%i", &lo_reg_value) != 1)
-		{
-			break;
-		}
-		CURRENT_STATE.LO = lo_reg_value;
-		NEXT_STATE.LO = lo_reg_value;
-		break;
-	case 'P':
-	case 'p':
-		print_program();
-		break;
-	case 'f':
-	case 'F':
-		if (scanf("%d", &fwd) != 1)
-		{
-			break;
-		}
-		if (fwd == 0)
+	}
+	sim->CHECKPOINT_TAKEN = FALSE;
+	sim->LAST_WRITE_PAGE_NUM = MEM_PAGE_COUNT;
+	sim->LAST_WRITE_PAGE = NULL;
+}
+
+/***************************************************************/
+/* Start a new checkpoint: later diffs only show writes made after it         */
+/***************************************************************/
+void mem_checkpoint(sim_t *sim)
+{
+	// The write cache must miss so the next write to each page gets tracked
+	mem_clear_checkpoint(sim);
+	sim->CHECKPOINT_TAKEN = TRUE;
+}
+
+/***************************************************************/
+/* Return the pages of [begin, end] to their snapshot contents                    */
+/***************************************************************/
+void mem_release(sim_t *sim, uint32_t begin, uint32_t end)
+{
+	uint32_t page_num;
+
+	for (page_num = begin >> MEM_PAGE_SHIFT; page_num <= (end >> MEM_PAGE_SHIFT); page_num++)
+	{
+		mem_discard_page(sim, page_num);
+	}
+	mem_invalidate(sim);
+}
+
+/***************************************************************/
+/* Free every page and the directories; init_memory() may have failed part way */
+/***************************************************************/
+void mem_free(sim_t *sim)
+{
+	uint32_t page_num;
+
+	if (sim->MEM_PAGE_TABLE != NULL && sim->MEM_SNAPSHOT_TABLE != NULL && sim->MEM_CHECKPOINT_TABLE != NULL &&
+		sim->MEM_DIRTY_BITS != NULL && sim->MEM_CHECKPOINT_BITS != NULL)
+	{
+		// Private pages and checkpoint copies first; what is left is the load image
+		mem_restore(sim);
+		for (page_num = 0; page_num < MEM_PAGE_COUNT; page_num++)
 		{
-			ENABLE_FORWARDING = 0;
-			printf("Forwarding OFF\n");
+			free(sim->MEM_SNAPSHOT_TABLE[page_num]);
 		}
-		else if (fwd == 1)
+	}
+	free(sim->MEM_PAGE_TABLE);
+	free(sim->MEM_SNAPSHOT_TABLE);
+	free(sim->MEM_CHECKPOINT_TABLE);
+	free(sim->MEM_DIRTY_BITS);
+	free(sim->MEM_CHECKPOINT_BITS);
+	free(sim->MEM_DIRTY_LIST);
+}
+
+/***************************************************************/
+/* Print how many pages have been touched and the bytes they use                  */
+/***************************************************************/
+void mem_stats(sim_t *sim)
+{
+	int i;
+	uint32_t total = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory usage (page size %d bytes)\n", MEM_PAGE_SIZE);
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Region]\t\t\t[Pages]\t[Resident bytes]\n");
+	for (i = 0; i < NUM_MEM_REGION; i++)
+	{
+		printf("\t0x%08x..0x%08x\t%u\t%u\n", sim->MEM_REGIONS[i].begin, sim->MEM_REGIONS[i].end,
+			   sim->MEM_REGIONS[i].touched, sim->MEM_REGIONS[i].touched * MEM_PAGE_SIZE);
+		total += sim->MEM_REGIONS[i].touched;
+	}
+	printf("\tTotal\t\t\t\t%u\t%u\n\n", total, total * MEM_PAGE_SIZE);
+}
+
+/***************************************************************/
+/* L1: 8KB 4-way I-cache, 64KB 8-way D-cache, 32-byte blocks, hit in the stage */
+/* L2: 256KB 8-way inclusive, 64-byte blocks, 10 cycles; DRAM: 100 cycles */
+/***************************************************************/
+const cache_config_t L1I_DEFAULT = {8192, 4, 32, REPL_LRU, WRITE_BACK, 0};
+const cache_config_t L1D_DEFAULT = {65536, 8, 32, REPL_LRU, WRITE_BACK, 0};
+const cache_config_t L2_DEFAULT = {262144, 8, 64, REPL_LRU, WRITE_BACK, 10};
+const dram_config_t DRAM_DEFAULT = {0, 0, 100, 100};
+
+// IF and MEM can miss in the same cycle; their refills overlap
+void cache_stall(sim_t *sim, uint32_t cycles)
+{
+	if (cycles > sim->PIPE_STALL)
+	{
+		sim->PIPE_STALL = cycles;
+	}
+}
+
+/***************************************************************/
+/* Send a load or store to the D-cache; returns the cycle its data is   */
+/* ready. Without MSHRs a miss freezes the pipeline as before; with     */
+/* them it only freezes when every MSHR is busy.                                  */
+/***************************************************************/
+uint64_t dcache_access(sim_t *sim, uint32_t pc, uint32_t address, int write)
+{
+	const uint64_t now = sim->CYCLE_COUNT;
+	const uint32_t block = address & ~(sim->L1D.config.block - 1);
+	uint64_t start, ready;
+
+	if (sim->MSHRS.count == 0)
+	{
+		cache_stall(sim, prefetch_access(&sim->PREFETCH, &sim->L1D, pc, address, write, now));
+		return now;
+	}
+
+	// Hits, and misses to a block already on its way, need no new MSHR
+	if (cache_lookup(&sim->L1D, address) != NULL)
+	{
+		if (mshr_find(&sim->MSHRS, block, now) >= 0)
 		{
-			ENABLE_FORWARDING = 1;
-			printf("Forwarding ON\n");
+			sim->MSHRS.stats.secondary++;
 		}
-		else
+		else if (mshr_outstanding(&sim->MSHRS, now) > 0)
 		{
-			printf("Invalid Command.\n");
+			sim->MSHRS.stats.hit_under_miss++;
 		}
-		break;
-	default:
-		printf("Invalid Command.\n");
-		break;
+		return now + prefetch_access(&sim->PREFETCH, &sim->L1D, pc, address, write, now);
 	}
+
+	start = mshr_free_at(&sim->MSHRS, now);
+	if (start > now)
+	{
+		sim->MSHRS.stats.full++;
+		sim->MSHRS.stats.full_cycles += start - now;
+		cache_stall(sim, start - now);
+	}
+	ready = start + prefetch_access(&sim->PREFETCH, &sim->L1D, pc, address, write, start);
+	// A write-through store miss does not fetch the block
+	if (cache_lookup(&sim->L1D, address) != NULL)
+	{
+		mshr_allocate(&sim->MSHRS, block, ready, start);
+	}
+	return ready;
+}
+
+// Cycles until the registers an instruction reads or writes are back from non-blocking loads
+uint32_t operand_wait(sim_t *sim, const uint32_t ir)
+{
+	const uint32_t format = ISA_FORMAT[isa_decode(ir)];
+	const uint32_t rs1 = (ir >> 15) & 0x1F, rs2 = (ir >> 20) & 0x1F, rd = (ir >> 7) & 0x1F;
+	uint64_t ready = 0;
+
+	if (reads_rs1(format))
+	{
+		ready = sim->REG_READY[rs1];
+	}
+	if (reads_rs2(format) && sim->REG_READY[rs2] > ready)
+	{
+		ready = sim->REG_READY[rs2];
+	}
+	if (FMT_WRITES_RD[format] && sim->REG_READY[rd] > ready)
+	{
+		ready = sim->REG_READY[rd];
+	}
+	return ready > sim->CYCLE_COUNT ? (uint32_t)(ready - sim->CYCLE_COUNT) : 0;
 }
 
 /***************************************************************/
-/* reset registers/memory and reload program                                                    */
+/* Wire the L1s to the L2 (when enabled) and everything to DRAM        */
 /***************************************************************/
-void reset()
+void cache_hierarchy(sim_t *sim)
 {
-	int i;
-	/*reset registers*/
-	for (i = 0; i < MIPS_REGS; i++)
+	if (sim->L2.inclusion == INCLUSION_EXCLUSIVE && (sim->L1I.config.block != sim->L2.config.block || sim->L1D.config.block != sim->L2.config.block))
+	{
+		printf("Error: an exclusive L2 needs the L1 block size, using NINE\n");
+		sim->L2.inclusion = INCLUSION_NINE;
+	}
+	sim->L2.upper_count = 0;
+	cache_attach(&sim->L1I, sim->L2_ENABLED ? &sim->L2 : NULL, &sim->DRAM);
+	cache_attach(&sim->L1D, sim->L2_ENABLED ? &sim->L2 : NULL, &sim->DRAM);
+	cache_attach(&sim->L2, NULL, &sim->DRAM);
+	if (!sim->L2_ENABLED)
 	{
-		CURRENT_STATE.REGS[i] = 0;
+		sim->L2.upper_count = 0;
 	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
+}
 
-	for (i = 0; i < NUM_MEM_REGION; i++)
+/***************************************************************/
+/* Out-of-order core: 32-entry ROB, 16-entry LSQ, two ALUs, a branch  */
+/* unit and an address unit, every one a cycle, and the in-order       */
+/* pipeline's multiplier and divider                                               */
+/***************************************************************/
+const ooo_config_t OOO_DEFAULT = {1, 32, 16, {16, 8, 16, 4, 4}, {2, 1, 1, 1, 1}, {1, 1, 1, 3, 32}};
+
+/***************************************************************/
+/* The out-of-order core's view of memory and the caches                 */
+/***************************************************************/
+uint32_t core_read(void *context, uint32_t address, uint32_t size)
+{
+	sim_t *sim = context;
+
+	return size == 1 ? mem_read_8(sim, address) : size == 2 ? mem_read_16(sim, address) : mem_read_32(sim, address);
+}
+
+void core_write(void *context, uint32_t address, uint32_t size, uint32_t value)
+{
+	sim_t *sim = context;
+
+	if (size == 1)
+	{
+		mem_write_8(sim, address, value & 0xFF);
+	}
+	else if (size == 2)
+	{
+		mem_write_16(sim, address, value & 0xFFFF);
+	}
+	else
 	{
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		mem_write_32(sim, address, value);
 	}
+}
 
-	/*load program*/
-	load_program();
+uint32_t core_fetch_latency(void *context, uint32_t pc, uint64_t now)
+{
+	sim_t *sim = context;
 
-	/*reset PC*/
-	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+	trace_record(&sim->TRACE, TRACE_FETCH, pc);
+	return sim->CACHE_ENABLED ? cache_access(&sim->L1I, pc, FALSE, now) : 0;
 }
 
-/***************************************************************/
-/* Allocate and set memory to zero                                                                            */
-/***************************************************************/
-void init_memory()
+// With no MSHRs every miss is still timed, but nothing freezes: the core only waits for the data
+uint64_t core_data_ready(void *context, uint32_t pc, uint32_t address, int write, uint64_t now)
 {
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++)
+	sim_t *sim = context;
+	uint64_t ready;
+
+	trace_record(&sim->TRACE, write ? TRACE_STORE : TRACE_LOAD, address);
+	if (!sim->CACHE_ENABLED)
+	{
+		return now;
+	}
+	if (sim->MSHRS.count == 0)
 	{
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		return now + prefetch_access(&sim->PREFETCH, &sim->L1D, pc, address, write, now);
 	}
+	ready = dcache_access(sim, pc, address, write);
+	sim->PIPE_STALL = 0;
+	return ready;
 }
 
 /**************************************************************/
-/* load program into memory                                   */
+/* load program into memory, echoing each word if asked;      */
+/* returns 0 if the file cannot be opened                     */
 /**************************************************************/
-void load_program()
+int load_program(sim_t *sim, const char *path, int echo)
 {
 	FILE *fp;
 	int i, word;
 	uint32_t address;
 
 	/* Open program file. */
-	fp = fopen(prog_file, "r");
+	fp = fopen(path, "r");
 	if (fp == NULL)
 	{
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+		printf("Error: Can't open program file %s\n", path);
+		return 0;
 	}
 
 	/* Read in the program. */
@@ -392,589 +946,839 @@ void load_program()
 	while (fscanf(fp, "%x\n", &word) != EOF)
 	{
 		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
-		LAST_INST = address;
+		mem_write_32(sim, address, word);
+		if (echo)
+		{
+			printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
+		}
+		sim->LAST_INST = address;
 		i += 4;
 	}
-	PROGRAM_SIZE = i / 4;
-	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+	sim->PROGRAM_SIZE = i / 4;
+	if (echo)
+	{
+		printf("Program loaded into memory.\n%d words written into memory.\n\n", sim->PROGRAM_SIZE);
+	}
 	fclose(fp);
+	return 1;
 }
 
 /************************************************************/
 /* maintain the pipeline                                    */
 /************************************************************/
-void handle_pipeline()
+void handle_pipeline(sim_t *sim)
 {
 	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
 	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
-	WB();
-	MEM();
-	EX();
-	ID();
-	IF();
+
+	// The out-of-order core has stages and queues of its own
+	if (sim->OOO_ENABLED)
+	{
+		sim->OOO.env.last = sim->LAST_INST;
+		sim->OOO.env.fetch_block = sim->CACHE_ENABLED ? sim->L1I.config.block : 0;
+		sim->INSTRUCTION_COUNT += ooo_cycle(&sim->OOO, sim->CYCLE_COUNT);
+		sim->CURRENT_STATE.PC = sim->OOO.pc;
+		sim->NEXT_STATE = sim->CURRENT_STATE;
+		return;
+	}
+
+	// A cache miss freezes every stage until the block arrives
+	// Buffered stores keep draining while the pipeline is frozen
+	if (sim->CACHE_ENABLED && sim->STORE_BUFFER.size > 0)
+	{
+		store_buffer_tick(&sim->STORE_BUFFER, &sim->PREFETCH, &sim->L1D, sim->CYCLE_COUNT);
+	}
+
+	if (sim->PIPE_STALL > 0)
+	{
+		sim->PIPE_STALL--;
+		return;
+	}
+
+	// So does an instruction about to read a register a non-blocking load has not filled yet
+	uint32_t wait = bundle_wait(sim, sim->IF_EX, sim->ISSUE_WIDTH);
+	if (bundle_wait(sim, sim->ID_IF, sim->FETCHED) > wait)
+	{
+		wait = bundle_wait(sim, sim->ID_IF, sim->FETCHED);
+	}
+	if (wait > 0)
+	{
+		sim->MSHRS.stats.use_cycles += wait;
+		sim->PIPE_STALL = wait - 1;
+		return;
+	}
+
+	WB(sim);
+	MEM(sim);
+	EX(sim);
+	ID(sim);
+	IF(sim);
+	sim->PIPE_CLOCK++;
+}
+
+// Longest operand_wait() of the instructions in a bundle
+uint32_t bundle_wait(sim_t *sim, const CPU_Pipeline_Reg *bundle, uint32_t slots)
+{
+	uint32_t wait = 0, s;
+
+	for (s = 0; s < slots; s++)
+	{
+		if (operand_wait(sim, bundle[s].IR) > wait)
+		{
+			wait = operand_wait(sim, bundle[s].IR);
+		}
+	}
+	return wait;
+}
+
+/************************************************************/
+/* Whether the program has run off its end and every stage */
+/* is empty                                                 */
+/************************************************************/
+int pipeline_done(sim_t *sim)
+{
+	uint32_t s;
+
+	// The out-of-order core's PC only moves past the end once the last instruction commits
+	if (sim->CURRENT_STATE.PC <= sim->LAST_INST || sim->OOO_ENABLED)
+	{
+		return sim->CURRENT_STATE.PC > sim->LAST_INST;
+	}
+	for (s = 0; s < ISSUE_MAX; s++)
+	{
+		if (sim->ID_IF[s].IR != 0 || sim->IF_EX[s].IR != 0 || sim->EX_MEM[s].IR != 0 || sim->MEM_WB[s].IR != 0)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
 }
 
 /************************************************************/
 /* writeback (WB) pipeline stage:                           */
 /************************************************************/
-void WB()
+void WB(sim_t *sim)
+{
+	uint32_t s;
+
+	// Slots retire oldest first, so the youngest of two writes to a register wins
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
+	{
+		const CPU_Pipeline_Reg *retiring = &sim->MEM_WB[s];
+		const uint32_t rd = (retiring->IR >> 7) & 0x1F;
+
+		// Bubbles and squashed instructions are not counted
+		if (retiring->IR != 0)
+		{
+			sim->INSTRUCTION_COUNT++;
+		}
+
+		// MEM leaves the ALU result in LMD for everything but loads
+		if (FMT_WRITES_RD[ISA_FORMAT[isa_decode(retiring->IR)]] && rd != 0)
+		{
+			sim->CURRENT_STATE.REGS[rd] = retiring->LMD;
+		}
+	}
+}
+
+/************************************************************/
+/* memory access (MEM) pipeline stage:                      */
+/************************************************************/
+void MEM(sim_t *sim)
+{
+	uint32_t s;
+
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
+	{
+		MEM_slot(sim, &sim->EX_MEM[s], &sim->MEM_WB[s]);
+	}
+}
+
+// ID lets at most one load or store into a bundle: there is a single D-cache port
+void MEM_slot(sim_t *sim, const CPU_Pipeline_Reg *in, CPU_Pipeline_Reg *out)
 {
-	INSTRUCTION_COUNT++;
-	const uint32_t opcode = MEM_WB.IR & 0x7F;
-	const uint32_t rd = (MEM_WB.IR >> 7) & 0x1F;
+	out->IR = in->IR;
+	out->ALUOutput = in->ALUOutput;
 
-	INSTRUCTION_COUNT++;
+	const uint32_t id = isa_decode(out->IR);
+	const uint32_t format = ISA_FORMAT[id];
+	store_buffer_match_t match = STORE_BUFFER_MISS;
+	uint32_t forwarded = 0, drain = 0;
 
-	// Clear the stalling flag if the stalled instruction has completed
-	if (STALLING && stalledInstruction.opcode == opcode && stalledInstruction.rd == rd)
+	if (format == FMT_S || (format == FMT_LOAD && id != INST_JALR))
 	{
-		if (!ENABLE_FORWARDING)
+		// funct3[1:0] is the access size for both loads and stores
+		const uint32_t size = 1u << ((out->IR >> 12) & 0x3);
+
+		trace_record(&sim->TRACE, format == FMT_S ? TRACE_STORE : TRACE_LOAD, in->ALUOutput);
+		if (sim->CACHE_ENABLED && format == FMT_S && sim->STORE_BUFFER.size > 0)
 		{
-			NO_FORWARD_DELAY = 1;
+			// The store reaches the D-cache later; MEM only waits for a free entry
+			cache_stall(sim, store_buffer_push(&sim->STORE_BUFFER, &sim->PREFETCH, &sim->L1D, in->PC, in->ALUOutput, size, in->B,
+										  sim->CYCLE_COUNT));
 		}
-		else
+		else if (sim->CACHE_ENABLED)
 		{
-			STALLING = FALSE;
-			CURRENT_STATE.PC += 4;
+			// Loads look in the store buffer before the cache
+			if (format == FMT_LOAD)
+			{
+				match = store_buffer_forward(&sim->STORE_BUFFER, &sim->PREFETCH, &sim->L1D, in->ALUOutput, size, &forwarded, &drain,
+											 sim->CYCLE_COUNT);
+				cache_stall(sim, drain);
+			}
+			if (match != STORE_BUFFER_FORWARD)
+			{
+				const uint64_t ready = dcache_access(sim, in->PC, in->ALUOutput, format == FMT_S);
+				const uint32_t rd = (out->IR >> 7) & 0x1F;
+
+				// A load that missed only holds up the instructions that use its register
+				if (format == FMT_LOAD && rd != 0 && ready > sim->CYCLE_COUNT)
+				{
+					sim->REG_READY[rd] = ready;
+					// The bundle behind it executes this very cycle
+					const uint32_t wait = bundle_wait(sim, sim->IF_EX, sim->ISSUE_WIDTH);
+
+					sim->MSHRS.stats.use_cycles += wait;
+					cache_stall(sim, wait);
+				}
+			}
 		}
 	}
 
-	switch (opcode)
+	switch (id)
 	{
-	case 0x33: // Register-Register Instruction (R-type)
-		CURRENT_STATE.REGS[rd] = MEM_WB.ALUOutput;
+	case INST_LB:
+		out->LMD = byte_to_word(match == STORE_BUFFER_FORWARD ? forwarded : mem_read_8(sim, in->ALUOutput));
+		break;
+	case INST_LH:
+		out->LMD = half_to_word(match == STORE_BUFFER_FORWARD ? forwarded : mem_read_16(sim, in->ALUOutput));
+		break;
+	case INST_LW:
+		out->LMD = match == STORE_BUFFER_FORWARD ? forwarded : mem_read_32(sim, in->ALUOutput);
 		break;
-	case 0x13: // Register-Immediate Instruction (I-type Arimetic)
-		CURRENT_STATE.REGS[rd] = MEM_WB.ALUOutput;
+	case INST_LBU:
+		out->LMD = match == STORE_BUFFER_FORWARD ? forwarded : mem_read_8(sim, in->ALUOutput);
 		break;
-	case 0x03: // Load-from-Memory Instruction (I-type Load)
-		CURRENT_STATE.REGS[rd] = MEM_WB.LMD;
+	case INST_LHU:
+		out->LMD = match == STORE_BUFFER_FORWARD ? forwarded : mem_read_16(sim, in->ALUOutput);
 		break;
-	case 0x67: // I-Type Jump and Link Register (JALR)
-		CURRENT_STATE.REGS[rd] = MEM_WB.ALUOutput;
+	case INST_SB:
+		mem_write_8(sim, in->ALUOutput, in->B & 0xFF);
 		break;
-	default: // NOP and Store Instruction (S-type)
-		// Do nothing
+	case INST_SH:
+		mem_write_16(sim, in->ALUOutput, in->B & 0xFFFF);
+		break;
+	case INST_SW:
+		mem_write_32(sim, in->ALUOutput, in->B);
+		break;
+	default: // Other instructions that don't use memory
+		// This makes forwarding easier, trust
+		out->LMD = in->ALUOutput;
 		break;
 	}
+
+	// Set RegWrite and RegisterRd for instructions that write to a register
+	out->RegWrite = FMT_WRITES_RD[format];
+	out->RegisterRd = out->RegWrite ? (out->IR >> 7) & 0x1F : 0;
 }
 
 /************************************************************/
-/* memory access (MEM) pipeline stage:                      */
+/* execution (EX) pipeline stage:                           */
 /************************************************************/
-void MEM()
+void EX(sim_t *sim)
 {
-	MEM_WB.IR = EX_MEM.IR;
-	MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-
-	int opcode = MEM_WB.IR & 0x7F;
-	int funct3 = (MEM_WB.IR >> 12) & 0x7;
+	uint32_t s;
 
-	// Initialize RegWrite and RegisterRd to FALSE and 0 respectively
-	MEM_WB.RegWrite = FALSE;
-	MEM_WB.RegisterRd = 0;
-
-	switch (opcode)
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
 	{
-	case 0x03: // Load-from-Memory Instruction (I-type Load)
-
-		switch (funct3)
+		// Slots behind a mispredicted branch in the same bundle are on the wrong path
+		if (sim->REDIRECT)
 		{
-		case (0x0): // lb
-			MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-			break;
-		case (0x1): // lh
-			MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-			break;
-		case (0x2): // lw
-			MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-			break;
+			pipeline_bubble(&sim->EX_MEM[s]);
+			continue;
 		}
+		EX_slot(sim, &sim->IF_EX[s], &sim->EX_MEM[s]);
+	}
+}
 
-		break;
-	case 0x23: // Store Instruction (S-type)
+void EX_slot(sim_t *sim, const CPU_Pipeline_Reg *in, CPU_Pipeline_Reg *out)
+{
+	const uint32_t id = isa_decode(in->IR);
+	const uint32_t imm = in->imm;
+	uint32_t A = in->A, B = in->B;
 
-		switch (funct3)
+	// The bypass network delivers operands as EX starts, not when ID read them
+	if (sim->ENABLE_FORWARDING == FORWARD_BYPASS)
+	{
+		if (reads_rs1(ISA_FORMAT[id]))
 		{
-		case (0x0): // lb
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
-			break;
-		case (0x1): // lh
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
-			break;
-		case (0x2): // lw
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
-			break;
+			A = bypass_operand(sim, (in->IR >> 15) & 0x1F);
 		}
-		break;
-	default: // Other instructions that don't use memory
-		// This makes forwarding easier, trust
-		MEM_WB.LMD = EX_MEM.ALUOutput;
-		break;
+		if (reads_rs2(ISA_FORMAT[id]))
+		{
+			B = bypass_operand(sim, (in->IR >> 20) & 0x1F);
+		}
+	}
+	out->IR = in->IR;
+	out->PC = in->PC;
+	out->A = A;
+	out->B = B;
+
+	// Set RegWrite and specify the destination register for every format that has one
+	out->RegWrite = FMT_WRITES_RD[ISA_FORMAT[id]];
+	out->RegisterRd = out->RegWrite ? (in->IR >> 7) & 0x1F : 0;
+
+	// B-type leaves its next PC in ALUOutput, jumps their return address
+	out->ALUOutput = isa_execute(id, A, B, imm, in->PC);
+	if (isa_is_mul(id) || isa_is_div(id))
+	{
+		unit_start(sim, id, out->RegisterRd, A, B);
 	}
+	const int taken = id == INST_JAL || id == INST_JALR || isa_taken(id, A, B);
 
-	// Set RegWrite and RegisterRd for instructions that write to a register
-	if (opcode == 0x03 || opcode == 0x13 || opcode == 0x1B || opcode == 0x67)
-	{ // I-type instructions
-		MEM_WB.RegWrite = TRUE;
-		MEM_WB.RegisterRd = (MEM_WB.IR >> 7) & 0x1F;
+	// Resolve branches and jumps against what IF predicted for them; ID already did B-type and jal
+	if (id == INST_JALR || (!sim->BRANCH_IN_ID && (ISA_FORMAT[id] == FMT_B || ISA_FORMAT[id] == FMT_J)))
+	{
+		branch_resolve(sim, in, id, taken, A);
 	}
 }
 
 /************************************************************/
-/* execution (EX) pipeline stage:                           */
+/* Train the predictor with a resolved branch or jump and   */
+/* redirect fetch if IF went down the wrong path            */
+/************************************************************/
+void branch_resolve(sim_t *sim, const CPU_Pipeline_Reg *reg, const uint32_t id, const int taken, const uint32_t A)
+{
+	const uint32_t target = id == INST_JALR ? (A + reg->imm) & ~1u : reg->PC + reg->imm;
+	const uint32_t next = taken ? target : reg->PC + 4;
+	const branch_kind_t kind = ISA_FORMAT[id] == FMT_B ? BRANCH_CONDITIONAL
+							   : id == INST_JALR	   ? BRANCH_INDIRECT
+													   : BRANCH_JUMP;
+	const uint8_t ras = bpred_ras_hint(kind, (reg->IR >> 7) & 0x1F, (reg->IR >> 15) & 0x1F);
+
+	bpred_update(&sim->BPRED, reg->PC, kind, ras, taken, target, &reg->prediction);
+	if (next != reg->prediction.next)
+	{
+		// Everything fetched after the branch is on the wrong path
+		sim->REDIRECT = TRUE;
+		sim->REDIRECT_PC = next;
+	}
+}
+
+/************************************************************/
+/* Forwarding function for ID stage:                        */
 /************************************************************/
-void EX()
-{
-	EX_MEM.IR = IF_EX.IR;
-	EX_MEM.A = IF_EX.A;
-	EX_MEM.B = IF_EX.B;
-	int opcode = IF_EX.IR & 0x7F;
-	int funct3 = (IF_EX.IR >> 12) & 0x7;
-	int funct7 = (IF_EX.IR >> 25);
-
-	// Initialize RegWrite and RegisterRd to FALSE and 0 respectively
-	EX_MEM.RegWrite = FALSE;
-	EX_MEM.RegisterRd = 0;
-
-	if (opcode == 0x33)
-	{ // R-type instructions
-		switch (funct3)
+// Stores and branches keep immediate bits where rd would be, so they are never forwarding sources
+uint8_t writes_rd(const uint32_t ir)
+{
+	return FMT_WRITES_RD[ISA_FORMAT[isa_decode(ir)]];
+}
+
+// The youngest writer of r in a bundle, NULL if none
+const CPU_Pipeline_Reg *bundle_writer(sim_t *sim, const CPU_Pipeline_Reg *bundle, const uint32_t r)
+{
+	uint32_t s;
+
+	for (s = sim->ISSUE_WIDTH; s-- > 0;)
+	{
+		const uint32_t rd = (bundle[s].IR >> 7) & 0x1F;
+
+		if (rd != 0 && rd == r && writes_rd(bundle[s].IR))
 		{
-		case 0x0:
-			if (funct7 == 0x00)
-			{
-				// add
-				EX_MEM.ALUOutput = IF_EX.A + IF_EX.B;
-			}
-			else if (funct7 == 0x20)
-			{
-				// sub
-				EX_MEM.ALUOutput = IF_EX.A - IF_EX.B;
-			}
-			// Set RegWrite to TRUE and specify destination register for R-type instructions
-			EX_MEM.RegWrite = TRUE;
-			EX_MEM.RegisterRd = (IF_EX.IR >> 7) & 0x1F;
-			break;
-		case 0x1:
-			// sll
-			EX_MEM.ALUOutput = IF_EX.A << IF_EX.B;
-			EX_MEM.RegWrite = TRUE;
-			EX_MEM.RegisterRd = (IF_EX.IR >> 7) & 0x1F;
-			break;
-		case 0x4:
-			// xor
-			EX_MEM.ALUOutput = IF_EX.A ^ IF_EX.B;
-			break;
-		case 0x6:
-			if (funct7 == 0x00)
-			{
-				// srl
-				EX_MEM.ALUOutput = (unsigned int)IF_EX.A >> IF_EX.B;
-			}
-			else if (funct7 == 0x20)
-			{
-				// sra
-				EX_MEM.ALUOutput = IF_EX.A >> IF_EX.B;
-			}
-			break;
-		case 0x7:
-			// and
-			EX_MEM.ALUOutput = IF_EX.A & IF_EX.B;
-			break;
-		case 0x5:
-			// or
-			EX_MEM.ALUOutput = IF_EX.A | IF_EX.B;
-			break;
-		case 0x2:
-			// slt
-			EX_MEM.ALUOutput = (IF_EX.A < IF_EX.B) ? 1 : 0;
-			break;
-		case 0x3:
-			// sltu
-			EX_MEM.ALUOutput = ((unsigned int)IF_EX.A < (unsigned int)IF_EX.B) ? 1 : 0;
-			break;
+			return &bundle[s];
+		}
+	}
+	return NULL;
+}
+
+// Returns if forwarding happened or not; the EX bundle is younger, so it is checked first
+uint8_t forwarding(sim_t *sim, const uint32_t r, uint32_t *value)
+{
+	const CPU_Pipeline_Reg *ex = bundle_writer(sim, sim->EX_MEM, r);
+	const CPU_Pipeline_Reg *mem = bundle_writer(sim, sim->MEM_WB, r);
+
+	if (ex != NULL)
+	{
+		*value = ex->ALUOutput;
+	}
+	else if (mem != NULL)
+	{
+		*value = mem->LMD;
+	}
+	return ex != NULL || mem != NULL;
+}
+
+/************************************************************/
+/* instruction decode (ID) pipeline stage:                  */
+/************************************************************/
+void ID(sim_t *sim)
+{
+	uint32_t issued = 0, memory_ops = 0, branches = 0, muldiv_ops = 0, s;
+
+	// A mispredicted branch in EX squashes everything here
+	if (sim->REDIRECT)
+	{
+		for (s = 0; s < sim->ISSUE_WIDTH; s++)
+		{
+			pipeline_bubble(&sim->IF_EX[s]);
 		}
+		return;
 	}
-	else if (opcode == 0x03 || opcode == 0x13 || opcode == 0x1B || opcode == 0x67)
-	{ // I-type instructions
-		switch (funct3)
+
+	// Issue the oldest fetched instructions in order until one has to wait
+	while (issued < sim->FETCHED && issued < sim->ISSUE_WIDTH)
+	{
+		const CPU_Pipeline_Reg *decoded = &sim->ID_IF[issued];
+		const uint32_t id = isa_decode(decoded->IR), format = ISA_FORMAT[id];
+		const int rs = (decoded->IR >> 15) & 0x1F;
+		const int rt = (decoded->IR >> 20) & 0x1F;
+		CPU_Pipeline_Reg *issuing = &sim->IF_EX[issued];
+
+		// Intra-bundle dependencies: a bundle never bypasses to itself
+		for (s = 0; s < issued; s++)
 		{
-		case 0x0:
-			if (opcode == 0x03)
-			{
-				// lb
-				EX_MEM.ALUOutput = IF_EX.A + IF_EX.imm;
-			}
-			else if (opcode == 0x13)
+			const uint32_t rd = sim->IF_EX[s].RegisterRd;
+
+			if (sim->IF_EX[s].RegWrite && rd != 0 &&
+				((reads_rs1(format) && rd == (uint32_t)rs) || (reads_rs2(format) && rd == (uint32_t)rt)))
 			{
-				// addi
-				EX_MEM.ALUOutput = IF_EX.A + IF_EX.imm;
-			}
-			// Set RegWrite to TRUE and specify destination register for I-type instructions
-			EX_MEM.RegWrite = TRUE;
-			EX_MEM.RegisterRd = (IF_EX.IR >> 7) & 0x1F;
-			break;
-		case 0x4: // XORI
-			EX_MEM.ALUOutput = IF_EX.A ^ IF_EX.imm;
-			break;
-		case 0x6: // ORI
-			EX_MEM.ALUOutput = IF_EX.A | IF_EX.imm;
-			break;
-		case 0x7: // ANDI
-			EX_MEM.ALUOutput = IF_EX.A & IF_EX.imm;
-			break;
-		case 0x1: // SLLI
-			EX_MEM.ALUOutput = IF_EX.A << IF_EX.imm;
-			break;
-		case 0x5: // SRLI and SRAI
-			if (IF_EX.imm & 0x400)
-			{ // SRAI
-				EX_MEM.ALUOutput = ((int32_t)IF_EX.A) >> IF_EX.imm;
-			}
-			else
-			{ // SRLI
-				EX_MEM.ALUOutput = IF_EX.A >> IF_EX.imm;
+				break;
 			}
-			break;
-		case 0x2: // SLTI
-			EX_MEM.ALUOutput = ((int32_t)IF_EX.A < (int32_t)IF_EX.imm) ? 1 : 0;
-			break;
-		case 0x3: // SLTIU
-			EX_MEM.ALUOutput = (IF_EX.A < IF_EX.imm) ? 1 : 0;
-			break;
 		}
-	}
-	else if (opcode == 0x23)
-	{ // S-type instructions
-		switch (funct3)
+		if (s < issued)
 		{
-		case 0x0: // SB
-			EX_MEM.ALUOutput = IF_EX.A + IF_EX.imm;
-			break;
-		case 0x1: // SH
-			EX_MEM.ALUOutput = IF_EX.A + IF_EX.imm;
-			break;
-		case 0x2: // SW
-			EX_MEM.ALUOutput = IF_EX.A + IF_EX.imm;
+			sim->ISSUE_STATS.dependency++;
 			break;
 		}
-	}
-	else if (opcode == 0x63)
-	{ // B-type instructions
-		switch (funct3)
+
+		// Structural hazards: one D-cache port, one branch unit
+		if ((format == FMT_S || format == FMT_LOAD) && id != INST_JALR && memory_ops++ > 0)
 		{
-		case 0x0: // BEQ
-			if (IF_EX.A == IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
-			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
+			sim->ISSUE_STATS.memory_port++;
 			break;
-		case 0x1: // BNE
-			if (IF_EX.A != IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
-			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
+		}
+		if ((format == FMT_B || format == FMT_J || id == INST_JALR) && branches++ > 0)
+		{
+			sim->ISSUE_STATS.branch++;
 			break;
-		case 0x4: // BLT
-			if ((int32_t)IF_EX.A < (int32_t)IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
-			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
+		}
+		if ((isa_is_mul(id) || isa_is_div(id)) && muldiv_ops++ > 0)
+		{
+			sim->ISSUE_STATS.muldiv++;
 			break;
-		case 0x5: // BGE
-			if ((int32_t)IF_EX.A >= (int32_t)IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
-			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
+		}
+
+		// Detect data hazards and stall if necessary: the instruction stays in ID_IF and IF only
+		// refills the slots that were freed. The hazard unit only waits for loads (and for ALU
+		// results an ID compare needs); the older policy waits for the write-back.
+		if (sim->ENABLE_FORWARDING == FORWARD_BYPASS
+				? scoreboard_hazard(sim, decoded->IR, sim->BRANCH_IN_ID && format == FMT_B ? sim->PIPE_CLOCK : sim->PIPE_CLOCK + 1)
+				: legacy_hazard(sim, rs, rt) || (sim->BRANCH_IN_ID && format == FMT_B && branch_hazard(sim, rs, rt)))
+		{
+			sim->HAZARD_STATS.stalls++;
 			break;
-		case 0x6: // BLTU
-			if (IF_EX.A < IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
-			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
+		}
+		// Multiply and divide results take their unit's latency to come out, whatever the forward mode
+		if (unit_hazard(sim, decoded->IR, sim->BRANCH_IN_ID && format == FMT_B ? sim->PIPE_CLOCK - 1 : sim->PIPE_CLOCK))
+		{
 			break;
-		case 0x7: // BGEU
-			if (IF_EX.A >= IF_EX.B)
-			{
-				EX_MEM.ALUOutput = IF_EX.PC + IF_EX.imm;
-			}
-			else
+		}
+		scoreboard_issue(sim, decoded->IR);
+
+		// Preserve the current pipeline register values
+		issuing->IR = decoded->IR;
+		issuing->PC = decoded->PC;
+		issuing->prediction = decoded->prediction;
+		issuing->RegWrite = writes_rd(decoded->IR);
+		issuing->RegisterRd = issuing->RegWrite ? (decoded->IR >> 7) & 0x1F : 0;
+
+		// If forwarding is disabled, use the current register values
+		if (!sim->ENABLE_FORWARDING || !forwarding(sim, rs, &issuing->A))
+		{
+			issuing->A = sim->CURRENT_STATE.REGS[rs];
+		}
+		if (!sim->ENABLE_FORWARDING || !forwarding(sim, rt, &issuing->B))
+		{
+			issuing->B = sim->CURRENT_STATE.REGS[rt];
+		}
+
+		// Sign-extend the immediate for the instruction's format (R-type has none)
+		issuing->imm = isa_imm(issuing->IR, format);
+		issued++;
+
+		// Early resolution: the comparator and the jal adder sit in ID
+		if (sim->BRANCH_IN_ID && (format == FMT_B || format == FMT_J))
+		{
+			const int taken = id == INST_JAL || isa_taken(id, branch_operand(sim, rs), branch_operand(sim, rt));
+
+			branch_resolve(sim, issuing, id, taken, 0);
+			if (sim->REDIRECT)
 			{
-				EX_MEM.ALUOutput = IF_EX.PC + 4;
+				// What was fetched behind it is on the wrong path; IF drops it
+				break;
 			}
-			CURRENT_STATE.PC = EX_MEM.ALUOutput;
-			break;
 		}
 	}
-	else if (opcode == 0x37 || opcode == 0x17)
-	{ // U-type instructions
-		// LUI or AUIPC
-		EX_MEM.ALUOutput = IF_EX.imm;
-		CURRENT_STATE.PC = EX_MEM.ALUOutput;
+	sim->ISSUE_STATS.bundles[issued]++;
 
+	for (s = issued; s < sim->ISSUE_WIDTH; s++)
+	{
+		pipeline_bubble(&sim->IF_EX[s]);
+	}
+	// The instructions left behind move to the front of the fetch buffer
+	for (s = issued; s < sim->FETCHED; s++)
+	{
+		sim->ID_IF[s - issued] = sim->ID_IF[s];
 	}
-	else if (opcode == 0x6F)
-	{ // J-type instructions
-		// JAL
-		EX_MEM.RegWrite = TRUE;
-		EX_MEM.RegisterRd = (IF_EX.IR >> 7) & 0x1F;
+	sim->FETCHED -= issued;
+	for (s = sim->FETCHED; s < ISSUE_MAX; s++)
+	{
+		pipeline_bubble(&sim->ID_IF[s]);
+	}
+}
+
+// The older policy: wait while the bundle in EX/MEM or MEM/WB is still to write a source back
+uint8_t legacy_hazard(sim_t *sim, const uint32_t rs, const uint32_t rt)
+{
+	return bundle_writer(sim, sim->EX_MEM, rs) != NULL || bundle_writer(sim, sim->EX_MEM, rt) != NULL ||
+		   bundle_writer(sim, sim->MEM_WB, rs) != NULL || bundle_writer(sim, sim->MEM_WB, rt) != NULL;
+}
+
+/************************************************************/
+/* ID comparator operands: the value computed in EX this    */
+/* cycle and a load still in MEM are too late for it, an    */
+/* ALU result waiting in MEM/WB is forwarded                */
+/************************************************************/
+uint8_t branch_hazard(sim_t *sim, const uint32_t rs, const uint32_t rt)
+{
+	const CPU_Pipeline_Reg *mem_rs = bundle_writer(sim, sim->MEM_WB, rs), *mem_rt = bundle_writer(sim, sim->MEM_WB, rt);
 
-		CURRENT_STATE.PC = IF_EX.PC + IF_EX.imm;
-		EX_MEM.ALUOutput = IF_EX.PC + 4;
+	if (bundle_writer(sim, sim->EX_MEM, rs) != NULL || bundle_writer(sim, sim->EX_MEM, rt) != NULL)
+	{
+		return TRUE;
+	}
+	if (mem_rs == NULL && mem_rt == NULL)
+	{
+		return FALSE;
 	}
-	else if(opcode == 0x67)
-	{ // I-type jump
-		EX_MEM.RegWrite = TRUE;
-		EX_MEM.RegisterRd = (IF_EX.IR >> 7) & 0x1F;
+	return !sim->ENABLE_FORWARDING || (mem_rs != NULL && ISA_FORMAT[isa_decode(mem_rs->IR)] == FMT_LOAD) ||
+		   (mem_rt != NULL && ISA_FORMAT[isa_decode(mem_rt->IR)] == FMT_LOAD);
+}
+
+uint32_t branch_operand(sim_t *sim, const uint32_t r)
+{
+	const CPU_Pipeline_Reg *mem = bundle_writer(sim, sim->MEM_WB, r);
 
-		// JALR
-		CURRENT_STATE.PC = IF_EX.A + IF_EX.imm;
-		EX_MEM.ALUOutput = IF_EX.PC + 4;
+	if (sim->ENABLE_FORWARDING && mem != NULL)
+	{
+		return mem->LMD;
 	}
+	return sim->CURRENT_STATE.REGS[r];
 }
 
 /************************************************************/
-/* Forwarding function for ID stage:                        */
+/* Hazard unit                                              */
 /************************************************************/
-inline uint8_t forwardingA(const uint32_t rs)
+// Formats that read rs1 and rs2; the other bits in those fields are immediates
+uint8_t reads_rs1(const uint32_t format)
+{
+	return format != FMT_NONE && format != FMT_U && format != FMT_J;
+}
+
+uint8_t reads_rs2(const uint32_t format)
+{
+	return format == FMT_R || format == FMT_S || format == FMT_B;
+}
+
+// Whether a source of the instruction in ID cannot be bypassed to it by advance need: the next
+// one for an EX operand, this one for the ID comparator
+uint8_t scoreboard_hazard(sim_t *sim, const uint32_t ir, const uint64_t need)
 {
-	// Used for forwarding
-	uint8_t forwardA = 0x0;
-	const uint8_t exBitMask = 0x2;
-	const uint8_t memBitMask = 0x1;
+	const uint32_t format = ISA_FORMAT[isa_decode(ir)];
+	const uint32_t rs1 = (ir >> 15) & 0x1F, rs2 = (ir >> 20) & 0x1F;
 
-	// Getting rd from EX and MEM
-	const uint32_t ex_rd = (EX_MEM.IR >> 7) & 0x1F;
-	const uint32_t mem_rd = (MEM_WB.IR >> 7) & 0x1F;
+	return (reads_rs1(format) && sim->SCOREBOARD[rs1] > need) || (reads_rs2(format) && sim->SCOREBOARD[rs2] > need);
+}
+
+// An ALU result can feed the EX right behind it; a load's data only comes out of MEM a stage later
+void scoreboard_issue(sim_t *sim, const uint32_t ir)
+{
+	const uint32_t format = ISA_FORMAT[isa_decode(ir)];
+	const uint32_t rd = (ir >> 7) & 0x1F;
 
-	// Forwarding from EX stage
-	if (ex_rd != 0 && ex_rd == rs)
+	if (FMT_WRITES_RD[format] && rd != 0)
 	{
-		forwardA += 0x2;
+		sim->SCOREBOARD[rd] = sim->PIPE_CLOCK + (format == FMT_LOAD && isa_decode(ir) != INST_JALR ? 3 : 2);
+		sim->SCOREBOARD_ISSUE[rd] = sim->PIPE_CLOCK;
 	}
+}
 
-	// Forwarding from MEM stage
-	if (mem_rd != 0 && mem_rd == rs)
+// MEM has already moved the bundle one ahead into MEM/WB and WB has written the one two ahead
+uint32_t bypass_operand(sim_t *sim, const uint32_t r)
+{
+	const CPU_Pipeline_Reg *ahead = r != 0 ? bundle_writer(sim, sim->MEM_WB, r) : NULL;
+
+	if (r == 0)
 	{
-		forwardA += 0x1;
+		return 0;
 	}
-
-	// Checking for Forwarding, checking EX first
-	if (forwardA & exBitMask)
+	if (ahead != NULL)
 	{
-		IF_EX.A = EX_MEM.ALUOutput;
+		sim->HAZARD_STATS.ex_bypass++;
+		return ahead->LMD;
 	}
-	else if (forwardA & memBitMask)
+	if (sim->SCOREBOARD_ISSUE[r] + 3 == sim->PIPE_CLOCK)
 	{
-		IF_EX.A = MEM_WB.LMD;
+		sim->HAZARD_STATS.mem_bypass++;
 	}
-
-	// return if forwarding happened or not
-	return forwardA > 0;
+	return sim->CURRENT_STATE.REGS[r];
 }
 
-inline uint8_t forwardingB(const uint32_t rt)
+/************************************************************/
+/* Multiply and divide units                                */
+/************************************************************/
+// The multiplier takes a new operation every advance; the divider is busy until its result is out
+void unit_start(sim_t *sim, const uint32_t id, const uint32_t rd, const uint32_t a, const uint32_t b)
 {
-	// Used for forwarding
-	uint8_t forwardB = 0x0;
-	const uint8_t exBitMask = 0x2;
-	const uint8_t memBitMask = 0x1;
+	unit_stats_t *unit = isa_is_div(id) ? &sim->DIV_STATS : &sim->MUL_STATS;
+	const uint32_t cycles = isa_is_div(id) ? isa_div_cycles(id, a, b, sim->DIV_LATENCY) : sim->MUL_LATENCY;
 
-	// Getting rd from EX and MEM
-	const uint32_t ex_rd = (EX_MEM.IR >> 7) & 0x1F;
-	const uint32_t mem_rd = (MEM_WB.IR >> 7) & 0x1F;
-
-	// Forwarding from EX stage
-	if (ex_rd != 0 && ex_rd == rt)
+	unit->ops++;
+	if (isa_is_div(id))
+	{
+		unit->busy += cycles;
+		unit->early_outs += cycles < sim->DIV_LATENCY;
+		sim->DIV_FREE = sim->PIPE_CLOCK + cycles - 1;
+	}
+	else
+	{
+		unit->busy++;
+	}
+	// A reader in ID now goes to EX next advance, which an ALU result is just in time for
+	if (rd != 0)
 	{
-		forwardB += 0x2;
+		sim->UNIT_READY[rd] = sim->PIPE_CLOCK + cycles - 1;
+		sim->UNIT_PRODUCER[rd] = unit;
 	}
+}
+
+// Whether the instruction in ID reads a result not out by advance need, writes a register a unit
+// is still to fill, or is a divide with the divider busy; the stall is charged to that unit
+uint8_t unit_hazard(sim_t *sim, const uint32_t ir, const uint64_t need)
+{
+	unit_stats_t *unit;
 
-	// Forwarding from MEM stage
-	if (mem_rd != 0 && mem_rd == rt)
+	if (unit_wait(sim, ir, need, &unit) == 0)
 	{
-		forwardB += 0x1;
+		return FALSE;
 	}
+	unit->stalls++;
+	return TRUE;
+}
 
-	// Checking for Forwarding, checking EX first
-	if (forwardB & exBitMask)
+// Advances the first of those reasons holds the instruction for, 0 if none does
+uint64_t unit_wait(sim_t *sim, const uint32_t ir, const uint64_t need, unit_stats_t **unit)
+{
+	const uint32_t id = isa_decode(ir), format = ISA_FORMAT[id];
+	const uint32_t rs1 = (ir >> 15) & 0x1F, rs2 = (ir >> 20) & 0x1F, rd = (ir >> 7) & 0x1F;
+
+	if (isa_is_div(id) && sim->DIV_FREE > sim->PIPE_CLOCK)
 	{
-		IF_EX.B = EX_MEM.ALUOutput;
+		*unit = &sim->DIV_STATS;
+		return sim->DIV_FREE - sim->PIPE_CLOCK;
 	}
-	else if (forwardB & memBitMask)
+	if (reads_rs1(format) && sim->UNIT_READY[rs1] > need)
 	{
-		IF_EX.B = MEM_WB.LMD;
+		*unit = sim->UNIT_PRODUCER[rs1];
+		return sim->UNIT_READY[rs1] - need;
 	}
-
-	// return if forwarding happened or not
-	return forwardB > 0;
+	if (reads_rs2(format) && sim->UNIT_READY[rs2] > need)
+	{
+		*unit = sim->UNIT_PRODUCER[rs2];
+		return sim->UNIT_READY[rs2] - need;
+	}
+	if (FMT_WRITES_RD[format] && sim->UNIT_READY[rd] > sim->PIPE_CLOCK)
+	{
+		*unit = sim->UNIT_PRODUCER[rd];
+		return sim->UNIT_READY[rd] - sim->PIPE_CLOCK;
+	}
+	return 0;
 }
 
 /************************************************************/
-/* instruction decode (ID) pipeline stage:                  */
+/* instruction fetch (IF) pipeline stage:                   */
 /************************************************************/
-void ID()
-{
-	// If the pipeline is currently stalled, do nothing
-	if (STALLING || BRANCH_DETECTED)
-	{
-		IF_EX.IR = 00000000;
-		IF_EX.A = 0;
-		IF_EX.B = 0;
-		IF_EX.ALUOutput = 0;
-		IF_EX.LMD = 0;
-		IF_EX.RegWrite = FALSE;
-		IF_EX.RegisterRd = 0;
-		if(BRANCH_DETECTED)
+void IF(sim_t *sim)
+{
+	uint32_t block;
+
+	// A misprediction found this cycle: what IF fetches now is squashed, the right path starts next cycle
+	if (sim->REDIRECT)
+	{
+		sim->REDIRECT = FALSE;
+		sim->CURRENT_STATE.PC = sim->REDIRECT_PC;
+		for (; sim->FETCHED > 0; sim->FETCHED--)
 		{
-			BRANCH_DETECTED = FALSE;
+			pipeline_bubble(&sim->ID_IF[sim->FETCHED - 1]);
 		}
+		sim->NEXT_STATE = sim->CURRENT_STATE;
 		return;
 	}
 
-	// Preserve the current pipeline register values
-	IF_EX.IR = ID_IF.IR;
-	IF_EX.PC = ID_IF.PC;
-	IF_EX.A = ID_IF.A;
-	IF_EX.B = ID_IF.B;
-	IF_EX.imm = ID_IF.imm;
+	// Fill the slots ID freed; a fetch group is one I-cache block and ends at a predicted-taken branch
+	block = sim->CURRENT_STATE.PC & ~(sim->L1I.config.block - 1);
+	if (sim->CACHE_ENABLED && sim->FETCHED < sim->ISSUE_WIDTH)
+	{
+		cache_stall(sim, cache_access(&sim->L1I, sim->CURRENT_STATE.PC, FALSE, sim->CYCLE_COUNT));
+	}
+	while (sim->FETCHED < sim->ISSUE_WIDTH)
+	{
+		CPU_Pipeline_Reg *fetched = &sim->ID_IF[sim->FETCHED++];
+
+		// IR <= Mem[PC]
+		trace_record(&sim->TRACE, TRACE_FETCH, sim->CURRENT_STATE.PC);
+		fetched->IR = mem_read_32(sim, sim->CURRENT_STATE.PC);
+		fetched->PC = sim->CURRENT_STATE.PC;
 
-	// Extract rs and rt from IR
-	int rs = (IF_EX.IR >> 15) & 0x1F;
-	int rt = (IF_EX.IR >> 20) & 0x1F;
+		// The predictor picks the next PC before the instruction is even decoded
+		fetched->prediction = bpred_predict(&sim->BPRED, sim->CURRENT_STATE.PC);
+		sim->CURRENT_STATE.PC = fetched->prediction.next;
 
-	// Check for data hazards
-	if (ENABLE_FORWARDING)
-	{
-		// Perform data forwarding
-		if (!forwardingA(rs))
-		{
-			IF_EX.A = CURRENT_STATE.REGS[rs];
-		}
-		if (!forwardingB(rt))
+		if (sim->CURRENT_STATE.PC != fetched->PC + 4 ||
+			(sim->CACHE_ENABLED && (sim->CURRENT_STATE.PC & ~(sim->L1I.config.block - 1)) != block))
 		{
-			IF_EX.B = CURRENT_STATE.REGS[rt];
+			break;
 		}
 	}
-	else
-	{
-		// If forwarding is disabled, use the current register values
-		IF_EX.A = CURRENT_STATE.REGS[rs];
-		IF_EX.B = CURRENT_STATE.REGS[rt];
-	}
 
-	// Extract opcode from IR
-	int opcode = IF_EX.IR & 0x7F;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+}
+
+/************************************************************/
+/* Empty a pipeline register so the next stage sees a NOP   */
+/************************************************************/
+void pipeline_bubble(CPU_Pipeline_Reg *reg)
+{
+	reg->IR = 0;
+	reg->A = 0;
+	reg->B = 0;
+	reg->ALUOutput = 0;
+	reg->LMD = 0;
+	reg->RegWrite = FALSE;
+	reg->RegisterRd = 0;
+}
+
+/************************************************************/
+/* Create a simulator with the default configuration and   */
+/* empty memory; returns NULL when out of memory            */
+/************************************************************/
+sim_t *sim_create(void)
+{
+	sim_t *sim = calloc(1, sizeof(sim_t));
 
-	// Sign-extend the lower 16 bits of IR only for instructions that use an immediate value
-	if (opcode != 0x33)
+	if (sim == NULL)
 	{
-		IF_EX.imm = (IF_EX.IR >> 20);
+		printf("Error: Out of memory allocating the simulator\n");
+		return NULL;
 	}
-	else
+	if (!init_memory(sim))
 	{
-		IF_EX.imm = 0;
+		sim_destroy(sim);
+		return NULL;
 	}
-
-	// Check if instruction is of J-type or B-type
-	if(opcode == 0x63 || opcode == 0x6F)
+	sim->ENABLE_FORWARDING = FORWARD_NONE;
+	sim->BRANCH_IN_ID = FALSE;
+	sim->ISSUE_WIDTH = 1;
+	sim->CACHE_ENABLED = TRUE;
+	sim->L2_ENABLED = TRUE;
+	sim->MUL_LATENCY = 3;
+	sim->DIV_LATENCY = 32;
+	sim->OOO_ENABLED = FALSE;
+	if (!cache_init(&sim->L1I, "L1 I-cache", &L1I_DEFAULT) || !cache_init(&sim->L1D, "L1 D-cache", &L1D_DEFAULT) ||
+		!cache_init(&sim->L2, "L2 cache", &L2_DEFAULT) || !dram_init(&sim->DRAM, &DRAM_DEFAULT))
 	{
-		BRANCH_DETECTED = TRUE;
+		sim_destroy(sim);
+		return NULL;
 	}
+	sim->L2.inclusion = INCLUSION_INCLUSIVE;
+	cache_hierarchy(sim);
+	prefetch_init(&sim->PREFETCH, PREFETCH_NONE, 4);
+	bpred_init(&sim->BPRED, BPRED_NOT_TAKEN, 12, 9);
+	bpred_ras_init(&sim->BPRED, 8);
+	// The out-of-order core calls back into this simulator, never a global one
+	sim->OOO.env.context = sim;
+	sim->OOO.env.regs = sim->CURRENT_STATE.REGS;
+	sim->OOO.env.load = core_read;
+	sim->OOO.env.store = core_write;
+	sim->OOO.env.fetch_latency = core_fetch_latency;
+	sim->OOO.env.data_ready = core_data_ready;
+	sim->OOO.env.bpred = &sim->BPRED;
+	ooo_configure(&sim->OOO, &OOO_DEFAULT);
+	sim->CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	ooo_reset(&sim->OOO, sim->CURRENT_STATE.PC);
+	sim->RUN_FLAG = TRUE;
+	return sim;
+}
 
-	// Detect data hazards and stall the pipeline if necessary
-	if ((EX_MEM.RegWrite && (EX_MEM.RegisterRd != 0) && (EX_MEM.RegisterRd == rs || EX_MEM.RegisterRd == rt)) ||
-		(MEM_WB.RegWrite && (MEM_WB.RegisterRd != 0) && (MEM_WB.RegisterRd == rs || MEM_WB.RegisterRd == rt)))
-	{
-		// Stall the pipeline, hazard detected!
-		STALLING = TRUE;
-		// Store information about the stalled instruction
-		stalledInstruction.opcode = EX_MEM.IR & 0x7F;
-		stalledInstruction.rd = (EX_MEM.IR >> 7) & 0x1F;
-
-		CURRENT_STATE.PC -= 4;
-
-		IF_EX.IR = 00000000;
-		IF_EX.A = 0;
-		IF_EX.B = 0;
-		IF_EX.ALUOutput = 0;
-		IF_EX.LMD = 0;
-		IF_EX.RegWrite = FALSE;
-		IF_EX.RegisterRd = 0;
-	}
-	else
+/************************************************************/
+/* Load a program quietly and make it the image reset()     */
+/* returns to; returns 0 if the file cannot be opened       */
+/************************************************************/
+int sim_load(sim_t *sim, const char *path)
+{
+	if (!load_program(sim, path, FALSE))
 	{
-		// No hazard detected, proceed without stalling
-		STALLING = FALSE;
+		return 0;
 	}
+	snapshot_program(sim);
+	return 1;
 }
 
 /************************************************************/
-/* instruction fetch (IF) pipeline stage:                   */
+/* Run for up to n cycles, stopping early once the program  */
+/* is done; returns the cycles run                          */
 /************************************************************/
-void IF()
+uint32_t sim_step(sim_t *sim, uint32_t cycles)
 {
-	// IR <= Mem[PC]
-	ID_IF.IR = mem_read_32(CURRENT_STATE.PC);
-	ID_IF.PC = CURRENT_STATE.PC;
+	const uint64_t limit = (uint64_t)sim->CYCLE_COUNT + cycles;
+	uint32_t run = 0;
 
-	// 'Trail' with NOP if a branch was detected
-	if (!STALLING)
-	{
-		CURRENT_STATE.PC += 4;
-	}
-	else if (STALLING && NO_FORWARD_DELAY > 0)
+	while (run < cycles && sim->RUN_FLAG && !pipeline_done(sim))
 	{
-		NO_FORWARD_DELAY -= 1;
+		run += cycle_until(sim, limit);
 	}
-	else if (STALLING && NO_FORWARD_DELAY == 0)
+	return run;
+}
+
+/************************************************************/
+/* Run the program to completion                            */
+/************************************************************/
+void sim_run(sim_t *sim)
+{
+	while (sim->RUN_FLAG && !pipeline_done(sim))
 	{
-		STALLING = FALSE;
-		CURRENT_STATE.PC += 4;
+		cycle_until(sim, UINT32_MAX);
 	}
-
-	NEXT_STATE = CURRENT_STATE;
 }
 
 /************************************************************/
-/* Initialize Memory                                        */
+/* Free a simulator and everything it allocated             */
 /************************************************************/
-void initialize()
+void sim_destroy(sim_t *sim)
 {
-	init_memory();
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+	if (sim == NULL)
+	{
+		return;
+	}
+	trace_record_stop(&sim->TRACE);
+	mem_free(sim);
+	cache_free(&sim->L1I);
+	cache_free(&sim->L1D);
+	cache_free(&sim->L2);
+	dram_free(&sim->DRAM);
+	bpred_free(&sim->BPRED);
+	free(sim);
 }
 
 /************************************************************/
@@ -985,17 +1789,15 @@ void initialize()
 uint8_t print_instruction(const uint32_t instruction, const uint8_t printAddress, const uint32_t addr)
 {
 	const char branchHeader[] = "Br-";
-	int32_t offset; //offset for jumps
-	uint32_t branchAddress;
 
-	uint32_t opcode = instruction & 0x7F;
+	const uint32_t id = isa_decode(instruction);
+	const char *name = ISA_NAME[id];
+	const int32_t imm = isa_imm(instruction, ISA_FORMAT[id]);
 	uint32_t rd = (instruction >> 7) & 0x1F;
-	uint32_t funct3 = (instruction >> 12) & 0x7;
 	uint32_t rs1 = (instruction >> 15) & 0x1F;
 	uint32_t rs2 = (instruction >> 20) & 0x1F;
-	uint32_t funct7 = (instruction >> 25) & 0x7F;
 
-	if (opcode == 00000000)
+	if ((instruction & 0x7F) == 0)
 	{ // stops instructions with all zero bits from being printed
 		return 1;
 	}
@@ -1005,166 +1807,44 @@ uint8_t print_instruction(const uint32_t instruction, const uint8_t printAddress
 		printf("%08x: %08x ", addr, instruction);
 	}
 
-	uint32_t imm = 0;
-
-	switch (opcode)
+	switch (ISA_FORMAT[id])
 	{
-	case 0x33: // R-type
-		switch (funct3)
-		{
-		case 0x0:
-			if (funct7 == 0x00)
-				printf("add ");
-			else if (funct7 == 0x20)
-				printf("sub ");
-			break;
-		case 0x1:
-			printf("sll ");
-			break;
-		case 0x2:
-			printf("slt ");
-			break;
-		case 0x3:
-			printf("sltu ");
-			break;
-		case 0x4:
-			printf("xor ");
-			break;
-		case 0x5:
-			if (funct7 == 0x00)
-				printf("srl ");
-			else if (funct7 == 0x20)
-				printf("sra ");
-			break;
-		case 0x6:
-			printf("or ");
-			break;
-		case 0x7:
-			printf("and ");
-			break;
-		}
-		printf("x%d, x%d, x%d\n", rd, rs1, rs2);
+	case FMT_R:
+		printf("%s x%d, x%d, x%d\n", name, rd, rs1, rs2);
 		break;
-	case 0x03: // I-type (load)
-		imm = (instruction >> 20);
-		switch (funct3)
-		{
-		case 0x0:
-			printf("lb ");
-			break;
-		case 0x1:
-			printf("lh ");
-			break;
-		case 0x2:
-			printf("lw ");
-			break;
-		case 0x4:
-			printf("lbu ");
-			break;
-		case 0x5:
-			printf("lhu ");
-			break;
-		}
-		printf("x%d, %d(x%d)\n", rd, imm, rs1);
+	case FMT_I:
+	case FMT_SHIFT:
+		printf("%s x%d, x%d, %d\n", name, rd, rs1, imm);
 		break;
-	case 0x13: // I-type (addi, slti, sltiu, xori, ori, andi, slli, srli, srai)
-		imm = (instruction >> 20);
-		switch (funct3)
-		{
-		case 0x0:
-			printf("addi ");
-			break;
-		case 0x2:
-			printf("slti ");
-			break;
-		case 0x3:
-			printf("sltiu ");
-			break;
-		case 0x4:
-			printf("xori ");
-			break;
-		case 0x6:
-			printf("ori ");
-			break;
-		case 0x7:
-			printf("andi ");
-			break;
-		case 0x1:
-			printf("slli ");
-			break;
-		case 0x5:
-			if (funct7 == 0x00)
-				printf("srli ");
-			else if (funct7 == 0x20)
-				printf("srai ");
-			break;
-		}
-		printf("x%d, x%d, %d\n", rd, rs1, imm);
+	case FMT_LOAD:
+		printf("%s x%d, %d(x%d)\n", name, rd, imm, rs1);
 		break;
-	case 0x23: // S-type
-		imm = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
-		switch (funct3)
-		{
-		case 0x0:
-			printf("sb ");
-			break;
-		case 0x1:
-			printf("sh ");
-			break;
-		case 0x2:
-			printf("sw ");
-			break;
-		}
-		printf("x%d, %d(x%d)\n", rs2, imm, rs1);
+	case FMT_S:
+		printf("%s x%d, %d(x%d)\n", name, rs2, imm, rs1);
 		break;
-
-	case 0x63: // B-type branching
-		imm += ((instruction & 0x80) >> 7) << 11; // imm[11]
-		imm += ((instruction & 0xF00) >> 8) << 1; // imm[4:1]
-		imm += ((instruction & 0x7E000000) >> 25) << 5; // imm[10:5]
-		imm += ((instruction & 0x80000000) >> 31) << 12;  // imm[12]
-
-		switch (funct3){
-			case 0x0: printf("beq "); break;
-			case 0x1: printf("bne "); break;
-			case 0x4: printf("blt "); break;
-			case 0x5: printf("bge "); break;
-			case 0x6: printf("bltu "); break;					
-			case 0x7: printf("bgeu "); break;
-		}
-
-		offset = signExtend_13b(imm);
-		branchAddress = addr + offset;
-
-		printf("x%d, x%d, %s%x\n", rs1, rs2, branchHeader, branchAddress);
+	case FMT_B:
+		printf("%s x%d, x%d, %s%x\n", name, rs1, rs2, branchHeader, addr + imm);
 		break;
-
-	case 0x6F: // J-type instruction (only jal)
-		imm += ((instruction & 0xFF000) >> 12) << 12; //imm[19:12]
-		imm += ((instruction & 0x00100000) >> 20) << 11; //imm[11]
-		imm += ((instruction & 0x7FE00000) >> 21) << 1; //imm[10:1]
-		imm += ((instruction & 0x80000000) >> 31) << 20; //imm[20]
-
-		offset = signExtend_21b(imm);
-		branchAddress = addr + offset;
-
-		printf("jal x%d, %s%x\n", rd, branchHeader, branchAddress);
+	case FMT_U:
+		printf("%s x%d, 0x%x\n", name, rd, (uint32_t)imm >> 12);
+		break;
+	case FMT_J:
+		printf("%s x%d, %s%x\n", name, rd, branchHeader, addr + imm);
 		break;
-
 	default:
 		printf("unknown instruction\n");
 	}
 	return 0;
 }
 
-void print_program()
+void print_program(sim_t *sim)
 {
 	/* execute one instruction at a time. Use/update CURRENT_STATE and and NEXT_STATE, as necessary.*/
 	uint32_t addr;
 
-	for (addr = CURRENT_STATE.PC; addr < MEM_TEXT_END; addr += 4)
+	for (addr = sim->CURRENT_STATE.PC; addr < MEM_TEXT_END; addr += 4)
 	{
-		uint32_t instruction = mem_read_32(addr);
+		uint32_t instruction = mem_read_32(sim, addr);
 
 		print_instruction(instruction, TRUE, addr);
 	}
@@ -1173,73 +1853,85 @@ void print_program()
 /************************************************************/
 /* Print the current pipeline                               */
 /************************************************************/
-void show_pipeline()
+void show_pipeline(sim_t *sim)
 {
 	const char allZeroInstruction[] = "No Instruction Loaded";
+	char slot[8] = "";
+	uint32_t s;
 
-	printf("Current PC		%i\n", CURRENT_STATE.PC);
-	printf("IF/ID.IR		");
-	if (print_instruction(ID_IF.IR, FALSE, 0) != 0)
+	// The out-of-order core has no pipeline registers: show its ROB
+	if (sim->OOO_ENABLED)
 	{
-		printf("%s\n", allZeroInstruction);
+		ooo_show(&sim->OOO);
+		return;
 	}
-	printf("IF/ID.PC		%i\n", ID_IF.PC);
-
-	printf("\n");
 
-	printf("ID/EX.IR		");
-	if (print_instruction(IF_EX.IR, FALSE, 0) != 0)
+	printf("Current PC		%i\n", sim->CURRENT_STATE.PC);
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
 	{
-		printf("%s\n", allZeroInstruction);
+		// Slots are numbered only when there is more than one
+		if (sim->ISSUE_WIDTH > 1)
+		{
+			sprintf(slot, "[%u]", s);
+		}
+		printf("IF/ID%s.IR		", slot);
+		if (print_instruction(sim->ID_IF[s].IR, FALSE, 0) != 0)
+		{
+			printf("%s\n", allZeroInstruction);
+		}
+		printf("IF/ID%s.PC		%i\n", slot, sim->ID_IF[s].PC);
 	}
-	printf("ID/EX.A			%i\n", IF_EX.A);
-	printf("ID/EX.B			%i\n", IF_EX.B);
-	printf("ID/EX.imm		%i\n", IF_EX.imm);
 
 	printf("\n");
 
-	printf("EX/MEM.IR		");
-	if (print_instruction(EX_MEM.IR, FALSE, 0) != 0)
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
 	{
-		printf("%s\n", allZeroInstruction);
+		if (sim->ISSUE_WIDTH > 1)
+		{
+			sprintf(slot, "[%u]", s);
+		}
+		printf("ID/EX%s.IR		", slot);
+		if (print_instruction(sim->IF_EX[s].IR, FALSE, 0) != 0)
+		{
+			printf("%s\n", allZeroInstruction);
+		}
+		printf("ID/EX%s.A			%i\n", slot, sim->IF_EX[s].A);
+		printf("ID/EX%s.B			%i\n", slot, sim->IF_EX[s].B);
+		printf("ID/EX%s.imm		%i\n", slot, sim->IF_EX[s].imm);
 	}
-	printf("EX/MEM.A		%i\n", EX_MEM.A);
-	printf("EX/MEM.B		%i\n", EX_MEM.B);
-	printf("EX/MEM.ALUOutput	%i\n", EX_MEM.ALUOutput);
 
 	printf("\n");
 
-	printf("MEM/WB.IR		");
-	if (print_instruction(MEM_WB.IR, FALSE, 0) != 0)
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
 	{
-		printf("%s\n", allZeroInstruction);
+		if (sim->ISSUE_WIDTH > 1)
+		{
+			sprintf(slot, "[%u]", s);
+		}
+		printf("EX/MEM%s.IR		", slot);
+		if (print_instruction(sim->EX_MEM[s].IR, FALSE, 0) != 0)
+		{
+			printf("%s\n", allZeroInstruction);
+		}
+		printf("EX/MEM%s.A		%i\n", slot, sim->EX_MEM[s].A);
+		printf("EX/MEM%s.B		%i\n", slot, sim->EX_MEM[s].B);
+		printf("EX/MEM%s.ALUOutput	%i\n", slot, sim->EX_MEM[s].ALUOutput);
 	}
-	printf("MEM/WB.ALUOutput	%i\n", MEM_WB.ALUOutput);
-	printf("MEM/WB.LMD		%i\n", MEM_WB.LMD);
-}
-
-/***************************************************************/
-/* main                                                                                                                                   */
-/***************************************************************/
-int main(int argc, char *argv[])
-{
-	printf("\n**************************\n");
-	printf("Welcome to MU-RISCV SIM...\n");
-	printf("**************************\n\n");
 
-	if (argc < 2)
-	{
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n", argv[0]);
-		exit(1);
-	}
+	printf("\n");
 
-	strcpy(prog_file, argv[1]);
-	initialize();
-	load_program();
-	help();
-	while (1)
+	for (s = 0; s < sim->ISSUE_WIDTH; s++)
 	{
-		handle_command();
+		if (sim->ISSUE_WIDTH > 1)
+		{
+			sprintf(slot, "[%u]", s);
+		}
+		printf("MEM/WB%s.IR		", slot);
+		if (print_instruction(sim->MEM_WB[s].IR, FALSE, 0) != 0)
+		{
+			printf("%s\n", allZeroInstruction);
+		}
+		printf("MEM/WB%s.ALUOutput	%i\n", slot, sim->MEM_WB[s].ALUOutput);
+		printf("MEM/WB%s.LMD		%i\n", slot, sim->MEM_WB[s].LMD);
 	}
-	return 0;
 }
@@ -1,5 +1,15 @@
+#ifndef MU_RISCV_H
+#define MU_RISCV_H
+
 #include <stdint.h>
 
+#include "mu-bpred.h"
+#include "mu-cache.h"
+#include "mu-ooo.h"
+#include "mu-prefetch.h"
+#include "mu-storebuf.h"
+#include "mu-sweep.h"
+
 #define FALSE 0
 #define TRUE 1
 
@@ -22,26 +32,29 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END 0x10010000
 
+/* guest memory is allocated one page at a time, the first time the page is written */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_PAGE_COUNT (1 << (32 - MEM_PAGE_SHIFT))
+
 typedef struct
 {
 	uint32_t begin, end;
-	uint8_t *mem;
+	uint32_t touched; /* number of pages allocated so far */
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-	{MEM_TEXT_BEGIN, MEM_TEXT_END, NULL},
-	{MEM_DATA_BEGIN, MEM_DATA_END, NULL},
-	{MEM_KDATA_BEGIN, MEM_KDATA_END, NULL},
-	{MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL}};
+#define MEM_BIT_TEST(bits, page_num) ((bits)[(page_num) >> 5] & (1u << ((page_num) & 0x1F)))
+#define MEM_BIT_SET(bits, page_num) ((bits)[(page_num) >> 5] |= (1u << ((page_num) & 0x1F)))
+#define MEM_BIT_CLEAR(bits, page_num) ((bits)[(page_num) >> 5] &= ~(1u << ((page_num) & 0x1F)))
 
 #define NUM_MEM_REGION 4
 #define MIPS_REGS 32
 
-int ENABLE_FORWARDING = FALSE;
-int STALLING = FALSE;
-int NO_FORWARD_DELAY = -1;
-int BRANCH_DETECTED = FALSE;
+/* forward modes */
+#define FORWARD_NONE 0	 /* operands come from the register file once the producer has written back */
+#define FORWARD_LEGACY 1 /* ID forwards from EX/MEM and MEM/WB, but still stalls until write-back */
+#define FORWARD_BYPASS 2 /* hazard unit: EX->EX and MEM->EX bypass, one bubble for a load-use */
 
 typedef struct CPU_State_Struct
 {
@@ -62,60 +75,217 @@ typedef struct CPU_Pipeline_Reg_Struct
 	uint32_t LMD;
 	int RegWrite;
 	uint32_t RegisterRd;
+	bpred_info_t prediction; /* next PC IF fetched after this instruction */
 } CPU_Pipeline_Reg;
 
-// Define a struct to store information about the stalled instruction
+#define ISSUE_MAX 4
+
+typedef struct
+{
+	uint64_t bundles[ISSUE_MAX + 1]; /* cycles ID issued 0, 1, ... instructions */
+	uint64_t dependency;			 /* bundles cut short by a dependency on an earlier slot */
+	uint64_t memory_port;			 /* by a second load or store */
+	uint64_t branch;				 /* by a second branch or jump */
+	uint64_t muldiv;				 /* by a second multiply or divide */
+} issue_stats_t;
+
 typedef struct
 {
-	uint32_t opcode;
-	uint32_t rd;
-} StalledInstruction;
+	uint64_t stalls;	 /* cycles ID held an instruction for a data hazard */
+	uint64_t ex_bypass;	 /* operands taken from the instruction one ahead */
+	uint64_t mem_bypass; /* operands taken from the instruction two ahead */
+} hazard_stats_t;
 
-// Define a variable to store information about the stalled instruction
-StalledInstruction stalledInstruction;
+typedef struct
+{
+	uint64_t ops;
+	uint64_t busy;		 /* advances the unit was occupied: one per multiply, a divide's whole run */
+	uint64_t stalls;	 /* advances ID held an instruction for the unit */
+	uint64_t early_outs; /* divides done before the full latency */
+} unit_stats_t;
 
 /***************************************************************/
-/* CPU State info.                                                                                                               */
+/* One simulator: everything a stage reads or writes. Each instance   */
+/* is independent, so several can run on separate threads.              */
 /***************************************************************/
+typedef struct
+{
+	/***************************************************************/
+	/* Guest memory                                                                                  */
+	/***************************************************************/
+	mem_region_t MEM_REGIONS[NUM_MEM_REGION];
+	/* flat page directory indexed by guest page number, NULL until the page is written */
+	uint8_t **MEM_PAGE_TABLE;
+	/* pages as they were right after loading; shared with MEM_PAGE_TABLE until written */
+	uint8_t **MEM_SNAPSHOT_TABLE;
+	/* the most recently read page and the most recently written (private) page */
+	uint32_t LAST_PAGE_NUM, LAST_WRITE_PAGE_NUM;
+	uint8_t *LAST_PAGE, *LAST_WRITE_PAGE;
+	/* pages written since the snapshot, as a bitmap and as a list */
+	uint32_t *MEM_DIRTY_BITS;
+	uint32_t *MEM_DIRTY_LIST;
+	uint32_t MEM_DIRTY_COUNT, MEM_DIRTY_CAPACITY;
+	/* pages written since the last checkpoint, and their contents at the checkpoint */
+	uint32_t *MEM_CHECKPOINT_BITS;
+	uint8_t **MEM_CHECKPOINT_TABLE;
+	int CHECKPOINT_TAKEN;
+
+	int ENABLE_FORWARDING;
+	int REDIRECT; /* a misprediction was found: squash what follows the branch, fetch from REDIRECT_PC */
+	uint32_t REDIRECT_PC;
+	int BRANCH_IN_ID; /* B-type and jal resolve in ID instead of EX */
+
+	/***************************************************************/
+	/* CPU State info.                                                                                                               */
+	/***************************************************************/
+	CPU_State CURRENT_STATE, NEXT_STATE;
+	CPU_State LOADED_STATE; /* state right after load_program(), restored by reset() */
+	int RUN_FLAG; /* run flag*/
+	uint32_t INSTRUCTION_COUNT;
+	uint32_t CYCLE_COUNT;
+	uint32_t PROGRAM_SIZE; /*in words*/
+	uint32_t LAST_INST;	   /*last instruction executed*/
+
+	/***************************************************************/
+	/* Pipeline Registers.                                                                                                        */
+	/* Each holds a bundle of ISSUE_WIDTH slots, oldest instruction first.  */
+	/* ID_IF is the fetch buffer: FETCHED instructions wait there to issue. */
+	/***************************************************************/
+	uint32_t ISSUE_WIDTH;
+	uint32_t FETCHED;
+	CPU_Pipeline_Reg ID_IF[ISSUE_MAX];
+	CPU_Pipeline_Reg IF_EX[ISSUE_MAX];
+	CPU_Pipeline_Reg EX_MEM[ISSUE_MAX];
+	CPU_Pipeline_Reg MEM_WB[ISSUE_MAX];
+	issue_stats_t ISSUE_STATS;
+
+	/***************************************************************/
+	/* Memory hierarchy: L1 caches on the IF and MEM paths, a shared L2, DRAM. */
+	/***************************************************************/
+	cache_t L1I, L1D, L2;
+	dram_t DRAM;
+	int CACHE_ENABLED;
+	int L2_ENABLED;
+	uint32_t PIPE_STALL; /* cycles the whole pipeline stays frozen on a cache miss */
+	prefetcher_t PREFETCH; /* on the L1 D-cache path */
+	mshr_file_t MSHRS;	   /* of the L1 D-cache; with none every miss freezes the pipeline */
+	uint64_t REG_READY[MIPS_REGS]; /* cycle a non-blocking load's data reaches each register */
+	store_buffer_t STORE_BUFFER;   /* between MEM and the D-cache; with no entries stores write the cache in MEM */
+	trace_t TRACE;				   /* the IF/MEM address stream, when recording */
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG; /* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t CYCLE_COUNT;
-uint32_t PROGRAM_SIZE; /*in words*/
-uint32_t LAST_INST;	   /*last instruction executed*/
+	/***************************************************************/
+	/* Hazard unit for FORWARD_BYPASS: a scoreboard of when each register's */
+	/* value can be bypassed into EX, counted in pipeline advances so cache */
+	/* freezes do not age it.                                                                      */
+	/***************************************************************/
+	uint64_t PIPE_CLOCK;				/* times the stages have advanced */
+	uint64_t SCOREBOARD[MIPS_REGS];		/* advance from which an EX can use the register */
+	uint64_t SCOREBOARD_ISSUE[MIPS_REGS]; /* advance its producer left ID */
+	hazard_stats_t HAZARD_STATS;
+
+	/***************************************************************/
+	/* RV32M units beside the ALU in EX: a pipelined multiplier and an   */
+	/* iterative divider that stops early on short quotients. Their times */
+	/* count in pipeline advances too, in every forward mode.                  */
+	/***************************************************************/
+	uint32_t MUL_LATENCY;
+	uint32_t DIV_LATENCY;
+	uint64_t UNIT_READY[MIPS_REGS];			/* advance from which ID can issue a reader of the register */
+	unit_stats_t *UNIT_PRODUCER[MIPS_REGS]; /* the unit still to fill it */
+	uint64_t DIV_FREE;						/* advance from which ID can issue the next divide */
+	unit_stats_t MUL_STATS, DIV_STATS;
+
+	/***************************************************************/
+	/* Branch prediction in IF, resolution in EX                                             */
+	/***************************************************************/
+	bpred_t BPRED;
+
+	/***************************************************************/
+	/* Alternate core: out-of-order, Tomasulo with a ROB (mu-ooo.c). It   */
+	/* fetches, dispatches and commits ISSUE_WIDTH instructions a cycle;   */
+	/* CURRENT_STATE.PC is then the next instruction to commit.              */
+	/***************************************************************/
+	int OOO_ENABLED;
+	ooo_t OOO;
+} sim_t;
 
 /***************************************************************/
-/* Pipeline Registers.                                                                                                        */
+/* Library interface: a harness creates a simulator, loads a program */
+/* and steps it; nothing is shared between instances.                     */
 /***************************************************************/
-CPU_Pipeline_Reg ID_IF;
-CPU_Pipeline_Reg IF_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
-
-char prog_file[32];
+sim_t *sim_create(void);
+int sim_load(sim_t *sim, const char *path);
+uint32_t sim_step(sim_t *sim, uint32_t cycles);
+void sim_run(sim_t *sim);
+void sim_destroy(sim_t *sim);
 
 /***************************************************************/
 /* Function Declerations.                                                                                                */
 /***************************************************************/
-void help();
-uint32_t mem_read_32(uint32_t address);
-void mem_write_32(uint32_t address, uint32_t value);
-void cycle();
-void run(int num_cycles);
-void runAll();
-void mdump(uint32_t start, uint32_t stop);
-void rdump();
-void handle_command();
-void reset();
-void init_memory();
-void load_program();
-void handle_pipeline(); /*IMPLEMENT THIS*/
-void WB();				/*IMPLEMENT THIS*/
-void MEM();				/*IMPLEMENT THIS*/
-void EX();				/*IMPLEMENT THIS*/
-void ID();				/*IMPLEMENT THIS*/
-void IF();				/*IMPLEMENT THIS*/
-void show_pipeline();	/*IMPLEMENT THIS*/
-void initialize();
-void print_program(); /*IMPLEMENT THIS*/
+mem_region_t *mem_region(sim_t *sim, uint32_t address);
+void mem_mark_dirty(sim_t *sim, uint32_t page_num);
+void mem_mark_checkpoint(sim_t *sim, uint32_t page_num);
+uint8_t *mem_write_fault(sim_t *sim, uint32_t address);
+uint8_t mem_read_8(sim_t *sim, uint32_t address);
+uint16_t mem_read_16(sim_t *sim, uint32_t address);
+uint32_t mem_read_32(sim_t *sim, uint32_t address);
+void mem_write_8(sim_t *sim, uint32_t address, uint8_t value);
+void mem_write_16(sim_t *sim, uint32_t address, uint16_t value);
+void mem_write_32(sim_t *sim, uint32_t address, uint32_t value);
+void cycle(sim_t *sim);
+uint32_t cycle_until(sim_t *sim, uint64_t limit);
+uint64_t idle_cycles(sim_t *sim, unit_stats_t **unit);
+void mdump(sim_t *sim, uint32_t start, uint32_t stop);
+void mdiff(sim_t *sim, int since_load);
+void rdump(sim_t *sim);
+void reset(sim_t *sim);
+int init_memory(sim_t *sim);
+void mem_invalidate(sim_t *sim);
+void mem_snapshot(sim_t *sim);
+void mem_discard_page(sim_t *sim, uint32_t page_num);
+void mem_restore(sim_t *sim);
+void mem_clear_checkpoint(sim_t *sim);
+void mem_checkpoint(sim_t *sim);
+void mem_release(sim_t *sim, uint32_t begin, uint32_t end);
+void mem_free(sim_t *sim);
+void mem_stats(sim_t *sim);
+void cache_stall(sim_t *sim, uint32_t cycles);
+uint64_t dcache_access(sim_t *sim, uint32_t pc, uint32_t address, int write);
+uint32_t operand_wait(sim_t *sim, const uint32_t ir);
+void cache_hierarchy(sim_t *sim);
+int load_program(sim_t *sim, const char *path, int echo);
+void snapshot_program(sim_t *sim);
+void handle_pipeline(sim_t *sim); /*IMPLEMENT THIS*/
+uint32_t bundle_wait(sim_t *sim, const CPU_Pipeline_Reg *bundle, uint32_t slots);
+int pipeline_done(sim_t *sim);
+void MEM_slot(sim_t *sim, const CPU_Pipeline_Reg *in, CPU_Pipeline_Reg *out);
+void EX_slot(sim_t *sim, const CPU_Pipeline_Reg *in, CPU_Pipeline_Reg *out);
+uint8_t writes_rd(const uint32_t ir);
+const CPU_Pipeline_Reg *bundle_writer(sim_t *sim, const CPU_Pipeline_Reg *bundle, const uint32_t r);
+uint8_t forwarding(sim_t *sim, const uint32_t r, uint32_t *value);
+uint8_t legacy_hazard(sim_t *sim, const uint32_t rs, const uint32_t rt);
+void pipeline_bubble(CPU_Pipeline_Reg *reg);
+void branch_resolve(sim_t *sim, const CPU_Pipeline_Reg *reg, const uint32_t id, const int taken, const uint32_t A);
+uint8_t branch_hazard(sim_t *sim, const uint32_t rs, const uint32_t rt);
+uint32_t branch_operand(sim_t *sim, const uint32_t r);
+uint8_t reads_rs1(const uint32_t format);
+uint8_t reads_rs2(const uint32_t format);
+uint8_t scoreboard_hazard(sim_t *sim, const uint32_t ir, const uint64_t need);
+void scoreboard_issue(sim_t *sim, const uint32_t ir);
+uint32_t bypass_operand(sim_t *sim, const uint32_t r);
+void unit_start(sim_t *sim, const uint32_t id, const uint32_t rd, const uint32_t a, const uint32_t b);
+uint8_t unit_hazard(sim_t *sim, const uint32_t ir, const uint64_t need);
+uint64_t unit_wait(sim_t *sim, const uint32_t ir, const uint64_t need, unit_stats_t **unit);
+uint32_t core_read(void *context, uint32_t address, uint32_t size);
+void core_write(void *context, uint32_t address, uint32_t size, uint32_t value);
+uint32_t core_fetch_latency(void *context, uint32_t pc, uint64_t now);
+uint64_t core_data_ready(void *context, uint32_t pc, uint32_t address, int write, uint64_t now);
+void WB(sim_t *sim);				/*IMPLEMENT THIS*/
+void MEM(sim_t *sim);				/*IMPLEMENT THIS*/
+void EX(sim_t *sim);				/*IMPLEMENT THIS*/
+void ID(sim_t *sim);				/*IMPLEMENT THIS*/
+void IF(sim_t *sim);				/*IMPLEMENT THIS*/
+void show_pipeline(sim_t *sim);	/*IMPLEMENT THIS*/
+void print_program(sim_t *sim); /*IMPLEMENT THIS*/
+
+#endif
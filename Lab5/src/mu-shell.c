@@ -0,0 +1,1009 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mu-riscv.h"
+#include "mu-decode.h"
+
+/***************************************************************/
+/* Interactive shell around one simulator (mu-riscv.c)                         */
+/***************************************************************/
+void help();
+void handle_command(sim_t *sim);
+void run(sim_t *sim, int num_cycles);
+void runAll(sim_t *sim);
+void bench_memory(sim_t *sim);
+void bench_decode();
+void cache_command(sim_t *sim);
+void bpred_command(sim_t *sim);
+void bpred_compare(sim_t *sim, uint32_t cycles);
+void prefetch_command(sim_t *sim);
+void trace_command(sim_t *sim);
+void fu_command(sim_t *sim);
+void forward_command(sim_t *sim);
+void forward_compare(sim_t *sim, uint32_t cycles);
+void issue_command(sim_t *sim);
+void issue_compare(sim_t *sim, uint32_t cycles);
+void core_command(sim_t *sim);
+void core_compare(sim_t *sim, uint32_t cycles);
+
+/***************************************************************/
+/* Print out a list of commands available                                                                  */
+/***************************************************************/
+void help()
+{
+	printf("------------------------------------------------------------------\n\n");
+	printf("\t**********MU-RISCV Help MENU**********\n\n");
+	printf("sim\t-- simulate program to completion \n");
+	printf("run <n>\t-- simulate program for <n> instructions\n");
+	printf("rdump\t-- dump register values\n");
+	printf("reset\t-- restores all registers/memory to the freshly loaded program\n");
+	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
+	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
+	printf("mdiff <load|checkpoint>\t-- list words changed since load or the last checkpoint\n");
+	printf("checkpoint\t-- start a new checkpoint for mdiff\n");
+	printf("high <val>\t-- set the HI register to <val>\n");
+	printf("low <val>\t-- set the LO register to <val>\n");
+	printf("print\t-- print the program loaded into memory\n");
+	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("stats\t-- show memory pages touched and resident bytes\n");
+	printf("bench mem\t-- time memory accesses per second\n");
+	printf("bench decode\t-- time instruction decodes per second\n");
+	printf("forward [0|1|2]\t-- show hazard stats or set forwarding: off, on (stalls until write-back), full bypass\n");
+	printf("issue [1|2|4]\t-- show issue stats or set the issue width (resets the simulator)\n");
+	printf("issue compare [n]\t-- run the program for up to [n] cycles (default 100000) at every issue width\n");
+	printf("core [inorder|ooo]\t-- show the out-of-order core's stats or choose the core (resets the simulator)\n");
+	printf("core rob <n> | lsq <n>\t-- size the out-of-order core's reorder buffer or load/store queue\n");
+	printf("core <alu|branch|mem|mul|div> <rs entries> <units> <latency>\t-- configure a functional unit class\n");
+	printf("core compare [n]\t-- run the program for up to [n] cycles (default 100000) on each core\n");
+	printf("fu\t-- show multiply and divide unit utilization\n");
+	printf("fu <mul|div> <latency>\t-- set the multiplier's latency or the divider's worst case\n");
+	printf("forward compare [n]\t-- run the program for up to [n] cycles (default 100000) in every forward mode\n");
+	printf("cache\t-- show hits, misses, evictions and miss rate per cache level and DRAM\n");
+	printf("cache <i|d|l2> <size> <assoc> <block> <lru|plru|random> <wb|wt> <latency>\t-- reconfigure a cache\n");
+	printf("cache l2 <on|off|inclusive|exclusive|nine>\t-- enable / disable the L2 or set its inclusion policy\n");
+	printf("cache dram <latency> | <banks> <row bytes> <row hit> <row miss>\t-- fixed-latency or banked DRAM\n");
+	printf("cache mshr <n>\t-- give the D-cache <n> MSHRs (0 blocks on every miss)\n");
+	printf("cache sb <n>\t-- put an <n>-entry store buffer between MEM and the D-cache (0 for none)\n");
+	printf("cache <on|off>\t-- enable / disable the cache model\n");
+	printf("prefetch [none|next|stride|stream] [degree]\t-- show or choose the D-cache prefetcher\n");
+	printf("bpred [not-taken|btfn|bimodal|gshare|tournament] [bits] [btb bits]\t-- show or choose the branch predictor\n");
+	printf("bpred ras <n>\t-- predict returns with an <n>-entry return address stack (0 for none)\n");
+	printf("bpred resolve [ex|id]\t-- show or choose the stage that resolves branches and jal\n");
+	printf("bpred compare [n]\t-- run the program for up to [n] cycles (default 100000) under every predictor\n");
+	printf("trace record <file>\t-- record the IF/MEM address stream of the following runs\n");
+	printf("trace stop\t-- stop recording\n");
+	printf("trace sweep <file> [block] [lru|plru|random]\t-- miss rates of the trace across cache sizes and ways\n");
+	printf("?\t-- display help menu\n");
+	printf("quit\t-- exit the simulator\n\n");
+	printf("------------------------------------------------------------------\n\n");
+}
+
+/***************************************************************/
+/* Simulate RISCV for n cycles                                                                                       */
+/***************************************************************/
+void run(sim_t *sim, int num_cycles)
+{
+
+	if (sim->RUN_FLAG == FALSE)
+	{
+		printf("Simulation Stopped\n\n");
+		return;
+	}
+
+	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	int i;
+	for (i = 0; i < num_cycles;)
+	{
+		if (sim->RUN_FLAG == FALSE)
+		{
+			printf("Simulation Stopped.\n\n");
+			break;
+		}
+		i += cycle_until(sim, (uint64_t)sim->CYCLE_COUNT + num_cycles - i);
+	}
+}
+
+/***************************************************************/
+/* simulate to completion                                                                                               */
+/***************************************************************/
+void runAll(sim_t *sim)
+{
+	if (sim->RUN_FLAG == FALSE)
+	{
+		printf("Simulation Stopped.\n\n");
+		return;
+	}
+
+	printf("Simulation Started...\n\n");
+	while (!pipeline_done(sim))
+	{
+		cycle_until(sim, UINT32_MAX);
+	}
+	printf("Simulation Finished.\n\n");
+}
+
+/***************************************************************/
+/* Read a command from standard input.                                                               */
+/***************************************************************/
+void handle_command(sim_t *sim)
+{
+	char buffer[20];
+	uint32_t start, stop, cycles;
+	uint32_t register_no;
+	int register_value;
+	int hi_reg_value, lo_reg_value;
+
+	printf("MU-RISCV SIM:> ");
+
+	if (scanf("%s", buffer) == EOF)
+	{
+		exit(0);
+	}
+
+	switch (buffer[0])
+	{
+	case 'S':
+	case 's':
+		if (buffer[1] == 'h' || buffer[1] == 'H')
+		{
+			show_pipeline(sim);
+		}
+		else if (buffer[1] == 't' || buffer[1] == 'T')
+		{
+			mem_stats(sim);
+		}
+		else
+		{
+			runAll(sim);
+		}
+		break;
+	case 'M':
+	case 'm':
+		if (buffer[1] == 'd' && (buffer[2] == 'i' || buffer[2] == 'I'))
+		{
+			if (scanf("%19s", buffer) != 1)
+			{
+				break;
+			}
+			if (buffer[0] == 'l' || buffer[0] == 'L')
+			{
+				mdiff(sim, TRUE);
+			}
+			else if (buffer[0] == 'c' || buffer[0] == 'C')
+			{
+				mdiff(sim, FALSE);
+			}
+			else
+			{
+				printf("Invalid Command.\n");
+			}
+			break;
+		}
+		if (scanf("%x %x", &start, &stop) != 2)
+		{
+			break;
+		}
+		mdump(sim, start, stop);
+		break;
+	case 'C':
+	case 'c':
+		if (strcmp(buffer, "cache") == 0)
+		{
+			cache_command(sim);
+			break;
+		}
+		if (strcmp(buffer, "core") == 0)
+		{
+			core_command(sim);
+			break;
+		}
+		mem_checkpoint(sim);
+		printf("Checkpoint taken after %u instructions.\n\n", sim->INSTRUCTION_COUNT);
+		break;
+	case 'B':
+	case 'b':
+		if (strcmp(buffer, "bpred") == 0)
+		{
+			bpred_command(sim);
+			break;
+		}
+		if (scanf("%19s", buffer) != 1)
+		{
+			break;
+		}
+		if (strcmp(buffer, "mem") == 0)
+		{
+			bench_memory(sim);
+		}
+		else if (strcmp(buffer, "decode") == 0)
+		{
+			bench_decode();
+		}
+		else
+		{
+			printf("Invalid Command.\n");
+		}
+		break;
+	case 'T':
+	case 't':
+		trace_command(sim);
+		break;
+	case '?':
+		help();
+		break;
+	case 'Q':
+	case 'q':
+		printf("**************************\n");
+		printf("Exiting MU-RISCV! Good Bye...\n");
+		printf("**************************\n");
+		exit(0);
+	case 'R':
+	case 'r':
+		if (buffer[1] == 'd' || buffer[1] == 'D')
+		{
+			rdump(sim);
+		}
+		else if (buffer[1] == 'e' || buffer[1] == 'E')
+		{
+			reset(sim);
+		}
+		else
+		{
+			if (scanf("%d", &cycles) != 1)
+			{
+				break;
+			}
+			run(sim, cycles);
+		}
+		break;
+	case 'I':
+	case 'i':
+		if (strcmp(buffer, "issue") == 0)
+		{
+			issue_command(sim);
+			break;
+		}
+		if (scanf("%u %i", &register_no, &register_value) != 2)
+		{
+			break;
+		}
+		sim->CURRENT_STATE.REGS[register_no] = register_value;
+		sim->NEXT_STATE.REGS[register_no] = register_value;
+		break;
+	case 'H':
+	case 'h':
+		if (scanf("%i", &hi_reg_value) != 1)
+		{
+			break;
+		}
+		sim->CURRENT_STATE.HI = hi_reg_value;
+		sim->NEXT_STATE.HI = hi_reg_value;
+		break;
+	case 'L':
+	case 'l':
+		if (scanf("%i", &lo_reg_value) != 1)
+		{
+			break;
+		}
+		sim->CURRENT_STATE.LO = lo_reg_value;
+		sim->NEXT_STATE.LO = lo_reg_value;
+		break;
+	case 'P':
+	case 'p':
+		if (strcmp(buffer, "prefetch") == 0)
+		{
+			prefetch_command(sim);
+			break;
+		}
+		print_program(sim);
+		break;
+	case 'f':
+	case 'F':
+		if (strcmp(buffer, "fu") == 0)
+		{
+			fu_command(sim);
+			break;
+		}
+		forward_command(sim);
+		break;
+	default:
+		printf("Invalid Command.\n");
+		break;
+	}
+}
+
+/***************************************************************/
+/* Millions of operations per second since a clock() start time                      */
+/***************************************************************/
+double bench_rate(uint32_t operations, clock_t start)
+{
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	return seconds > 0 ? operations / seconds / 1e6 : 0;
+}
+
+/***************************************************************/
+/* Time the memory layer in word accesses per second                                 */
+/***************************************************************/
+void bench_memory(sim_t *sim)
+{
+	const uint32_t accesses = 1 << 24;
+	const uint32_t window = 1 << 20; /* scratch pages in kernel data, released afterwards */
+	const uint32_t base = MEM_KDATA_BEGIN;
+	uint32_t i, checksum = 0;
+	clock_t start;
+
+	printf("Timing %u word accesses per pattern...\n\n", accesses);
+
+	start = clock();
+	for (i = 0; i < accesses; i++)
+	{
+		mem_write_32(sim, base + ((i << 2) & (window - 1)), i);
+	}
+	printf("sequential writes\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+
+	start = clock();
+	for (i = 0; i < accesses; i++)
+	{
+		checksum += mem_read_32(sim, base + ((i << 2) & (window - 1)));
+	}
+	printf("sequential reads\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+
+	// One access per page defeats the last-page shortcut and exercises the directory
+	start = clock();
+	for (i = 0; i < accesses; i++)
+	{
+		checksum += mem_read_32(sim, base + ((i * (MEM_PAGE_SIZE + 4)) & (window - 1)));
+	}
+	printf("page-strided reads\t: %.1f M accesses/s\n", bench_rate(accesses, start));
+	printf("(checksum 0x%08x)\n\n", checksum);
+
+	mem_release(sim, base, base + window - 1);
+}
+
+/***************************************************************/
+/* Time the decoder over a mix of RV32I encodings and random words */
+/***************************************************************/
+void bench_decode()
+{
+	const uint32_t decodes = 1 << 24;
+	const uint32_t window = 1 << 12; /* words, small enough to stay in L1 */
+	uint32_t *words = malloc(window * sizeof(uint32_t));
+	uint32_t i, seed = 12345, checksum = 0;
+	clock_t start;
+
+	if (words == NULL)
+	{
+		printf("Error: Out of memory allocating the decode benchmark\n");
+		return;
+	}
+	// Mostly valid instructions with random operands; every eighth word is arbitrary
+	for (i = 0; i < window; i++)
+	{
+		uint32_t id = 1 + (seed >> 16) % (INST_COUNT - 1);
+		seed = seed * 1103515245 + 12345;
+		words[i] = (i & 7) ? ISA_MATCH[id] | (seed & ~ISA_MASK[id]) : seed;
+		seed = seed * 1103515245 + 12345;
+	}
+
+	printf("Timing %u decodes...\n\n", decodes);
+
+	// What ID and EX do per instruction: look up the instruction, its immediate and whether it writes rd
+	start = clock();
+	for (i = 0; i < decodes; i++)
+	{
+		uint32_t word = words[i & (window - 1)];
+		uint32_t id = isa_decode(word);
+		checksum += id + isa_imm(word, ISA_FORMAT[id]) + FMT_WRITES_RD[ISA_FORMAT[id]];
+	}
+	printf("table lookup\t: %.1f M decodes/s\n", bench_rate(decodes, start));
+	printf("(checksum 0x%08x)\n\n", checksum);
+
+	free(words);
+}
+
+/***************************************************************/
+/* cache [on|off]                                                                    */
+/* cache <i|d|l2> <size> <assoc> <block> <repl> <wb|wt> <latency>        */
+/* cache l2 <on|off|inclusive|exclusive|nine>                                */
+/* cache dram <latency> | cache dram <banks> <row bytes> <row hit> <row miss> */
+/* cache mshr <n> | cache sb <entries>                                          */
+/***************************************************************/
+void cache_command(sim_t *sim)
+{
+	char line[128], which[8], repl[16], write[16];
+	cache_config_t config;
+	dram_config_t dram;
+	cache_t *cache;
+	uint32_t mshrs, entries;
+	int fields;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%7s", which) != 1)
+	{
+		printf("Cache model %s\n\n", sim->CACHE_ENABLED ? "on" : "off");
+		cache_print_stats(&sim->L1I);
+		cache_print_stats(&sim->L1D);
+		if (sim->PREFETCH.kind != PREFETCH_NONE)
+		{
+			prefetch_print_stats(&sim->PREFETCH);
+		}
+		if (sim->MSHRS.count > 0)
+		{
+			mshr_print_stats(&sim->MSHRS);
+		}
+		if (sim->STORE_BUFFER.size > 0)
+		{
+			store_buffer_print_stats(&sim->STORE_BUFFER);
+		}
+		if (sim->L2_ENABLED)
+		{
+			cache_print_stats(&sim->L2);
+		}
+		dram_print_stats(&sim->DRAM);
+		return;
+	}
+
+	if (strcmp(which, "on") == 0 || strcmp(which, "off") == 0)
+	{
+		sim->CACHE_ENABLED = strcmp(which, "on") == 0;
+		printf("Cache model %s\n\n", sim->CACHE_ENABLED ? "on" : "off");
+		return;
+	}
+
+	if (strcmp(which, "mshr") == 0)
+	{
+		if (sscanf(line, "%*s %u", &mshrs) != 1)
+		{
+			printf("Invalid Command.\n");
+		}
+		else if (mshr_init(&sim->MSHRS, mshrs))
+		{
+			mshr_print_stats(&sim->MSHRS);
+		}
+		return;
+	}
+
+	if (strcmp(which, "sb") == 0)
+	{
+		if (sscanf(line, "%*s %u", &entries) != 1)
+		{
+			printf("Invalid Command.\n");
+		}
+		else if (store_buffer_init(&sim->STORE_BUFFER, entries))
+		{
+			store_buffer_print_stats(&sim->STORE_BUFFER);
+		}
+		return;
+	}
+
+	if (strcmp(which, "dram") == 0)
+	{
+		memset(&dram, 0, sizeof(dram));
+		fields = sscanf(line, "%*s %u %u %u %u", &dram.banks, &dram.row_size, &dram.latency, &dram.row_miss_latency);
+		if (fields == 1)
+		{
+			dram.latency = dram.banks;
+			dram.banks = 0;
+		}
+		else if (fields != 4)
+		{
+			printf("Invalid Command.\n");
+			return;
+		}
+		if (dram_init(&sim->DRAM, &dram))
+		{
+			dram_print_stats(&sim->DRAM);
+		}
+		return;
+	}
+
+	cache = strcmp(which, "i") == 0 ? &sim->L1I : strcmp(which, "d") == 0 ? &sim->L1D : strcmp(which, "l2") == 0 ? &sim->L2 : NULL;
+	if (cache == &sim->L2 && sscanf(line, "%*s %15s", repl) == 1 && (repl[0] < '0' || repl[0] > '9'))
+	{
+		if (strcmp(repl, "on") == 0 || strcmp(repl, "off") == 0)
+		{
+			sim->L2_ENABLED = strcmp(repl, "on") == 0;
+		}
+		else if (strcmp(repl, "inclusive") == 0 || strcmp(repl, "exclusive") == 0 || strcmp(repl, "nine") == 0)
+		{
+			sim->L2.inclusion = repl[0] == 'i' ? INCLUSION_INCLUSIVE : repl[0] == 'e' ? INCLUSION_EXCLUSIVE : INCLUSION_NINE;
+		}
+		else
+		{
+			printf("Invalid Command.\n");
+			return;
+		}
+		cache_hierarchy(sim);
+		printf("L2 %s, %s\n\n", sim->L2_ENABLED ? "on" : "off", cache_inclusion_name(sim->L2.inclusion));
+		return;
+	}
+	if (cache == NULL || sscanf(line, "%*s %u %u %u %15s %15s %u", &config.size, &config.assoc, &config.block,
+								repl, write, &config.latency) != 6)
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	config.repl = strcmp(repl, "plru") == 0 ? REPL_PLRU : strcmp(repl, "random") == 0 ? REPL_RANDOM : REPL_LRU;
+	config.write = strcmp(write, "wt") == 0 ? WRITE_THROUGH : WRITE_BACK;
+	if (cache_init(cache, cache->name, &config))
+	{
+		// Blocks held above may no longer be in a resized L2
+		cache_reset(&sim->L1I);
+		cache_reset(&sim->L1D);
+		cache_reset(&sim->L2);
+		prefetch_reset(&sim->PREFETCH);
+		mshr_reset(&sim->MSHRS);
+		store_buffer_reset(&sim->STORE_BUFFER);
+		cache_hierarchy(sim);
+		cache_print_stats(cache);
+	}
+}
+
+/***************************************************************/
+/* prefetch [none|next|stride|stream] [degree]                                     */
+/***************************************************************/
+void prefetch_command(sim_t *sim)
+{
+	char line[64], kind[16];
+	uint32_t degree = 4;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s %u", kind, &degree) < 1)
+	{
+		prefetch_print_stats(&sim->PREFETCH);
+		return;
+	}
+	if (strcmp(kind, "none") == 0)
+	{
+		prefetch_init(&sim->PREFETCH, PREFETCH_NONE, degree);
+	}
+	else if (strcmp(kind, "next") == 0)
+	{
+		prefetch_init(&sim->PREFETCH, PREFETCH_NEXT_LINE, degree);
+	}
+	else if (strcmp(kind, "stride") == 0)
+	{
+		prefetch_init(&sim->PREFETCH, PREFETCH_STRIDE, degree);
+	}
+	else if (strcmp(kind, "stream") == 0)
+	{
+		prefetch_init(&sim->PREFETCH, PREFETCH_STREAM, degree);
+	}
+	else
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	prefetch_print_stats(&sim->PREFETCH);
+}
+
+/***************************************************************/
+/* Show the branch predictor, switch it, or compare every kind                 */
+/***************************************************************/
+void bpred_command(sim_t *sim)
+{
+	static const char *const names[] = {"not-taken", "btfn", "bimodal", "gshare", "tournament"};
+	char line[64], kind[16];
+	uint32_t bits = sim->BPRED.bits, btb_bits = sim->BPRED.btb_bits, i;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s %u %u", kind, &bits, &btb_bits) < 1)
+	{
+		bpred_print_stats(&sim->BPRED, sim->INSTRUCTION_COUNT, sim->CYCLE_COUNT);
+		return;
+	}
+	if (strcmp(kind, "compare") == 0)
+	{
+		uint32_t cycles = 100000;
+
+		sscanf(line, "%*s %u", &cycles);
+		bpred_compare(sim, cycles);
+		return;
+	}
+	if (strcmp(kind, "resolve") == 0)
+	{
+		char stage[8] = "";
+
+		sscanf(line, "%*s %7s", stage);
+		if (strcmp(stage, "id") == 0 || strcmp(stage, "ex") == 0)
+		{
+			sim->BRANCH_IN_ID = strcmp(stage, "id") == 0;
+		}
+		else if (stage[0] != '\0')
+		{
+			printf("Invalid Command.\n");
+			return;
+		}
+		printf("Branches and jal resolve in %s, jalr in EX\n\n", sim->BRANCH_IN_ID ? "ID" : "EX");
+		return;
+	}
+	if (strcmp(kind, "ras") == 0)
+	{
+		uint32_t depth = sim->BPRED.ras_depth;
+
+		sscanf(line, "%*s %u", &depth);
+		if (bpred_ras_init(&sim->BPRED, depth))
+		{
+			bpred_print_stats(&sim->BPRED, sim->INSTRUCTION_COUNT, sim->CYCLE_COUNT);
+		}
+		return;
+	}
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (strcmp(kind, names[i]) == 0)
+		{
+			break;
+		}
+	}
+	if (i == sizeof(names) / sizeof(names[0]))
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	if (bpred_init(&sim->BPRED, (bpred_kind_t)i, bits, btb_bits))
+	{
+		bpred_print_stats(&sim->BPRED, sim->INSTRUCTION_COUNT, sim->CYCLE_COUNT);
+	}
+}
+
+/***************************************************************/
+/* Run the loaded program from reset under each predictor                       */
+/***************************************************************/
+void bpred_compare(sim_t *sim, uint32_t cycles)
+{
+	const bpred_kind_t original = sim->BPRED.kind;
+	bpred_kind_t kind;
+
+	printf("Branches resolve in %s\n", sim->BRANCH_IN_ID ? "ID" : "EX");
+	printf("%-12s %10s %8s %8s %10s %12s\n", "predictor", "accuracy", "MPKI", "CPI", "cycles", "instructions");
+	for (kind = BPRED_NOT_TAKEN; kind <= BPRED_TOURNAMENT; kind++)
+	{
+		const bpred_stats_t *stats = &sim->BPRED.stats;
+		uint32_t misses;
+
+		bpred_init(&sim->BPRED, kind, sim->BPRED.bits, sim->BPRED.btb_bits);
+		reset(sim);
+		while (sim->CYCLE_COUNT < cycles && !pipeline_done(sim))
+		{
+			cycle_until(sim, cycles);
+		}
+		misses = stats->branch_misses + stats->jump_misses;
+		printf("%-12s %9.2f%% %8.2f %8.3f %10u %12u\n", bpred_name(kind),
+			   stats->branches ? 100.0 * (stats->branches - stats->branch_misses) / stats->branches : 0.0,
+			   sim->INSTRUCTION_COUNT ? 1000.0 * misses / sim->INSTRUCTION_COUNT : 0.0,
+			   sim->INSTRUCTION_COUNT ? (double)sim->CYCLE_COUNT / sim->INSTRUCTION_COUNT : 0.0, sim->CYCLE_COUNT, sim->INSTRUCTION_COUNT);
+	}
+	printf("\n");
+
+	bpred_init(&sim->BPRED, original, sim->BPRED.bits, sim->BPRED.btb_bits);
+	reset(sim);
+}
+
+/***************************************************************/
+/* Show the hazard stats, set the forward mode, or compare every mode  */
+/***************************************************************/
+void forward_command(sim_t *sim)
+{
+	static const char *const names[] = {"OFF", "ON", "ON with full bypass"};
+	char line[64], mode[16];
+	uint32_t cycles = 100000;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s", mode) < 1)
+	{
+		printf("Forwarding %s\n", names[sim->ENABLE_FORWARDING]);
+		printf("  hazard stalls\t: %llu\n", (unsigned long long)sim->HAZARD_STATS.stalls);
+		printf("  EX->EX bypasses\t: %llu\n", (unsigned long long)sim->HAZARD_STATS.ex_bypass);
+		printf("  MEM->EX bypasses\t: %llu\n", (unsigned long long)sim->HAZARD_STATS.mem_bypass);
+		printf("  CPI\t\t: %.3f\n\n", sim->INSTRUCTION_COUNT ? (double)sim->CYCLE_COUNT / sim->INSTRUCTION_COUNT : 0.0);
+		return;
+	}
+	if (strcmp(mode, "compare") == 0)
+	{
+		sscanf(line, "%*s %u", &cycles);
+		forward_compare(sim, cycles);
+		return;
+	}
+	if (strcmp(mode, "0") != 0 && strcmp(mode, "1") != 0 && strcmp(mode, "2") != 0)
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	sim->ENABLE_FORWARDING = mode[0] - '0';
+	printf("Forwarding %s\n", names[sim->ENABLE_FORWARDING]);
+}
+
+/***************************************************************/
+/* Run the loaded program from reset in each forward mode                       */
+/***************************************************************/
+void forward_compare(sim_t *sim, uint32_t cycles)
+{
+	static const char *const names[] = {"off", "on", "bypass"};
+	const int original = sim->ENABLE_FORWARDING;
+
+	printf("%-8s %10s %12s %8s %10s %10s %10s\n", "forward", "cycles", "instructions", "CPI", "stalls", "EX->EX",
+		   "MEM->EX");
+	for (sim->ENABLE_FORWARDING = FORWARD_NONE; sim->ENABLE_FORWARDING <= FORWARD_BYPASS; sim->ENABLE_FORWARDING++)
+	{
+		reset(sim);
+		while (sim->CYCLE_COUNT < cycles && !pipeline_done(sim))
+		{
+			cycle_until(sim, cycles);
+		}
+		printf("%-8s %10u %12u %8.3f %10llu %10llu %10llu\n", names[sim->ENABLE_FORWARDING], sim->CYCLE_COUNT,
+			   sim->INSTRUCTION_COUNT, sim->INSTRUCTION_COUNT ? (double)sim->CYCLE_COUNT / sim->INSTRUCTION_COUNT : 0.0,
+			   (unsigned long long)sim->HAZARD_STATS.stalls, (unsigned long long)sim->HAZARD_STATS.ex_bypass,
+			   (unsigned long long)sim->HAZARD_STATS.mem_bypass);
+	}
+	printf("\n");
+
+	sim->ENABLE_FORWARDING = original;
+	reset(sim);
+}
+
+/***************************************************************/
+/* Show the issue stats, set the issue width, or compare every width   */
+/***************************************************************/
+void issue_command(sim_t *sim)
+{
+	char line[64], word[16];
+	uint32_t width, cycles = 100000, i;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s", word) < 1)
+	{
+		printf("Issue width %u\n", sim->ISSUE_WIDTH);
+		for (i = 0; i <= sim->ISSUE_WIDTH; i++)
+		{
+			printf("  %u issued\t: %llu cycles\n", i, (unsigned long long)sim->ISSUE_STATS.bundles[i]);
+		}
+		printf("  cut by dependency\t: %llu\n", (unsigned long long)sim->ISSUE_STATS.dependency);
+		printf("  cut by memory port\t: %llu\n", (unsigned long long)sim->ISSUE_STATS.memory_port);
+		printf("  cut by branch unit\t: %llu\n", (unsigned long long)sim->ISSUE_STATS.branch);
+		printf("  cut by mul/div unit\t: %llu\n", (unsigned long long)sim->ISSUE_STATS.muldiv);
+		printf("  IPC\t\t: %.3f\n\n", sim->CYCLE_COUNT ? (double)sim->INSTRUCTION_COUNT / sim->CYCLE_COUNT : 0.0);
+		return;
+	}
+	if (strcmp(word, "compare") == 0)
+	{
+		sscanf(line, "%*s %u", &cycles);
+		issue_compare(sim, cycles);
+		return;
+	}
+	if (sscanf(word, "%u", &width) != 1 || (width != 1 && width != 2 && width != 4))
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	// Bundles in flight would lose their upper slots: start the program again
+	sim->ISSUE_WIDTH = width;
+	reset(sim);
+	printf("Issue width %u\n\n", sim->ISSUE_WIDTH);
+}
+
+/***************************************************************/
+/* Run the loaded program from reset at each issue width                          */
+/***************************************************************/
+void issue_compare(sim_t *sim, uint32_t cycles)
+{
+	const uint32_t original = sim->ISSUE_WIDTH;
+
+	printf("%-6s %10s %12s %8s %12s %12s %12s\n", "width", "cycles", "instructions", "IPC", "dependency",
+		   "memory port", "branch unit");
+	for (sim->ISSUE_WIDTH = 1; sim->ISSUE_WIDTH <= ISSUE_MAX; sim->ISSUE_WIDTH *= 2)
+	{
+		reset(sim);
+		while (sim->CYCLE_COUNT < cycles && !pipeline_done(sim))
+		{
+			cycle_until(sim, cycles);
+		}
+		printf("%-6u %10u %12u %8.3f %12llu %12llu %12llu\n", sim->ISSUE_WIDTH, sim->CYCLE_COUNT, sim->INSTRUCTION_COUNT,
+			   sim->CYCLE_COUNT ? (double)sim->INSTRUCTION_COUNT / sim->CYCLE_COUNT : 0.0,
+			   (unsigned long long)sim->ISSUE_STATS.dependency, (unsigned long long)sim->ISSUE_STATS.memory_port,
+			   (unsigned long long)sim->ISSUE_STATS.branch);
+	}
+	printf("\n");
+
+	sim->ISSUE_WIDTH = original;
+	reset(sim);
+}
+
+/***************************************************************/
+/* Show multiply and divide unit utilization or set a unit's latency  */
+/***************************************************************/
+void fu_command(sim_t *sim)
+{
+	char line[64], unit[16];
+	uint32_t latency;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s", unit) < 1)
+	{
+		if (sim->OOO_ENABLED)
+		{
+			ooo_print_stats(&sim->OOO);
+			return;
+		}
+		printf("Multiply and divide units over %llu advances\n", (unsigned long long)sim->PIPE_CLOCK);
+		printf("  mul\t: latency %u, pipelined, %llu ops, %.2f%% busy, %llu stalls\n", sim->MUL_LATENCY,
+			   (unsigned long long)sim->MUL_STATS.ops, sim->PIPE_CLOCK ? 100.0 * sim->MUL_STATS.busy / sim->PIPE_CLOCK : 0.0,
+			   (unsigned long long)sim->MUL_STATS.stalls);
+		printf("  div\t: latency up to %u, iterative, %llu ops (%llu early outs), %.2f%% busy, %llu stalls\n\n",
+			   sim->DIV_LATENCY, (unsigned long long)sim->DIV_STATS.ops, (unsigned long long)sim->DIV_STATS.early_outs,
+			   sim->PIPE_CLOCK ? 100.0 * sim->DIV_STATS.busy / sim->PIPE_CLOCK : 0.0, (unsigned long long)sim->DIV_STATS.stalls);
+		return;
+	}
+	if ((strcmp(unit, "mul") != 0 && strcmp(unit, "div") != 0) || sscanf(line, "%*s %u", &latency) != 1 ||
+		latency < 1 || latency > OOO_LATENCY_MAX)
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	// Both cores take the new latency from the next operation on
+	if (unit[0] == 'm')
+	{
+		sim->MUL_LATENCY = sim->OOO.config.latency[FU_MUL] = latency;
+	}
+	else
+	{
+		sim->DIV_LATENCY = sim->OOO.config.latency[FU_DIV] = latency;
+	}
+	printf("%s latency %u\n\n", unit, latency);
+}
+
+/***************************************************************/
+/* Show the out-of-order core's stats, choose the core, configure it,  */
+/* or compare the two                                                                       */
+/***************************************************************/
+void core_command(sim_t *sim)
+{
+	char line[96], word[16];
+	ooo_config_t config = sim->OOO.config;
+	uint32_t cycles = 100000, fu;
+	int valid = FALSE;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%15s", word) < 1)
+	{
+		printf("Core: %s\n", sim->OOO_ENABLED ? "out-of-order" : "in-order pipeline");
+		ooo_print_stats(&sim->OOO);
+		return;
+	}
+	if (strcmp(word, "compare") == 0)
+	{
+		sscanf(line, "%*s %u", &cycles);
+		core_compare(sim, cycles);
+		return;
+	}
+	if (strcmp(word, "inorder") == 0 || strcmp(word, "ooo") == 0)
+	{
+		// Nothing in flight carries over from one core to the other: start the program again
+		sim->OOO_ENABLED = word[0] == 'o';
+		reset(sim);
+		printf("Core: %s\n\n", sim->OOO_ENABLED ? "out-of-order" : "in-order pipeline");
+		return;
+	}
+
+	if (strcmp(word, "rob") == 0)
+	{
+		valid = sscanf(line, "%*s %u", &config.rob_size) == 1;
+	}
+	else if (strcmp(word, "lsq") == 0)
+	{
+		valid = sscanf(line, "%*s %u", &config.lsq_size) == 1;
+	}
+	else
+	{
+		for (fu = 0; fu < FU_CLASSES; fu++)
+		{
+			if (strcmp(word, ooo_unit_name(fu)) == 0)
+			{
+				valid = sscanf(line, "%*s %u %u %u", &config.rs_size[fu], &config.units[fu], &config.latency[fu]) == 3;
+			}
+		}
+	}
+	if (!valid)
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+	// In-flight instructions may not fit the new sizes: start the program again
+	if (ooo_configure(&sim->OOO, &config))
+	{
+		// Both cores share the multiply and divide latencies
+		sim->MUL_LATENCY = config.latency[FU_MUL];
+		sim->DIV_LATENCY = config.latency[FU_DIV];
+		reset(sim);
+		ooo_print_stats(&sim->OOO);
+	}
+}
+
+/***************************************************************/
+/* Run the loaded program from reset on each core                              */
+/***************************************************************/
+void core_compare(sim_t *sim, uint32_t cycles)
+{
+	static const char *const names[] = {"in-order", "ooo"};
+	const int original = sim->OOO_ENABLED;
+
+	printf("%-9s %10s %12s %8s %12s\n", "core", "cycles", "instructions", "IPC", "mispredicts");
+	for (sim->OOO_ENABLED = FALSE; sim->OOO_ENABLED <= TRUE; sim->OOO_ENABLED++)
+	{
+		reset(sim);
+		while (sim->CYCLE_COUNT < cycles && !pipeline_done(sim))
+		{
+			cycle_until(sim, cycles);
+		}
+		printf("%-9s %10u %12u %8.3f %12llu\n", names[sim->OOO_ENABLED], sim->CYCLE_COUNT, sim->INSTRUCTION_COUNT,
+			   sim->CYCLE_COUNT ? (double)sim->INSTRUCTION_COUNT / sim->CYCLE_COUNT : 0.0,
+			   (unsigned long long)(sim->BPRED.stats.branch_misses + sim->BPRED.stats.jump_misses));
+	}
+	printf("\n");
+
+	sim->OOO_ENABLED = original;
+	reset(sim);
+}
+
+/***************************************************************/
+/* trace record <file> | trace stop | trace sweep <file> [block] [repl]  */
+/***************************************************************/
+void trace_command(sim_t *sim)
+{
+	char line[160], action[8], path[128], repl[16] = "lru";
+	uint32_t block = 32;
+
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%7s", action) != 1)
+	{
+		printf("Invalid Command.\n");
+		return;
+	}
+
+	if (strcmp(action, "stop") == 0)
+	{
+		trace_record_stop(&sim->TRACE);
+	}
+	else if (strcmp(action, "record") == 0 && sscanf(line, "%*s %127s", path) == 1)
+	{
+		if (trace_record_start(&sim->TRACE, path))
+		{
+			printf("Recording the address stream to %s.\n\n", path);
+		}
+	}
+	else if (strcmp(action, "sweep") == 0 && sscanf(line, "%*s %127s %u %15s", path, &block, repl) >= 1)
+	{
+		// Make sure everything recorded so far is on disk
+		trace_record_stop(&sim->TRACE);
+		trace_sweep(path, block, strcmp(repl, "plru") == 0 ? REPL_PLRU : strcmp(repl, "random") == 0 ? REPL_RANDOM : REPL_LRU);
+	}
+	else
+	{
+		printf("Invalid Command.\n");
+	}
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+	sim_t *sim;
+
+	printf("\n**************************\n");
+	printf("Welcome to MU-RISCV SIM...\n");
+	printf("**************************\n\n");
+
+	if (argc < 2)
+	{
+		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n", argv[0]);
+		exit(1);
+	}
+
+	sim = sim_create();
+	if (sim == NULL || !load_program(sim, argv[1], TRUE))
+	{
+		exit(-1);
+	}
+	snapshot_program(sim);
+	help();
+	while (1)
+	{
+		handle_command(sim);
+	}
+	return 0;
+}
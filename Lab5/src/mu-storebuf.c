@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mu-storebuf.h"
+
+/***************************************************************/
+/* Size the buffer; returns 0 if the size is out of range                       */
+/***************************************************************/
+int store_buffer_init(store_buffer_t *buffer, uint32_t size)
+{
+	if (size > STORE_BUFFER_MAX)
+	{
+		printf("Error: the store buffer holds at most %d stores\n", STORE_BUFFER_MAX);
+		return 0;
+	}
+	buffer->size = size;
+	store_buffer_reset(buffer);
+	return 1;
+}
+
+void store_buffer_reset(store_buffer_t *buffer)
+{
+	buffer->head = 0;
+	buffer->count = 0;
+	buffer->draining = 0;
+	buffer->busy_until = 0;
+	memset(&buffer->stats, 0, sizeof(buffer->stats));
+}
+
+static store_entry_t *store_entry(store_buffer_t *buffer, uint32_t i)
+{
+	return &buffer->entries[(buffer->head + i) % STORE_BUFFER_MAX];
+}
+
+static void store_pop(store_buffer_t *buffer)
+{
+	buffer->head = (buffer->head + 1) % STORE_BUFFER_MAX;
+	buffer->count--;
+	buffer->draining = 0;
+	buffer->stats.drained++;
+}
+
+// Write the oldest store to the cache once the previous write is done; returns when it completes
+static uint64_t store_write(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint64_t at)
+{
+	const store_entry_t *entry = store_entry(buffer, 0);
+
+	if (buffer->busy_until > at)
+	{
+		at = buffer->busy_until;
+	}
+	buffer->busy_until = at + prefetch_access(prefetcher, cache, entry->pc, entry->address, 1, at);
+	return buffer->busy_until;
+}
+
+// Drain every store up to and including entry last; returns the cycle the last one completes
+static uint64_t store_drain_through(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint32_t last,
+									uint64_t now)
+{
+	uint64_t done = buffer->draining ? buffer->busy_until : store_write(buffer, prefetcher, cache, now);
+	uint32_t i;
+
+	store_pop(buffer);
+	for (i = 0; i < last; i++)
+	{
+		done = store_write(buffer, prefetcher, cache, done);
+		store_pop(buffer);
+	}
+	return done;
+}
+
+/***************************************************************/
+/* Once a cycle: retire the head store when its write completes and    */
+/* start the next one. Runs while the pipeline is frozen too.                */
+/***************************************************************/
+void store_buffer_tick(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint64_t now)
+{
+	if (buffer->draining && buffer->busy_until <= now)
+	{
+		store_pop(buffer);
+	}
+	if (buffer->count > 0 && !buffer->draining)
+	{
+		store_write(buffer, prefetcher, cache, now);
+		buffer->draining = 1;
+	}
+}
+
+/***************************************************************/
+/* Buffer a store; returns the cycles MEM waits for a free entry            */
+/***************************************************************/
+uint32_t store_buffer_push(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint32_t pc,
+						   uint32_t address, uint32_t size, uint32_t value, uint64_t now)
+{
+	store_entry_t *entry;
+	uint32_t wait = 0;
+
+	if (buffer->count == buffer->size)
+	{
+		uint64_t done = store_drain_through(buffer, prefetcher, cache, 0, now);
+
+		wait = done > now ? (uint32_t)(done - now) : 1;
+		buffer->stats.full++;
+		buffer->stats.full_cycles += wait;
+	}
+	entry = store_entry(buffer, buffer->count);
+	entry->address = address;
+	entry->pc = pc;
+	entry->size = size;
+	entry->value = value;
+	buffer->count++;
+	buffer->stats.stores++;
+	return wait;
+}
+
+/***************************************************************/
+/* Look a load up, youngest store first. A store that holds every byte */
+/* forwards its data; one that holds only some is drained first and   */
+/* *wait gets the cycles that takes.                                                    */
+/***************************************************************/
+store_buffer_match_t store_buffer_forward(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache,
+										  uint32_t address, uint32_t size, uint32_t *value, uint32_t *wait,
+										  uint64_t now)
+{
+	uint32_t i;
+
+	*wait = 0;
+	for (i = buffer->count; i-- > 0;)
+	{
+		const store_entry_t *entry = store_entry(buffer, i);
+		uint64_t done;
+
+		if (address >= entry->address + entry->size || entry->address >= address + size)
+		{
+			continue;
+		}
+		if (entry->address <= address && address + size <= entry->address + entry->size)
+		{
+			*value = entry->value >> (8 * (address - entry->address));
+			if (size < 4)
+			{
+				*value &= (1u << (8 * size)) - 1;
+			}
+			buffer->stats.forwarded++;
+			return STORE_BUFFER_FORWARD;
+		}
+		done = store_drain_through(buffer, prefetcher, cache, i, now);
+		*wait = done > now ? (uint32_t)(done - now) : 0;
+		buffer->stats.partial++;
+		buffer->stats.partial_cycles += *wait;
+		return STORE_BUFFER_PARTIAL;
+	}
+	return STORE_BUFFER_MISS;
+}
+
+void store_buffer_print_stats(const store_buffer_t *buffer)
+{
+	const store_buffer_stats_t *stats = &buffer->stats;
+
+	if (buffer->size == 0)
+	{
+		printf("Store buffer: none, stores write the D-cache in MEM\n\n");
+		return;
+	}
+	printf("Store buffer: %u entries, %u pending\n", buffer->size, buffer->count);
+	printf("  stores\t: %llu\n", (unsigned long long)stats->stores);
+	printf("  drained\t: %llu\n", (unsigned long long)stats->drained);
+	printf("  loads forwarded\t: %llu\n", (unsigned long long)stats->forwarded);
+	printf("  partial overlaps\t: %llu (%llu cycles)\n", (unsigned long long)stats->partial,
+		   (unsigned long long)stats->partial_cycles);
+	printf("  full\t\t: %llu (%llu cycles)\n\n", (unsigned long long)stats->full,
+		   (unsigned long long)stats->full_cycles);
+}
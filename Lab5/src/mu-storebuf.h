@@ -0,0 +1,63 @@
+#ifndef MU_STOREBUF_H
+#define MU_STOREBUF_H
+
+#include <stdint.h>
+
+#include "mu-cache.h"
+#include "mu-prefetch.h"
+
+/***************************************************************/
+/* Store buffer between MEM and the D-cache                                             */
+/* Stores wait here and drain to the cache one at a time in program   */
+/* order; loads check it first and take their data from the youngest   */
+/* store that covers them.                                                                      */
+/***************************************************************/
+
+#define STORE_BUFFER_MAX 64
+
+typedef enum
+{
+	STORE_BUFFER_MISS,	  /* no buffered store touches the load's bytes */
+	STORE_BUFFER_FORWARD, /* the youngest overlapping store holds every byte */
+	STORE_BUFFER_PARTIAL  /* it holds only some: the load waits for it to drain */
+} store_buffer_match_t;
+
+typedef struct
+{
+	uint32_t address, pc;
+	uint32_t value; /* low size bytes are stored */
+	uint32_t size;	/* 1, 2 or 4 */
+} store_entry_t;
+
+typedef struct
+{
+	uint64_t stores;
+	uint64_t drained;
+	uint64_t forwarded;		 /* loads served from the buffer */
+	uint64_t partial;		 /* loads that waited for a partially overlapping store */
+	uint64_t partial_cycles;
+	uint64_t full;			 /* stores that waited for a free entry */
+	uint64_t full_cycles;
+} store_buffer_stats_t;
+
+typedef struct
+{
+	uint32_t size; /* entries, 0 sends stores straight to the cache */
+	store_entry_t entries[STORE_BUFFER_MAX];
+	uint32_t head, count;
+	int draining;		 /* the head store is being written to the cache */
+	uint64_t busy_until; /* cycle the head store's write completes */
+	store_buffer_stats_t stats;
+} store_buffer_t;
+
+int store_buffer_init(store_buffer_t *buffer, uint32_t size);
+void store_buffer_reset(store_buffer_t *buffer);
+void store_buffer_tick(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint64_t now);
+uint32_t store_buffer_push(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache, uint32_t pc,
+						   uint32_t address, uint32_t size, uint32_t value, uint64_t now);
+store_buffer_match_t store_buffer_forward(store_buffer_t *buffer, prefetcher_t *prefetcher, cache_t *cache,
+										  uint32_t address, uint32_t size, uint32_t *value, uint32_t *wait,
+										  uint64_t now);
+void store_buffer_print_stats(const store_buffer_t *buffer);
+
+#endif
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mu-sweep.h"
+
+#define TRACE_MAGIC "MUTRACE1"
+
+/* the sweep grid: 1KB..128KB by 1..128 ways */
+#define SWEEP_SIZES 8
+#define SWEEP_WAYS 8
+#define SWEEP_MIN_SIZE 1024
+
+/***************************************************************/
+/* Recording                                                                                           */
+/***************************************************************/
+int trace_record_start(trace_t *trace, const char *path)
+{
+	trace_record_stop(trace);
+	trace->file = fopen(path, "wb");
+	if (trace->file == NULL)
+	{
+		printf("Error: Can't open trace file %s\n", path);
+		return 0;
+	}
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace->file);
+	memset(trace->last, 0, sizeof(trace->last));
+	trace->records = 0;
+	return 1;
+}
+
+void trace_record_stop(trace_t *trace)
+{
+	if (trace->file != NULL)
+	{
+		fclose(trace->file);
+		trace->file = NULL;
+		printf("Trace closed after %llu accesses.\n\n", (unsigned long long)trace->records);
+	}
+}
+
+int trace_recording(const trace_t *trace)
+{
+	return trace->file != NULL;
+}
+
+void trace_record(trace_t *trace, trace_kind_t kind, uint32_t address)
+{
+	int32_t delta;
+	uint64_t value;
+
+	if (trace->file == NULL)
+	{
+		return;
+	}
+	delta = (int32_t)(address - trace->last[kind]);
+	trace->last[kind] = address;
+	value = ((uint64_t)(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31)) << 2) | kind;
+	while (value >= 0x80)
+	{
+		putc((int)(value & 0x7F) | 0x80, trace->file);
+		value >>= 7;
+	}
+	putc((int)value, trace->file);
+	trace->records++;
+}
+
+/***************************************************************/
+/* Loading a trace into an instruction and a data stream                         */
+/***************************************************************/
+typedef struct
+{
+	uint32_t *address;
+	uint8_t *write;
+	size_t count, capacity;
+} sweep_stream_t;
+
+static void stream_push(sweep_stream_t *stream, uint32_t address, int write)
+{
+	if (stream->count == stream->capacity)
+	{
+		stream->capacity = stream->capacity ? 2 * stream->capacity : 4096;
+		stream->address = realloc(stream->address, stream->capacity * sizeof(uint32_t));
+		stream->write = realloc(stream->write, stream->capacity);
+		if (stream->address == NULL || stream->write == NULL)
+		{
+			printf("Error: Out of memory loading the trace\n");
+			exit(-1);
+		}
+	}
+	stream->address[stream->count] = address;
+	stream->write[stream->count] = write;
+	stream->count++;
+}
+
+static int trace_load(const char *path, sweep_stream_t *fetches, sweep_stream_t *data)
+{
+	char magic[sizeof(TRACE_MAGIC)] = {0};
+	uint32_t last[3] = {0, 0, 0};
+	FILE *fp = fopen(path, "rb");
+	int c;
+
+	if (fp == NULL)
+	{
+		printf("Error: Can't open trace file %s\n", path);
+		return 0;
+	}
+	if (fread(magic, 1, strlen(TRACE_MAGIC), fp) != strlen(TRACE_MAGIC) || strcmp(magic, TRACE_MAGIC) != 0)
+	{
+		printf("Error: %s is not a trace file\n", path);
+		fclose(fp);
+		return 0;
+	}
+
+	while ((c = getc(fp)) != EOF)
+	{
+		uint64_t value = c & 0x7F;
+		uint32_t shift = 7, zigzag, kind;
+
+		while ((c & 0x80) && (c = getc(fp)) != EOF)
+		{
+			value |= (uint64_t)(c & 0x7F) << shift;
+			shift += 7;
+		}
+		kind = value & 3;
+		if (kind > TRACE_STORE)
+		{
+			break;
+		}
+		zigzag = (uint32_t)(value >> 2);
+		last[kind] += (zigzag >> 1) ^ -(zigzag & 1);
+		stream_push(kind == TRACE_FETCH ? fetches : data, last[kind], kind == TRACE_STORE);
+	}
+	fclose(fp);
+	return 1;
+}
+
+/***************************************************************/
+/* Sweep tasks                                                                                       */
+/* LRU: one pass per set count builds a stack-distance histogram that   */
+/* gives the misses of every associativity at once (Mattson et al.).     */
+/* Other policies: one direct simulation per configuration.                  */
+/***************************************************************/
+typedef struct
+{
+	const sweep_stream_t *stream;
+	cache_config_t config;	/* simulated configuration, or block size for a stack pass */
+	uint32_t sets;			/* stack pass: sets, and config.assoc is the deepest stack kept */
+	int stack;
+	uint64_t *histogram;	/* stack pass: hits at each depth, then misses beyond */
+	uint64_t misses;		/* simulation */
+} sweep_task_t;
+
+typedef struct
+{
+	sweep_task_t *tasks;
+	uint32_t count, next;
+	pthread_mutex_t lock;
+} sweep_queue_t;
+
+static uint32_t log2_of(uint32_t value)
+{
+	uint32_t bits = 0;
+
+	while ((1u << bits) < value)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+static void sweep_stack_pass(sweep_task_t *task)
+{
+	const sweep_stream_t *stream = task->stream;
+	uint32_t ways = task->config.assoc, block_bits = log2_of(task->config.block);
+	uint32_t *stacks = malloc((size_t)task->sets * ways * sizeof(uint32_t));
+	uint32_t *depth = calloc(task->sets, sizeof(uint32_t));
+	size_t i;
+
+	task->histogram = calloc(ways + 1, sizeof(uint64_t));
+	if (stacks == NULL || depth == NULL || task->histogram == NULL)
+	{
+		printf("Error: Out of memory in the cache sweep\n");
+		exit(-1);
+	}
+
+	for (i = 0; i < stream->count; i++)
+	{
+		uint32_t block = stream->address[i] >> block_bits;
+		uint32_t set = block & (task->sets - 1);
+		uint32_t *stack = &stacks[(size_t)set * ways];
+		uint32_t position = 0;
+
+		while (position < depth[set] && stack[position] != block)
+		{
+			position++;
+		}
+		task->histogram[position < depth[set] ? position : ways]++;
+		if (position == depth[set] && depth[set] < ways)
+		{
+			depth[set]++;
+		}
+		if (position == ways)
+		{
+			position = ways - 1;
+		}
+		// Move to the top of the stack, pushing the rest down
+		memmove(&stack[1], &stack[0], position * sizeof(uint32_t));
+		stack[0] = block;
+	}
+	free(stacks);
+	free(depth);
+}
+
+static void sweep_simulate(sweep_task_t *task)
+{
+	cache_t cache;
+	size_t i;
+
+	memset(&cache, 0, sizeof(cache));
+	cache_init(&cache, "sweep", &task->config);
+	for (i = 0; i < task->stream->count; i++)
+	{
+		cache_access(&cache, task->stream->address[i], task->stream->write[i], 0);
+	}
+	task->misses = cache.stats.misses;
+	cache_free(&cache);
+}
+
+static void *sweep_worker(void *argument)
+{
+	sweep_queue_t *queue = argument;
+
+	while (1)
+	{
+		sweep_task_t *task;
+
+		pthread_mutex_lock(&queue->lock);
+		task = queue->next < queue->count ? &queue->tasks[queue->next++] : NULL;
+		pthread_mutex_unlock(&queue->lock);
+		if (task == NULL)
+		{
+			return NULL;
+		}
+		if (task->stack)
+		{
+			sweep_stack_pass(task);
+		}
+		else
+		{
+			sweep_simulate(task);
+		}
+	}
+}
+
+/***************************************************************/
+/* Miss rate of one grid point, -1 if the cache cannot be built          */
+/***************************************************************/
+static double sweep_miss_rate(const sweep_task_t *tasks, uint32_t count, const sweep_stream_t *stream,
+							  uint32_t size, uint32_t ways, uint32_t block)
+{
+	uint32_t i, depth;
+
+	if (stream->count == 0)
+	{
+		return -1.0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		const sweep_task_t *task = &tasks[i];
+		uint64_t hits = 0;
+
+		if (task->stream != stream)
+		{
+			continue;
+		}
+		if (!task->stack && task->config.size == size && task->config.assoc == ways)
+		{
+			return (double)task->misses / stream->count;
+		}
+		if (task->stack && task->sets == size / (ways * block))
+		{
+			for (depth = 0; depth < ways; depth++)
+			{
+				hits += task->histogram[depth];
+			}
+			return (double)(stream->count - hits) / stream->count;
+		}
+	}
+	return -1.0;
+}
+
+static void sweep_print(const char *title, const sweep_task_t *tasks, uint32_t count, const sweep_stream_t *stream,
+						uint32_t block)
+{
+	uint32_t s, w;
+
+	printf("%s miss rate (%llu accesses)\n", title, (unsigned long long)stream->count);
+	printf("size   ");
+	for (w = 0; w < SWEEP_WAYS; w++)
+	{
+		printf("%7u-way", 1u << w);
+	}
+	printf("\n");
+	for (s = 0; s < SWEEP_SIZES; s++)
+	{
+		uint32_t size = SWEEP_MIN_SIZE << s;
+
+		printf("%4uKB ", size >> 10);
+		for (w = 0; w < SWEEP_WAYS; w++)
+		{
+			double rate = sweep_miss_rate(tasks, count, stream, size, 1u << w, block);
+
+			if (rate < 0)
+			{
+				printf("%11s", "-");
+			}
+			else
+			{
+				printf("%10.2f%%", 100.0 * rate);
+			}
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/***************************************************************/
+/* Replay a trace against the whole grid, spread across host threads      */
+/***************************************************************/
+void trace_sweep(const char *path, uint32_t block, cache_repl_t repl)
+{
+	sweep_stream_t fetches = {0}, data = {0};
+	const sweep_stream_t *streams[2] = {&fetches, &data};
+	sweep_queue_t queue;
+	pthread_t *threads;
+	struct timespec begin, end;
+	uint32_t i, s, w, thread_count, points = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (block < 4 || (block & (block - 1)) != 0)
+	{
+		printf("Error: block size must be a power of two of at least 4 bytes\n");
+		return;
+	}
+	if (!trace_load(path, &fetches, &data))
+	{
+		return;
+	}
+
+	// One task per set count for LRU, one per grid point otherwise
+	queue.tasks = calloc(2 * SWEEP_SIZES * SWEEP_WAYS, sizeof(sweep_task_t));
+	queue.count = 0;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+	for (i = 0; i < 2; i++)
+	{
+		for (s = 0; s < SWEEP_SIZES; s++)
+		{
+			for (w = 0; w < SWEEP_WAYS; w++)
+			{
+				uint32_t size = SWEEP_MIN_SIZE << s, ways = 1u << w, sets, j;
+				sweep_task_t *task = &queue.tasks[queue.count];
+
+				if (size < ways * block || (repl == REPL_PLRU && ways > 64))
+				{
+					continue;
+				}
+				points++;
+				sets = size / (ways * block);
+				if (repl == REPL_LRU)
+				{
+					// Reuse the pass for this set count, deepening it if needed
+					for (j = 0; j < queue.count; j++)
+					{
+						if (queue.tasks[j].stream == streams[i] && queue.tasks[j].sets == sets)
+						{
+							break;
+						}
+					}
+					if (j < queue.count)
+					{
+						if (queue.tasks[j].config.assoc < ways)
+						{
+							queue.tasks[j].config.assoc = ways;
+						}
+						continue;
+					}
+					task->stack = 1;
+					task->sets = sets;
+				}
+				task->stream = streams[i];
+				task->config.size = size;
+				task->config.assoc = ways;
+				task->config.block = block;
+				task->config.repl = repl;
+				task->config.write = WRITE_BACK;
+				queue.count++;
+			}
+		}
+	}
+
+	thread_count = cpus > 0 ? (uint32_t)cpus : 1;
+	if (thread_count > queue.count)
+	{
+		thread_count = queue.count;
+	}
+	threads = malloc(thread_count * sizeof(pthread_t));
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < thread_count; i++)
+	{
+		pthread_create(&threads[i], NULL, sweep_worker, &queue);
+	}
+	for (i = 0; i < thread_count; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("Swept %u configurations per stream (%u passes) in %.3f s on %u threads, %u-byte blocks, %s%s\n\n",
+		   points / 2, queue.count, (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9, thread_count,
+		   block, cache_repl_name(repl), repl == REPL_LRU ? " (stack distance)" : "");
+	sweep_print("I-cache", queue.tasks, queue.count, &fetches, block);
+	sweep_print("D-cache", queue.tasks, queue.count, &data, block);
+
+	for (i = 0; i < queue.count; i++)
+	{
+		free(queue.tasks[i].histogram);
+	}
+	free(queue.tasks);
+	free(threads);
+	pthread_mutex_destroy(&queue.lock);
+	free(fetches.address);
+	free(fetches.write);
+	free(data.address);
+	free(data.write);
+}
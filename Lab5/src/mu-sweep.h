@@ -0,0 +1,38 @@
+#ifndef MU_SWEEP_H
+#define MU_SWEEP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mu-cache.h"
+
+/***************************************************************/
+/* Address traces and multi-configuration cache sweeps                            */
+/*                                                                                                    */
+/* A trace is the "MUTRACE1" header followed by one varint per access:  */
+/* the zigzag delta from the previous address of the same kind, shifted  */
+/* left two bits, with the kind in the low bits.                                        */
+/***************************************************************/
+
+typedef enum
+{
+	TRACE_FETCH, /* IF() */
+	TRACE_LOAD,	 /* MEM() */
+	TRACE_STORE	 /* MEM() */
+} trace_kind_t;
+
+/* a recording in progress, one per simulator */
+typedef struct
+{
+	FILE *file;		  /* NULL when not recording */
+	uint32_t last[3]; /* previous address of each kind */
+	uint64_t records;
+} trace_t;
+
+int trace_record_start(trace_t *trace, const char *path);
+void trace_record_stop(trace_t *trace);
+int trace_recording(const trace_t *trace);
+void trace_record(trace_t *trace, trace_kind_t kind, uint32_t address);
+void trace_sweep(const char *path, uint32_t block, cache_repl_t repl);
+
+#endif